@@ -0,0 +1,120 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "benchmark.hh"
+#include <ctx/ConcurrentCtxMap.hh>
+#include <ctx/CtxMap.hh>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+// Measure the cost of writing a block of result keys after each iteration
+// of a computation, either by individual calls to update or using a batch,
+// which applies all updates in a single traversal of the tree. The keys
+// are either written in the order of a counter (like "item10" after "item9")
+// or scattered over many subtrees in random order.
+
+int main() {
+  using namespace ctx;
+  using namespace ctx::benchmarks;
+
+  const size_t repeats = 20;
+  size_t checksum      = 0;
+
+  std::cout << "Writing all keys of a subtree (ns per key)" << std::endl;
+  for (size_t n = 1000; n <= 10000; n *= 10) {
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < n; ++i) keys.push_back("scf/results/item" + std::to_string(i));
+
+    CtxMap map;
+    const double t_update = time_per_call_ns(
+          [&] {
+            for (size_t i = 0; i < n; ++i) map.update(keys[i], static_cast<int>(i));
+          },
+          repeats);
+    const double t_batch = time_per_call_ns(
+          [&] {
+            CtxMapBatch batch = map.batch();
+            for (size_t i = 0; i < n; ++i) batch.update(keys[i], static_cast<int>(i));
+            batch.commit();
+          },
+          repeats);
+    checksum += map.subtree_size("/");
+
+    ConcurrentCtxMap concurrent;
+    const double t_concurrent_update = time_per_call_ns(
+          [&] {
+            for (size_t i = 0; i < n; ++i) {
+              concurrent.update(keys[i], static_cast<int>(i));
+            }
+          },
+          repeats);
+    const double t_concurrent_batch = time_per_call_ns(
+          [&] {
+            CtxMapBatch batch = concurrent.batch();
+            for (size_t i = 0; i < n; ++i) batch.update(keys[i], static_cast<int>(i));
+            batch.commit();
+          },
+          repeats);
+    checksum += concurrent.subtree_size("/");
+
+    const double per_key = static_cast<double>(n);
+    print_row("CtxMap::update               ", n, t_update / per_key, "ns");
+    print_row("CtxMap batch                 ", n, t_batch / per_key, "ns");
+    print_row("ConcurrentCtxMap::update     ", n, t_concurrent_update / per_key, "ns");
+    print_row("ConcurrentCtxMap batch       ", n, t_concurrent_batch / per_key, "ns");
+  }
+
+  std::cout << "Writing keys scattered over many subtrees (ns per key)" << std::endl;
+  for (size_t n = 1000; n <= 100000; n *= 10) {
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < n; ++i) keys.push_back(data_key(i * 997));
+    std::shuffle(std::begin(keys), std::end(keys), std::mt19937(42));
+
+    CtxMap map;
+    const double t_update = time_per_call_ns(
+          [&] {
+            for (size_t i = 0; i < n; ++i) map.update(keys[i], static_cast<int>(i));
+          },
+          repeats);
+    const double t_batch = time_per_call_ns(
+          [&] {
+            CtxMapBatch batch = map.batch();
+            for (size_t i = 0; i < n; ++i) batch.update(keys[i], static_cast<int>(i));
+            batch.commit();
+          },
+          repeats);
+    CtxMap fresh;
+    const double t_batch_new = time_per_call_ns(
+          [&] {
+            fresh = CtxMap();
+            CtxMapBatch batch = fresh.batch();
+            for (size_t i = 0; i < n; ++i) batch.update(keys[i], static_cast<int>(i));
+            batch.commit();
+          },
+          repeats);
+    checksum += map.subtree_size("/") + fresh.subtree_size("/");
+
+    const double per_key = static_cast<double>(n);
+    print_row("CtxMap::update               ", n, t_update / per_key, "ns");
+    print_row("CtxMap batch                 ", n, t_batch / per_key, "ns");
+    print_row("CtxMap batch (new keys)      ", n, t_batch_new / per_key, "ns");
+  }
+
+  std::cout << "(checksum " << checksum << ")" << std::endl;
+  return 0;
+}
@@ -0,0 +1,51 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+namespace ctx {
+namespace benchmarks {
+
+/** Return the average time in nanoseconds a call to ``f`` takes,
+ *  estimated by ``repeats`` consecutive calls. */
+template <typename F>
+double time_per_call_ns(F&& f, size_t repeats) {
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < repeats; ++i) f();
+  const auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() /
+         static_cast<double>(repeats);
+}
+
+/** Build the key of the i-th entry of a synthetic data tree, which
+ *  groups 1000 entries into one block, e.g. "/data/block12/item345". */
+inline std::string data_key(size_t i) {
+  return "/data/block" + std::to_string(i / 1000) + "/item" + std::to_string(i % 1000);
+}
+
+/** Print a result line of a benchmark table */
+inline void print_row(const std::string& label, size_t n, double value,
+                      const std::string& unit) {
+  std::cout << "  " << label << "  n = " << n << "  :  " << value << " " << unit
+            << std::endl;
+}
+
+}  // namespace benchmarks
+}  // namespace ctx
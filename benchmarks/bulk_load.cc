@@ -0,0 +1,87 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "benchmark.hh"
+#include <algorithm>
+#include <ctx/CtxMap.hh>
+#include <utility>
+#include <vector>
+
+// Measure the cost of loading many entries (e.g. an input deck or restart
+// data) into a CtxMap, either one by one or using assign, for keys given
+// in the order of the map and in a scrambled order.
+
+int main() {
+  using namespace ctx;
+  using namespace ctx::benchmarks;
+
+  const size_t repeats = 5;
+  size_t checksum      = 0;
+
+  std::cout << "Loading entries into an empty map (ns per entry)" << std::endl;
+  for (size_t n = 10000; n <= 1000000; n *= 10) {
+    std::vector<std::pair<std::string, double>> sorted;
+    for (size_t i = 0; i < n; ++i) {
+      sorted.emplace_back(data_key(i), static_cast<double>(i));
+    }
+    std::sort(std::begin(sorted), std::end(sorted),
+              [](const std::pair<std::string, double>& lhs,
+                 const std::pair<std::string, double>& rhs) {
+                return CtxMap::key_comparator_type{}(lhs.first, rhs.first);
+              });
+
+    // Interleave the blocks, such that consecutive keys share no subtree
+    std::vector<std::pair<std::string, double>> scrambled;
+    for (size_t i = 0; i < n; ++i) scrambled.push_back(sorted[(i * 7919) % n]);
+
+    const double t_update = time_per_call_ns(
+          [&] {
+            CtxMap map;
+            for (const auto& kv : sorted) map.update(kv.first, kv.second);
+            checksum += map.subtree_size("/");
+          },
+          repeats);
+    const double t_assign = time_per_call_ns(
+          [&] {
+            CtxMap map(std::begin(sorted), std::end(sorted));
+            checksum += map.subtree_size("/");
+          },
+          repeats);
+    const double t_update_scrambled = time_per_call_ns(
+          [&] {
+            CtxMap map;
+            for (const auto& kv : scrambled) map.update(kv.first, kv.second);
+            checksum += map.subtree_size("/");
+          },
+          repeats);
+    const double t_assign_scrambled = time_per_call_ns(
+          [&] {
+            CtxMap map(std::begin(scrambled), std::end(scrambled));
+            checksum += map.subtree_size("/");
+          },
+          repeats);
+
+    const double per_entry = static_cast<double>(n);
+    print_row("update (sorted keys)         ", n, t_update / per_entry, "ns");
+    print_row("assign (sorted keys)         ", n, t_assign / per_entry, "ns");
+    print_row("update (scrambled keys)      ", n, t_update_scrambled / per_entry, "ns");
+    print_row("assign (scrambled keys)      ", n, t_assign_scrambled / per_entry, "ns");
+  }
+
+  std::cout << "(checksum " << checksum << ")" << std::endl;
+  return 0;
+}
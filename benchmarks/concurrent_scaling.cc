@@ -0,0 +1,101 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "benchmark.hh"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctx/ConcurrentCtxMap.hh>
+#include <thread>
+#include <vector>
+
+// Measure the throughput of a ConcurrentCtxMap accessed from 1 to N threads
+// with different ratios of reads and writes. Each thread mostly works in its
+// own top-level subtree, but every tenth access goes to a random other subtree.
+// A map with a single shard (i.e. one lock shared by all writers) is shown
+// for comparison.
+
+namespace {
+using namespace ctx;
+
+/** Total number of map accesses per second (in millions) achieved by
+ *  n_threads threads, of which read_percent percent are reads. */
+double throughput(ConcurrentCtxMap& map, size_t n_threads, size_t read_percent,
+                  size_t keys_per_subtree, size_t ops_per_thread,
+                  std::atomic<size_t>& checksum) {
+  auto worker = [&](size_t t) {
+    size_t local = 0;
+    uint64_t rng = 0x9e3779b97f4a7c15ull * (t + 1);
+    for (size_t i = 0; i < ops_per_thread; ++i) {
+      rng ^= rng << 13;
+      rng ^= rng >> 7;
+      rng ^= rng << 17;
+      const size_t subtree = (rng % 10 == 0) ? (rng >> 8) % n_threads : t;
+      const std::string key = "/subtree" + std::to_string(subtree) + "/item" +
+                              std::to_string((rng >> 16) % keys_per_subtree);
+      if ((rng >> 32) % 100 < read_percent) {
+        local += static_cast<size_t>(map.at<int>(key, 0));
+      } else {
+        map.update(key, static_cast<int>(i));
+      }
+    }
+    checksum += local;
+  };
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < n_threads; ++t) threads.emplace_back(worker, t);
+  for (auto& thread : threads) thread.join();
+  const auto end = std::chrono::steady_clock::now();
+
+  const double seconds = std::chrono::duration<double>(end - start).count();
+  return static_cast<double>(n_threads * ops_per_thread) / seconds / 1e6;
+}
+}  // namespace
+
+int main() {
+  using namespace ctx::benchmarks;
+
+  const size_t max_threads =
+        std::max<size_t>(4, std::thread::hardware_concurrency());
+  const size_t keys_per_subtree = 1000;
+  const size_t ops_per_thread   = 100000;
+  std::atomic<size_t> checksum{0};
+
+  for (size_t n_shards : {size_t(1), ConcurrentCtxMap::default_n_shards}) {
+    for (size_t read_percent : {size_t(100), size_t(90), size_t(50)}) {
+      std::cout << "Throughput with " << n_shards << " shard(s) and " << read_percent
+                << "% reads (million accesses per second)" << std::endl;
+      for (size_t n_threads = 1; n_threads <= max_threads; n_threads *= 2) {
+        ConcurrentCtxMap map(n_shards);
+        for (size_t t = 0; t < n_threads; ++t) {
+          for (size_t i = 0; i < keys_per_subtree; ++i) {
+            map.update("/subtree" + std::to_string(t) + "/item" + std::to_string(i),
+                       static_cast<int>(i));
+          }
+        }
+        const double rate = throughput(map, n_threads, read_percent, keys_per_subtree,
+                                       ops_per_thread, checksum);
+        print_row("threads " + std::to_string(n_threads), keys_per_subtree * n_threads,
+                  rate, "M/s");
+      }
+    }
+  }
+
+  std::cout << "(checksum " << checksum << ")" << std::endl;
+  return 0;
+}
@@ -0,0 +1,64 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "benchmark.hh"
+#include <ctx/CtxMap.hh>
+
+// Measure the cost of copying a map and of modifying the copy afterwards.
+// Copies share the storage with the original, so copying and the first
+// update of a copy should not depend on the size of the map.
+
+int main() {
+  using namespace ctx;
+  using namespace ctx::benchmarks;
+
+  const size_t repeats = 10000;
+  size_t checksum      = 0;
+
+  std::cout << "Copying maps (ns per call)" << std::endl;
+  for (size_t n = 1000; n <= 1000000; n *= 10) {
+    CtxMap map;
+    for (size_t i = 0; i < n; ++i) map.update(data_key(i), static_cast<int>(i));
+
+    const double t_copy = time_per_call_ns(
+          [&] {
+            CtxMap copy(map);
+            checksum += copy.subtree_size("/");
+          },
+          repeats);
+    const double t_copy_update = time_per_call_ns(
+          [&] {
+            CtxMap copy(map);
+            copy.update(data_key(n / 2), 42);
+            checksum += static_cast<size_t>(copy.at<int>(data_key(n / 2)));
+          },
+          repeats);
+    const double t_copy_submap = time_per_call_ns(
+          [&] {
+            CtxMap copy(map.submap("data/block0"));
+            checksum += copy.subtree_size("/");
+          },
+          repeats);
+
+    print_row("copy                    ", n, t_copy, "ns");
+    print_row("copy and update one key ", n, t_copy_update, "ns");
+    print_row("copy of a submap        ", n, t_copy_submap, "ns");
+  }
+
+  std::cout << "(checksum " << checksum << ")" << std::endl;
+  return 0;
+}
@@ -0,0 +1,72 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "benchmark.hh"
+#include <ctx/CtxMap.hh>
+#include <vector>
+
+// Compare point lookups and full iterations of a CtxMap and the
+// FrozenCtxMap obtained from it by freeze() as the number of keys grows.
+
+int main() {
+  using namespace ctx;
+  using namespace ctx::benchmarks;
+
+  const size_t repeats = 1000000;
+  size_t checksum      = 0;
+
+  std::cout << "CtxMap versus FrozenCtxMap (ns per call)" << std::endl;
+  for (size_t n = 1000; n <= 1000000; n *= 10) {
+    CtxMap map;
+    for (size_t i = 0; i < n; ++i) map.update(data_key(i), static_cast<int>(i));
+    const FrozenCtxMap frozen = map.freeze();
+
+    // Look the keys up in a scattered order
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < 4096; ++i) keys.push_back(data_key((i * 7919) % n));
+
+    size_t k           = 0;
+    const double t_map = time_per_call_ns(
+          [&] { checksum += static_cast<size_t>(map.at<int>(keys[k++ % keys.size()])); },
+          repeats);
+    const double t_frozen = time_per_call_ns(
+          [&] {
+            checksum += static_cast<size_t>(frozen.at<int>(keys[k++ % keys.size()]));
+          },
+          repeats);
+
+    const double t_iter_map = time_per_call_ns(
+          [&] {
+            for (auto& kv : map) checksum += static_cast<size_t>(kv.value<int>());
+          },
+          1);
+    const double t_iter_frozen = time_per_call_ns(
+          [&] {
+            for (auto& kv : frozen) checksum += static_cast<size_t>(kv.value<int>());
+          },
+          1);
+
+    print_row("CtxMap::at               ", n, t_map, "ns");
+    print_row("FrozenCtxMap::at         ", n, t_frozen, "ns");
+    print_row("CtxMap iteration / key   ", n, t_iter_map / static_cast<double>(n), "ns");
+    print_row("FrozenCtxMap iter. / key ", n, t_iter_frozen / static_cast<double>(n),
+              "ns");
+  }
+
+  std::cout << "(checksum " << checksum << ")" << std::endl;
+  return 0;
+}
@@ -0,0 +1,87 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "benchmark.hh"
+#include <atomic>
+#include <cstdlib>
+#include <ctx/CtxMap.hh>
+#include <functional>
+#include <new>
+
+// Measure the cost of iterating over all entries of a large map
+// and the number of heap allocations a full iteration requires.
+
+namespace {
+std::atomic<size_t> allocation_count{0};
+}  // namespace
+
+// Not inlining the replacements keeps gcc from flagging the std::free
+// of memory obtained via operator new as a mismatched deallocation.
+#ifdef __GNUC__
+#define BENCH_NOINLINE __attribute__((noinline))
+#else
+#define BENCH_NOINLINE
+#endif
+
+BENCH_NOINLINE void* operator new(size_t size) {
+  ++allocation_count;
+  void* ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) throw std::bad_alloc{};
+  return ptr;
+}
+
+BENCH_NOINLINE void operator delete(void* ptr) noexcept { std::free(ptr); }
+BENCH_NOINLINE void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+int main() {
+  using namespace ctx;
+  using namespace ctx::benchmarks;
+
+  const size_t n = 1000000;
+  size_t checksum = 0;
+
+  CtxMap map;
+  for (size_t i = 0; i < n; ++i) map.update(data_key(i), static_cast<int>(i));
+  const CtxMap& cmap = map;
+
+  std::cout << "Full iteration over a map (per entry)" << std::endl;
+
+  // Time a full iteration and count the allocations it makes
+  auto measure = [&](const std::string& label, std::function<void()> iterate) {
+    const size_t allocations_before = allocation_count;
+    const double time_ns            = time_per_call_ns(iterate, 1);
+    const size_t allocations        = allocation_count - allocations_before;
+    print_row(label + " (ns)         ", n, time_ns / static_cast<double>(n), "ns");
+    print_row(label + " (allocations)", n,
+              static_cast<double>(allocations) / static_cast<double>(n), "");
+  };
+
+  measure("values", [&] {
+    for (auto& kv : map) checksum += static_cast<size_t>(kv.value<int>());
+  });
+  measure("keys  ", [&] {
+    for (auto& kv : cmap) checksum += kv.key().size();
+  });
+  measure("copies", [&] {
+    for (auto it = cmap.begin(); it != cmap.end(); it++) {
+      checksum += static_cast<size_t>(std::next(it) != cmap.end());
+    }
+  });
+
+  std::cout << "(checksum " << checksum << ")" << std::endl;
+  return 0;
+}
@@ -0,0 +1,90 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "benchmark.hh"
+#include <algorithm>
+#include <ctx/CtxMap.hh>
+#include <random>
+#include <vector>
+
+// Compare the cost of sorting keys and of building maps using the
+// per-character comparator used by ctx up to now and using the
+// comparators, which rely on plain byte comparison (memcmp).
+
+namespace {
+/** The key comparator ctx used to use, which special-cases '/' on every character */
+struct LegacyKeyComparator {
+  bool operator()(const std::string& x, const std::string& y) const {
+    return std::lexicographical_compare(
+          x.begin(), x.end(), y.begin(), y.end(), [](const char& lhs, const char& rhs) {
+            if (lhs == '/') return rhs != '/';
+            if (rhs == '/') return false;
+            return lhs < rhs;
+          });
+  }
+};
+
+template <typename Comparator>
+double time_sort_ns(const std::vector<std::string>& keys) {
+  std::vector<std::string> copy;
+  return ctx::benchmarks::time_per_call_ns(
+        [&] {
+          copy = keys;
+          std::sort(std::begin(copy), std::end(copy), Comparator{});
+        },
+        1);
+}
+}  // namespace
+
+int main() {
+  using namespace ctx;
+  using namespace ctx::benchmarks;
+
+  const size_t n = 1000000;
+  std::vector<std::string> keys;
+  std::vector<std::string> components;
+  for (size_t i = 0; i < n; ++i) {
+    keys.push_back(data_key(i));
+    components.push_back("item" + std::to_string(i));
+  }
+  std::shuffle(std::begin(keys), std::end(keys), std::mt19937{42});
+  std::shuffle(std::begin(components), std::end(components), std::mt19937{42});
+
+  std::cout << "Key comparison (ns per key)" << std::endl;
+  const double nd = static_cast<double>(n);
+  print_row("sort full keys, legacy comparator     ", n,
+            time_sort_ns<LegacyKeyComparator>(keys) / nd, "ns");
+  print_row("sort full keys, key_comparator_type   ", n,
+            time_sort_ns<CtxMapKeyComparator>(keys) / nd, "ns");
+  print_row("sort components, legacy comparator    ", n,
+            time_sort_ns<LegacyKeyComparator>(components) / nd, "ns");
+  print_row("sort components, component comparator ", n,
+            time_sort_ns<CtxMapComponentComparator>(components) / nd, "ns");
+
+  size_t checksum  = 0;
+  const double t_insert = time_per_call_ns(
+        [&] {
+          CtxMap map;
+          for (const auto& key : keys) map.update(key, 1);
+          checksum += map.subtree_size("/");
+        },
+        1);
+  print_row("insert into CtxMap                    ", n, t_insert / nd, "ns");
+
+  std::cout << "(checksum " << checksum << ")" << std::endl;
+  return 0;
+}
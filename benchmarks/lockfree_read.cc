@@ -0,0 +1,97 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "benchmark.hh"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctx/ConcurrentCtxMap.hh>
+#include <ctx/CtxMap.hh>
+#include <thread>
+#include <vector>
+
+// Measure the read throughput on a read-only workload with 1 to N threads.
+// Reads of a ConcurrentCtxMap take no lock, such that the throughput should
+// grow linearly with the number of threads (as long as there are enough cores).
+// For comparison the same reads are done on a CtxMap guarded by a single
+// reader/writer lock, whose lock word is modified by every read.
+
+namespace {
+using namespace ctx;
+
+/** Run n_threads threads each calling read(key) on n_reads keys and return
+ *  the total number of reads per second (in millions). */
+template <typename Read>
+double throughput(size_t n_threads, const std::vector<std::string>& keys, size_t n_reads,
+                  Read read) {
+  auto worker = [&](size_t t) {
+    for (size_t i = 0; i < n_reads; ++i) {
+      read(keys[(i * 7919 + t * 104729) % keys.size()]);
+    }
+  };
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < n_threads; ++t) threads.emplace_back(worker, t);
+  for (auto& thread : threads) thread.join();
+  const auto end = std::chrono::steady_clock::now();
+
+  const double seconds = std::chrono::duration<double>(end - start).count();
+  return static_cast<double>(n_threads * n_reads) / seconds / 1e6;
+}
+}  // namespace
+
+int main() {
+  using namespace ctx::benchmarks;
+
+  const size_t max_threads = std::max<size_t>(4, std::thread::hardware_concurrency());
+  const size_t n_keys      = 10000;
+  const size_t n_reads     = 200000;
+
+  std::vector<std::string> keys;
+  ConcurrentCtxMap concurrent;
+  CtxMap locked;
+  SharedMutex mutex;
+  for (size_t i = 0; i < n_keys; ++i) {
+    keys.push_back("/subtree" + std::to_string(i % 16) + "/item" + std::to_string(i));
+    concurrent.update(keys.back(), static_cast<int>(i));
+    locked.update(keys.back(), static_cast<int>(i));
+  }
+
+  std::atomic<size_t> checksum{0};
+  std::cout << "Read-only throughput (million reads per second)" << std::endl;
+  for (size_t n_threads = 1; n_threads <= max_threads; n_threads *= 2) {
+    const double t_lockfree =
+          throughput(n_threads, keys, n_reads, [&](const std::string& key) {
+            checksum.fetch_add(static_cast<size_t>(concurrent.at<int>(key)),
+                               std::memory_order_relaxed);
+          });
+    const double t_locked =
+          throughput(n_threads, keys, n_reads, [&](const std::string& key) {
+            SharedLock lock(mutex);
+            checksum.fetch_add(static_cast<size_t>(locked.at<int>(key)),
+                               std::memory_order_relaxed);
+          });
+    print_row("ConcurrentCtxMap (lock-free)   threads " + std::to_string(n_threads),
+              n_keys, t_lockfree, "M/s");
+    print_row("CtxMap with reader/writer lock threads " + std::to_string(n_threads),
+              n_keys, t_locked, "M/s");
+  }
+
+  std::cout << "(checksum " << checksum << ")" << std::endl;
+  return 0;
+}
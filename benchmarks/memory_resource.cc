@@ -0,0 +1,88 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "benchmark.hh"
+#include <algorithm>
+#include <ctx/CtxMap.hh>
+#include <memory>
+#include <vector>
+
+// Measure the cost of building and destroying a map of n entries, with the
+// nodes allocated from the global heap compared to a simple arena resource,
+// which hands out memory from large chunks and frees it all at once.
+
+namespace {
+class ArenaResource : public ctx::memory_resource {
+ private:
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+    m_used = (m_used + alignment - 1) / alignment * alignment;
+    if (m_chunks.empty() || m_used + bytes > chunk_size) {
+      m_chunks.emplace_back(new char[std::max(bytes, chunk_size)]);
+      m_used = 0;
+    }
+    void* ptr = m_chunks.back().get() + m_used;
+    m_used += bytes;
+    return ptr;
+  }
+  void do_deallocate(void*, std::size_t, std::size_t) override {}
+  bool do_is_equal(const ctx::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+
+  static constexpr std::size_t chunk_size = 1 << 20;
+  std::vector<std::unique_ptr<char[]>> m_chunks;
+  std::size_t m_used = 0;
+};
+constexpr std::size_t ArenaResource::chunk_size;
+}  // namespace
+
+int main() {
+  using namespace ctx;
+  using namespace ctx::benchmarks;
+
+  const size_t repeats = 5;
+  size_t checksum      = 0;
+
+  std::cout << "Building and destroying a map (ns per entry)" << std::endl;
+  for (size_t n = 1000; n <= 1000000; n *= 10) {
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < n; ++i) keys.push_back(data_key(i));
+
+    const double t_heap = time_per_call_ns(
+          [&] {
+            CtxMap map;
+            for (size_t i = 0; i < n; ++i) map.update(keys[i], static_cast<double>(i));
+            checksum += map.subtree_size("/");
+          },
+          repeats);
+    const double t_arena = time_per_call_ns(
+          [&] {
+            ArenaResource arena;
+            CtxMap map(&arena);
+            for (size_t i = 0; i < n; ++i) map.update(keys[i], static_cast<double>(i));
+            checksum += map.subtree_size("/");
+          },
+          repeats);
+
+    const double per_entry = static_cast<double>(n);
+    print_row("global heap      ", n, t_heap / per_entry, "ns");
+    print_row("arena resource   ", n, t_arena / per_entry, "ns");
+  }
+
+  std::cout << "(checksum " << checksum << ")" << std::endl;
+  return 0;
+}
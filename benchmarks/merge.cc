@@ -0,0 +1,90 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "benchmark.hh"
+#include <ctx/CtxMap.hh>
+#include <vector>
+
+// Measure the cost of merging a large subtree of results into another map,
+// which already holds half of its keys, using update(key, map) compared to
+// copying the entries one by one and to moving the results map.
+
+int main() {
+  using namespace ctx;
+  using namespace ctx::benchmarks;
+
+  const size_t repeats = 3;
+  size_t checksum      = 0;
+
+  std::cout << "Merging a subtree into a map (ns per merged entry)" << std::endl;
+  for (size_t n = 10000; n <= 1000000; n *= 10) {
+    CtxMap results;
+    CtxMap target;
+    for (size_t i = 0; i < n; ++i) {
+      results.update(data_key(i), static_cast<double>(i));
+      if (i % 2 == 0) target.update("archive" + data_key(i), 0.0);
+    }
+
+    // Keep the results, such that their destruction is not measured
+    std::vector<CtxMap> merged;
+    auto drop_merged = [&] {
+      for (const CtxMap& map : merged) checksum += map.subtree_size("/");
+      merged.clear();
+    };
+
+    const double t_entries = time_per_call_ns(
+          [&] {
+            CtxMap copy(target);
+            for (auto& kv : results) copy.update("archive" + kv.key(), kv.value_raw());
+            merged.push_back(std::move(copy));
+          },
+          repeats);
+    drop_merged();
+    const double t_merge = time_per_call_ns(
+          [&] {
+            CtxMap copy(target);
+            copy.update("archive", results);
+            merged.push_back(std::move(copy));
+          },
+          repeats);
+    drop_merged();
+
+    // Each move needs its own map, so build them beforehand. Unlike above
+    // the nodes of keys present in both maps are freed during the call.
+    std::vector<CtxMap> to_move(repeats);
+    for (CtxMap& map : to_move) {
+      for (size_t i = 0; i < n; ++i) map.update(data_key(i), static_cast<double>(i));
+    }
+    size_t next = 0;
+    const double t_move = time_per_call_ns(
+          [&] {
+            CtxMap copy(target);
+            copy.update("archive", std::move(to_move[next++]));
+            merged.push_back(std::move(copy));
+          },
+          repeats);
+    drop_merged();
+
+    const double per_entry = static_cast<double>(n);
+    print_row("update entry by entry        ", n, t_entries / per_entry, "ns");
+    print_row("update(key, map)             ", n, t_merge / per_entry, "ns");
+    print_row("update(key, std::move(map))  ", n, t_move / per_entry, "ns");
+  }
+
+  std::cout << "(checksum " << checksum << ")" << std::endl;
+  return 0;
+}
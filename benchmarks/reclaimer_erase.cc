@@ -0,0 +1,56 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "benchmark.hh"
+#include <ctx/CtxMap.hh>
+#include <memory>
+#include <vector>
+
+// Measure the latency of erasing a key holding a large array, when the
+// array is destroyed inside the call compared to by a CtxMapReclaimer.
+
+int main() {
+  using namespace ctx;
+  using namespace ctx::benchmarks;
+
+  const size_t repeats = 10;
+  size_t checksum      = 0;
+  auto reclaimer       = std::make_shared<CtxMapReclaimer>();
+
+  std::cout << "Erasing an array of n doubles (us per erase)" << std::endl;
+  for (size_t n = 1000; n <= 10000000; n *= 10) {
+    double t_direct    = 0;
+    double t_reclaimer = 0;
+    for (size_t r = 0; r < repeats; ++r) {
+      CtxMap map;
+      map.update("grid", std::make_shared<std::vector<double>>(n, 1.0));
+      t_direct += time_per_call_ns([&] { checksum += map.erase("grid"); }, 1);
+
+      map.set_reclaimer(reclaimer);
+      map.update("grid", std::make_shared<std::vector<double>>(n, 1.0));
+      t_reclaimer += time_per_call_ns([&] { checksum += map.erase("grid"); }, 1);
+      reclaimer->flush();
+    }
+
+    const double per_erase = 1000. * static_cast<double>(repeats);
+    print_row("destroyed in erase", n, t_direct / per_erase, "us");
+    print_row("reclaimer         ", n, t_reclaimer / per_erase, "us");
+  }
+
+  std::cout << "(checksum " << checksum << ")" << std::endl;
+  return 0;
+}
@@ -0,0 +1,58 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "benchmark.hh"
+#include <ctx/CtxMap.hh>
+#include <string>
+#include <vector>
+
+// Measure the cost of removing the intermediate results of a calculation
+// step via erase_recursive, with the entries stored on the global heap
+// compared to a region attached to the path of the step.
+
+int main() {
+  using namespace ctx;
+  using namespace ctx::benchmarks;
+
+  const size_t repeats = 5;
+  size_t checksum      = 0;
+
+  std::cout << "Erasing the subtree of a step (ns per erased entry)" << std::endl;
+  for (size_t n = 1000; n <= 1000000; n *= 10) {
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < n; ++i) keys.push_back("step" + data_key(i));
+
+    double t_heap   = 0;
+    double t_region = 0;
+    for (size_t r = 0; r < repeats; ++r) {
+      CtxMap map;
+      for (size_t i = 0; i < n; ++i) map.update(keys[i], static_cast<double>(i));
+      t_heap += time_per_call_ns([&] { checksum += map.erase_recursive("step"); }, 1);
+
+      map.attach_region("step");
+      for (size_t i = 0; i < n; ++i) map.update(keys[i], static_cast<double>(i));
+      t_region += time_per_call_ns([&] { checksum += map.erase_recursive("step"); }, 1);
+    }
+
+    const double per_entry = static_cast<double>(n * repeats);
+    print_row("global heap      ", n, t_heap / per_entry, "ns");
+    print_row("region           ", n, t_region / per_entry, "ns");
+  }
+
+  std::cout << "(checksum " << checksum << ")" << std::endl;
+  return 0;
+}
@@ -0,0 +1,67 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "benchmark.hh"
+#include <ctx/CtxMap.hh>
+
+// Measure the cost of rotating double-buffered iteration data, i.e. turning
+// /scf/current into /scf/previous, by copying the entries one by one
+// compared to relinking the subtrees with rename_subtree and swap_subtrees.
+
+int main() {
+  using namespace ctx;
+  using namespace ctx::benchmarks;
+
+  const size_t repeats = 20;
+  size_t checksum      = 0;
+
+  std::cout << "Rotating /scf/current into /scf/previous (ns per rotation)" << std::endl;
+  for (size_t n = 1000; n <= 100000; n *= 10) {
+    CtxMap map;
+    for (size_t i = 0; i < n; ++i) {
+      map.update("scf/current" + data_key(i), static_cast<double>(i));
+      map.update("scf/previous" + data_key(i), static_cast<double>(i));
+    }
+
+    const double t_copy = time_per_call_ns(
+          [&] {
+            map.erase_recursive("scf/previous");
+            for (auto& kv : map.submap("scf/current")) {
+              map.update("scf/previous" + kv.key(), kv.value_raw());
+            }
+          },
+          repeats);
+    // Rename back and forth, such that no entries are destroyed
+    const double t_rename = time_per_call_ns(
+          [&] {
+            map.rename_subtree("scf/current", "scf/next");
+            map.rename_subtree("scf/next", "scf/current");
+          },
+          repeats);
+    const double t_swap =
+          time_per_call_ns([&] { map.swap_subtrees("scf/current", "scf/previous"); },
+                           repeats);
+    checksum += map.subtree_size("/");
+
+    print_row("erase and copy entry by entry ", n, t_copy, "ns");
+    print_row("rename_subtree there and back ", n, t_rename, "ns");
+    print_row("swap_subtrees                 ", n, t_swap, "ns");
+  }
+
+  std::cout << "(checksum " << checksum << ")" << std::endl;
+  return 0;
+}
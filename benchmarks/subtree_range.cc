@@ -0,0 +1,60 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "benchmark.hh"
+#include <ctx/CtxMap.hh>
+
+// Measure the cost of setting up the iteration over a small subtree
+// and of querying subtree sizes as the total number of keys grows.
+// All timings should stay (roughly) constant with the map size.
+
+int main() {
+  using namespace ctx;
+  using namespace ctx::benchmarks;
+
+  const size_t repeats = 100000;
+  size_t checksum      = 0;
+
+  std::cout << "Subtree range setup and size queries (ns per call)" << std::endl;
+  for (size_t n = 1000; n <= 1000000; n *= 10) {
+    CtxMap map;
+    for (size_t i = 0; i < n; ++i) map.update(data_key(i), static_cast<int>(i));
+    for (int i = 0; i < 16; ++i) map.update("/probe/key" + std::to_string(i), i);
+
+    const double t_range = time_per_call_ns(
+          [&] { checksum += (map.begin("probe") != map.end("probe")) ? 1u : 0u; },
+          repeats);
+    const double t_iter = time_per_call_ns(
+          [&] {
+            for (auto& kv : map.submap("probe")) {
+              checksum += static_cast<size_t>(kv.value<int>());
+            }
+          },
+          repeats / 10);
+    const double t_size_small =
+          time_per_call_ns([&] { checksum += map.subtree_size("probe"); }, repeats);
+    const double t_size_large =
+          time_per_call_ns([&] { checksum += map.subtree_size("data"); }, repeats);
+
+    print_row("begin/end(\"probe\")      ", n, t_range, "ns");
+    print_row("iterate 16 keys         ", n, t_iter, "ns");
+    print_row("subtree_size(\"probe\")   ", n, t_size_small, "ns");
+    print_row("subtree_size(\"data\")    ", n, t_size_large, "ns");
+  }
+
+  std::cout << "(checksum " << checksum << ")" << std::endl;
+  return 0;
+}
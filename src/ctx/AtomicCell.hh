@@ -0,0 +1,136 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#pragma once
+#include "TypeRegistry.hh"
+#include <atomic>
+#include <ostream>
+#include <type_traits>
+
+namespace ctx {
+
+/** A number, which many threads may update at the same time, e.g. a counter
+ *  or the total time spent in a routine.
+ *
+ * The cell is stored in a CtxMap like any other object and obtained via
+ * the usual ``at`` function, e.g.
+ * ```
+ * map.update("timings/integrals", AtomicCell<double>{0});
+ *
+ * // From many threads at once:
+ * const CtxMap& cmap = map;
+ * cmap.at<AtomicCell<double>>("timings/integrals").fetch_add(elapsed);
+ * ```
+ * The modifying functions of the cell are deliberately const: The threads
+ * have to use the const functions of the map, since only these never modify
+ * the map itself and are thus safe to call concurrently. As a consequence a
+ * cell can be modified through any const reference to it, including one
+ * obtained from a const CtxMap or a FrozenCtxMap sharing the cell.
+ *
+ * The cell occupies a cache line of its own, such that updates of
+ * neighbouring cells by different threads do not slow each other down.
+ * Printing a map containing the cell prints its current value.
+ *
+ * An ``AtomicCell<bool>`` can be used as a flag, which is raised with
+ * ``fetch_max(true)`` or ``store(true)``. It has no fetch_add or fetch_sub.
+ */
+template <typename T>
+class AtomicCell {
+  static_assert(std::is_arithmetic<T>::value, "AtomicCell requires a numeric type.");
+
+ public:
+  typedef T value_type;
+
+  explicit AtomicCell(T value = T{}) : m_value(value) { register_printer(); }
+
+  /** Copy the current value of another cell */
+  AtomicCell(const AtomicCell& other) : AtomicCell(other.load()) {}
+
+  AtomicCell& operator=(const AtomicCell&) = delete;
+
+  /** Return the current value */
+  T load() const { return m_value.load(); }
+  operator T() const { return load(); }
+
+  /** Replace the value */
+  void store(T value) const { m_value.store(value); }
+
+  /** Add to the value and return the previous value */
+  T fetch_add(T delta) const {
+    static_assert(!std::is_same<T, bool>::value, "AtomicCell<bool> has no fetch_add.");
+    return fetch_add(delta, std::is_integral<T>{});
+  }
+
+  /** Subtract from the value and return the previous value */
+  T fetch_sub(T delta) const {
+    static_assert(!std::is_same<T, bool>::value, "AtomicCell<bool> has no fetch_sub.");
+    return fetch_sub(delta, std::is_integral<T>{});
+  }
+
+  /** Replace the value by the maximum of the value and ``value``,
+   *  return the previous value */
+  T fetch_max(T value) const {
+    T current = m_value.load();
+    while (current < value && !m_value.compare_exchange_weak(current, value)) {
+    }
+    return current;
+  }
+
+  /** Replace the value by the minimum of the value and ``value``,
+   *  return the previous value */
+  T fetch_min(T value) const {
+    T current = m_value.load();
+    while (value < current && !m_value.compare_exchange_weak(current, value)) {
+    }
+    return current;
+  }
+
+ private:
+  T fetch_add(T delta, std::true_type) const { return m_value.fetch_add(delta); }
+  T fetch_add(T delta, std::false_type) const {
+    // std::atomic has no fetch_add for floating point types before C++20
+    T current = m_value.load();
+    while (!m_value.compare_exchange_weak(current, current + delta)) {
+    }
+    return current;
+  }
+
+  T fetch_sub(T delta, std::true_type) const { return m_value.fetch_sub(delta); }
+  T fetch_sub(T delta, std::false_type) const { return fetch_add(-delta); }
+
+  /** Make printing values of the CtxMap holding cells print the current value */
+  static void register_printer() {
+    static const bool registered =
+          (TypeRegistry::instance().register_printer<AtomicCell>(), true);
+    (void)registered;
+  }
+
+  /** Keep other data off the cache line of the value */
+  char m_padding_front[64];
+
+  /** The value, mutable such that the const functions can modify it */
+  mutable std::atomic<T> m_value;
+
+  char m_padding_back[64 - sizeof(std::atomic<T>) % 64];
+};
+
+template <typename T>
+std::ostream& operator<<(std::ostream& o, const AtomicCell<T>& cell) {
+  return o << cell.load();
+}
+
+}  // namespace ctx
@@ -0,0 +1,144 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <type_traits>
+
+namespace ctx {
+
+/** Can values of type T be kept inline in an AtomicSlot, protected by a
+ *  sequence lock, instead of behind an atomically swapped shared_ptr */
+template <typename T>
+struct IsSeqlockStorable
+      : public std::integral_constant<bool, std::is_trivially_copyable<T>::value &&
+                                                  sizeof(T) <= 32> {};
+
+/** A value, which may be replaced by one thread while other threads read it.
+ *
+ * Readers obtain either the old or the new value, never a mixture of both,
+ * and neither readers nor writers take a lock. Slots are stored in a CtxMap
+ * like other objects, usually via CtxMap::update_atomic and read back via
+ * CtxMap::at_atomic. Since storing a new value into an existing slot does not
+ * modify the map itself, hot keys (like the current energy or a convergence
+ * flag) may be rewritten this way while other threads read the map.
+ *
+ * Small trivially copyable types are stored inline and protected by a
+ * sequence lock, i.e. readers retry if a write happened during their read.
+ * All other types are kept in immutable objects behind a shared_ptr, which
+ * is replaced atomically on store.
+ */
+template <typename T, bool Inline = IsSeqlockStorable<T>::value>
+class AtomicSlot;
+
+/** AtomicSlot for small trivially copyable types (sequence lock) */
+template <typename T>
+class AtomicSlot<T, true> {
+ public:
+  typedef T value_type;
+
+  explicit AtomicSlot(const T& value = T{}) : m_sequence(0) { write_words(value); }
+  AtomicSlot(const AtomicSlot&) = delete;
+  AtomicSlot& operator=(const AtomicSlot&) = delete;
+
+  /** Return the current value */
+  T load() const {
+    uint64_t words[n_words];
+    for (;;) {
+      const uint64_t before = m_sequence.load(std::memory_order_acquire);
+      if ((before & 1) != 0) {
+        std::this_thread::yield();  // A write is in progress
+        continue;
+      }
+      for (size_t i = 0; i < n_words; ++i) {
+        words[i] = m_words[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (m_sequence.load(std::memory_order_relaxed) == before) break;
+    }
+
+    T value;
+    std::memcpy(&value, words, sizeof(T));
+    return value;
+  }
+
+  /** Replace the value. Concurrent writers are serialised. */
+  void store(const T& value) {
+    // Make the sequence odd to signal the readers a write is in progress
+    uint64_t sequence = m_sequence.load(std::memory_order_relaxed);
+    while ((sequence & 1) != 0 ||
+           !m_sequence.compare_exchange_weak(sequence, sequence + 1,
+                                             std::memory_order_relaxed)) {
+      std::this_thread::yield();
+      sequence = m_sequence.load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    write_words(value);
+    m_sequence.store(sequence + 2, std::memory_order_release);
+  }
+
+ private:
+  static constexpr size_t n_words = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+  void write_words(const T& value) {
+    uint64_t words[n_words] = {};
+    std::memcpy(words, &value, sizeof(T));
+    for (size_t i = 0; i < n_words; ++i) {
+      m_words[i].store(words[i], std::memory_order_relaxed);
+    }
+  }
+
+  /** Sequence number, odd while a write is in progress */
+  std::atomic<uint64_t> m_sequence;
+
+  /** The bytes of the value */
+  std::atomic<uint64_t> m_words[n_words];
+};
+
+/** AtomicSlot for all other types (atomically replaced shared_ptr) */
+template <typename T>
+class AtomicSlot<T, false> {
+ public:
+  typedef T value_type;
+
+  explicit AtomicSlot(T value = T{})
+        : m_ptr(std::make_shared<const T>(std::move(value))) {}
+  AtomicSlot(const AtomicSlot&) = delete;
+  AtomicSlot& operator=(const AtomicSlot&) = delete;
+
+  /** Return a copy of the current value */
+  T load() const { return *load_ptr(); }
+
+  /** Return a pointer to the current value, which stays valid
+   *  (and unchanged) even if a new value is stored. */
+  std::shared_ptr<const T> load_ptr() const { return std::atomic_load(&m_ptr); }
+
+  /** Replace the value */
+  void store(T value) {
+    std::atomic_store(&m_ptr, std::make_shared<const T>(std::move(value)));
+  }
+
+ private:
+  /** The current value. Only accessed atomically. */
+  std::shared_ptr<const T> m_ptr;
+};
+
+}  // namespace ctx
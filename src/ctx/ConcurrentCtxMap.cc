@@ -0,0 +1,302 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "ConcurrentCtxMap.hh"
+#include "CtxMap.hh"
+#include <algorithm>
+#include <functional>
+
+namespace ctx {
+
+constexpr size_t ConcurrentCtxMap::default_n_shards;
+
+namespace {
+// The modifications of a shard, which are stored until they are repeated on
+// the second tree (see ConcurrentCtxMap::ShardModification)
+
+/** Store a value under a full key */
+struct InsertValue {
+  std::string full_key;
+  CtxMapValue value;
+
+  void operator()(CtxMapTree& tree, bool last, std::vector<CtxMapTree>&) {
+    tree.replace(tree[full_key], last ? std::move(value) : value);
+  }
+};
+
+/** Apply the modifications of a batch */
+struct ApplyBatch {
+  std::vector<CtxMapTree::Modification> modifications;
+
+  void operator()(CtxMapTree& tree, bool last, std::vector<CtxMapTree>&) {
+    if (last) {
+      tree.apply(std::move(modifications));
+    } else {
+      tree.apply(modifications);
+    }
+  }
+};
+
+/** Exchange the subtree at a path by another subtree */
+struct ExchangeSubtree {
+  std::string path;
+  CtxMapTree subtree;
+
+  void operator()(CtxMapTree& tree, bool last, std::vector<CtxMapTree>& replaced) {
+    if (last) {
+      replaced.push_back(tree.exchange(path, std::move(subtree)));
+    } else {
+      tree.exchange(path, subtree);
+    }
+  }
+};
+}  // namespace
+
+ConcurrentCtxMap::ConcurrentCtxMap(size_t n_shards)
+      : m_state{std::make_shared<State>(n_shards)}, m_location{""} {
+  if (n_shards == 0) {
+    throw invalid_argument("A ConcurrentCtxMap needs at least one shard.");
+  }
+}
+
+size_t ConcurrentCtxMap::shard_index(const std::string& full_key) const {
+  // The root key "" and the top-level component of all other keys
+  // (i.e. the part between the first and the second "/")
+  const size_t end = std::min(full_key.find('/', 1), full_key.size());
+  const std::string top{full_key.substr(std::min<size_t>(1, full_key.size()), end - 1)};
+  return std::hash<std::string>{}(top) % n_shards();
+}
+
+std::vector<std::unique_lock<SharedMutex>> ConcurrentCtxMap::lock_shards(
+      const std::vector<size_t>& indices) {
+  while (true) {
+    std::vector<std::unique_lock<SharedMutex>> locks;
+    locks.reserve(indices.size());
+    for (size_t index : indices) {
+      Shard& shard = m_state->shards[index];
+      locks.emplace_back(shard.mutex);
+      if (shard.pending && !m_state->epochs.passed(shard.pending_epoch)) {
+        // Let the other writers continue while waiting for the readers
+        const uint64_t epoch = shard.pending_epoch;
+        locks.clear();
+        m_state->epochs.wait_for(epoch);
+        break;
+      }
+    }
+    if (locks.size() == indices.size()) return locks;
+  }
+}
+
+void ConcurrentCtxMap::modify_shards(std::vector<std::unique_lock<SharedMutex>> locks,
+                                     const std::vector<size_t>& indices,
+                                     std::vector<ShardModification> modifications) {
+  std::vector<CtxMapTree> replaced;  // Destroyed once the locks are released
+  for (size_t i = 0; i < indices.size(); ++i) {
+    Shard& shard     = m_state->shards[indices[i]];
+    CtxMapTree& tree = shard.trees[1 - shard.latest()];
+    if (shard.pending) {
+      shard.pending(tree, true, replaced);
+      shard.pending = nullptr;
+    }
+    modifications[i](tree, false, replaced);
+  }
+
+  // Direct the readers to the modified trees of all shards at once: Readers
+  // seeing the old version keep using the old trees (see Shard::state).
+  {
+    std::lock_guard<std::mutex> lock(m_state->version_mutex);
+    const uint64_t version = m_state->version.load() + 1;
+    for (size_t index : indices) {
+      Shard& shard = m_state->shards[index];
+      shard.state.store((version << 1) | (1 - shard.latest()));
+    }
+    m_state->version.store(version);
+  }
+
+  // Readers which entered before this epoch might still use the old trees
+  const uint64_t epoch = m_state->epochs.advance();
+  for (size_t i = 0; i < indices.size(); ++i) {
+    Shard& shard        = m_state->shards[indices[i]];
+    shard.pending       = std::move(modifications[i]);
+    shard.pending_epoch = epoch;
+  }
+  locks.clear();
+}
+
+void ConcurrentCtxMap::insert(std::string full_key, entry_value_type e) {
+  const std::vector<size_t> indices{shard_index(full_key)};
+  std::vector<ShardModification> modifications;
+  modifications.emplace_back(InsertValue{std::move(full_key), std::move(e)});
+  modify_shards(lock_shards(indices), indices, std::move(modifications));
+}
+
+CtxMapBatch ConcurrentCtxMap::batch() {
+  ConcurrentCtxMap view(*this);
+  return CtxMapBatch(m_location,
+                     [view](std::vector<CtxMapTree::Modification> modifications) mutable {
+                       view.apply(std::move(modifications));
+                     });
+}
+
+void ConcurrentCtxMap::apply(std::vector<CtxMapTree::Modification> modifications) {
+  std::vector<size_t> shard_of_mod(modifications.size());
+  for (size_t i = 0; i < modifications.size(); ++i) {
+    shard_of_mod[i] = shard_index(modifications[i].key);
+  }
+
+  std::vector<std::vector<CtxMapTree::Modification>> per_shard(n_shards());
+  if (std::adjacent_find(std::begin(shard_of_mod), std::end(shard_of_mod),
+                         std::not_equal_to<size_t>()) == std::end(shard_of_mod)) {
+    // Common case: All keys are in one shard (e.g. in one subtree)
+    if (!modifications.empty()) per_shard[shard_of_mod[0]] = std::move(modifications);
+  } else {
+    for (size_t i = 0; i < modifications.size(); ++i) {
+      per_shard[shard_of_mod[i]].push_back(std::move(modifications[i]));
+    }
+  }
+
+  std::vector<size_t> indices;
+  std::vector<ShardModification> per_shard_modifications;
+  for (size_t i = 0; i < per_shard.size(); ++i) {
+    if (per_shard[i].empty()) continue;
+    indices.push_back(i);
+    per_shard_modifications.emplace_back(ApplyBatch{std::move(per_shard[i])});
+  }
+
+  // The locks are taken in the order of the shard index,
+  // such that concurrent batches cannot deadlock.
+  modify_shards(lock_shards(indices), indices, std::move(per_shard_modifications));
+}
+
+void ConcurrentCtxMap::publish(const std::string& path, CtxMap&& staging) {
+  const std::string full_path = make_full_key(path);
+
+  CtxMapTree subtree = CtxMap::take_entries(std::move(staging));
+  if (!full_path.empty()) {
+    const std::vector<size_t> indices{shard_index(full_path)};
+    std::vector<ShardModification> modifications;
+    modifications.emplace_back(ExchangeSubtree{full_path, std::move(subtree)});
+    modify_shards(lock_shards(indices), indices, std::move(modifications));
+    return;
+  }
+
+  // The root spans all shards: Split the top-level subtrees by shard
+  const CtxMapTree& source = subtree;
+  std::vector<CtxMapTree> per_shard(n_shards());
+  for (const auto& kv : source.root().children) {
+    const std::string key = "/" + kv.first;
+    per_shard[shard_index(key)].exchange(key, CtxMapTree(source, key));
+  }
+  if (source.root().has_value) per_shard[shard_index("")][""] = source.root().value;
+
+  std::vector<size_t> indices;
+  std::vector<ShardModification> modifications;
+  for (size_t i = 0; i < n_shards(); ++i) {
+    indices.push_back(i);
+    modifications.emplace_back(ExchangeSubtree{"", std::move(per_shard[i])});
+  }
+  modify_shards(lock_shards(indices), indices, std::move(modifications));
+}
+
+size_t ConcurrentCtxMap::erase(const key_view_type& key) {
+  const std::string full_key = make_full_key(key);
+  const size_t index         = shard_index(full_key);
+
+  std::vector<std::unique_lock<SharedMutex>> locks = lock_shards({index});
+  const Shard& shard = m_state->shards[index];
+  if (shard.trees[shard.latest()].find(full_key) == nullptr) return 0;
+
+  modify_shards(std::move(locks), {index},
+                {[full_key](CtxMapTree& tree, bool, std::vector<CtxMapTree>&) {
+                  tree.erase(full_key);
+                }});
+  return 1;
+}
+
+size_t ConcurrentCtxMap::erase_recursive(const key_view_type& path) {
+  const std::string full_path = make_full_key(path);
+  if (!full_path.empty()) {
+    const size_t index = shard_index(full_path);
+
+    std::vector<std::unique_lock<SharedMutex>> locks = lock_shards({index});
+    const Shard& shard = m_state->shards[index];
+    const size_t count = shard.trees[shard.latest()].subtree_size(full_path);
+    if (count == 0) return 0;
+
+    modify_shards(std::move(locks), {index},
+                  {[full_path](CtxMapTree& tree, bool, std::vector<CtxMapTree>&) {
+                    tree.erase_subtree(full_path);
+                  }});
+    return count;
+  }
+
+  // The root spans all shards, which are cleared at once
+  std::vector<size_t> indices;
+  for (size_t i = 0; i < n_shards(); ++i) indices.push_back(i);
+
+  std::vector<std::unique_lock<SharedMutex>> locks = lock_shards(indices);
+  size_t count = 0;
+  for (const Shard& shard : m_state->shards) {
+    count += shard.trees[shard.latest()].subtree_size("");
+  }
+  std::vector<ShardModification> modifications(
+        n_shards(),
+        [](CtxMapTree& tree, bool, std::vector<CtxMapTree>&) { tree.clear(); });
+  modify_shards(std::move(locks), indices, std::move(modifications));
+  return count;
+}
+
+void ConcurrentCtxMap::reclaim() {
+  for (size_t index = 0; index < n_shards(); ++index) {
+    std::vector<CtxMapTree> replaced;  // Destroyed once the lock is released
+
+    std::vector<std::unique_lock<SharedMutex>> locks = lock_shards({index});
+    Shard& shard = m_state->shards[index];
+    if (!shard.pending) continue;
+
+    // Both trees hold the same entries afterwards, so nothing is pending
+    shard.pending(shard.trees[1 - shard.latest()], true, replaced);
+    shard.pending = nullptr;
+    locks.clear();
+  }
+}
+
+bool ConcurrentCtxMap::exists(const key_view_type& key) const {
+  const std::string full_key = make_full_key(key);
+  EpochManager::Guard guard(m_state->epochs);
+  return find_value(full_key) != nullptr;
+}
+
+size_t ConcurrentCtxMap::subtree_size(const key_view_type& path) const {
+  const std::string full_path = make_full_key(path);
+  EpochManager::Guard guard(m_state->epochs);
+  if (!full_path.empty()) {
+    return shard_of(full_path)
+          .readers_tree(m_state->version.load())
+          .subtree_size(full_path);
+  }
+
+  // Count the keys of all shards in the same version of the map
+  const uint64_t version = m_state->version.load();
+  size_t count           = 0;
+  for (const Shard& shard : m_state->shards) {
+    count += shard.readers_tree(version).subtree_size("");
+  }
+  return count;
+}
+
+}  // namespace ctx
@@ -0,0 +1,361 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#pragma once
+#include "AtomicSlot.hh"
+#include "CtxMapBatch.hh"
+#include "CtxMapTree.hh"
+#include "EpochManager.hh"
+#include "SharedMutex.hh"
+#include "exceptions.hh"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace ctx {
+
+class CtxMap;
+
+/** A map like the CtxMap, which may be accessed and modified from several
+ *  threads at once.
+ *
+ * The key space is partitioned by the top-level component of the keys into
+ * a number of shards. Each shard holds its own CtxMapTree, which is guarded
+ * by its own lock. Writers working in different subtrees (e.g. "/scf",
+ * "/grid" and "/props") therefore only contend if their subtrees happen to
+ * be assigned to the same shard. Keys are normalised like for the CtxMap
+ * (see CtxMap::submap).
+ *
+ * Reads take no lock at all: Each shard keeps two copies of its tree, of
+ * which the readers use one. A writer modifies the copy not in use and then
+ * directs the readers to it. The modification is repeated on the other copy
+ * by the next writer of the shard, once the readers which might still have
+ * been looking at it are done (see EpochManager). A read therefore only
+ * writes to memory private to the reading thread, such that reads of many
+ * threads do not slow each other down. A write costs twice the modification
+ * of a CtxMap. Writers only wait for readers if the shard is modified again
+ * while a reader is still in the middle of a lookup in the old copy and
+ * never while holding the lock of a shard. The objects behind the values
+ * are shared between both copies. Since the old copy keeps the replaced
+ * values until the next write to the shard, use reclaim() to release them
+ * earlier.
+ *
+ * Readers are directed to new copies by incrementing a version of the whole
+ * map, such that modifications affecting several shards at once (batches,
+ * publish or erase_recursive at the root) become visible to the readers at
+ * once as well.
+ *
+ * Since another thread may replace or remove a value at any time, the
+ * functions reading values return copies of them or shared pointers to
+ * them instead of references. As long as such a shared pointer is kept,
+ * the object pointed to stays alive. Modifying the object behind it is
+ * only safe, if no other thread accesses the object at the same time.
+ *
+ * Copies of a ConcurrentCtxMap as well as its submaps are views, which refer
+ * to the same data. To pass the map to other threads, just pass a copy.
+ */
+class ConcurrentCtxMap {
+ public:
+  typedef CtxMapValue entry_value_type;
+
+  /** Default number of shards */
+  static constexpr size_t default_n_shards = 16;
+
+  /** Construct an empty map with the given number of shards.
+   *
+   * With a single shard all writers share one lock. */
+  explicit ConcurrentCtxMap(size_t n_shards = default_n_shards);
+
+  /** \name Modifiers */
+  ///@{
+  /** Insert or update a key (see CtxMap::update for the accepted values) */
+  void update(const std::string& key, entry_value_type e) {
+    insert(make_full_key(key), std::move(e));
+  }
+
+  /** Insert or update a key holding an AtomicSlot<T>.
+   *
+   * If the key holds an AtomicSlot<T> already, the value is stored into the
+   * slot without taking the lock of the shard or waiting for the readers
+   * (see CtxMap::update_atomic). Otherwise a new slot is inserted.
+   */
+  template <typename T>
+  void update_atomic(const std::string& key, T value) {
+    const std::string full_key = make_full_key(key);
+    {
+      EpochManager::Guard guard(m_state->epochs);
+      const CtxMapValue* entry = find_value(full_key);
+      if (entry != nullptr && entry->type_id() == TypeRegistry::id_of<AtomicSlot<T>>()) {
+        const_cast<AtomicSlot<T>&>(entry->get<AtomicSlot<T>>()).store(std::move(value));
+        return;
+      }
+    }
+    insert(full_key, std::make_shared<AtomicSlot<T>>(std::move(value)));
+  }
+
+  /** Start a batch of modifications of this map (see CtxMapBatch).
+   *
+   * On commit the lock of each shard affected by the batch is taken once
+   * and all modifications are applied in a single traversal of the shard's
+   * tree. All modifications of the batch become visible to the readers at
+   * once, also if they affect several shards, i.e. readers see either all
+   * or none of them.
+   */
+  CtxMapBatch batch();
+
+  /** Replace the entries at and below a path by the entries of a map built
+   *  elsewhere, e.g. by a producer thread in a private CtxMap.
+   *
+   * The subtree of ``staging`` is linked into the map as a whole (see
+   * CtxMap::rename_subtree), such that the readers switch from the old to
+   * the new entries at once and never see a partially installed subtree.
+   * The storage of ``staging`` is taken over like for
+   * ``CtxMap::update(key, CtxMap&&)``. The shard is only locked for a time
+   * independent of the number of entries. The old entries are destroyed
+   * after the lock has been released.
+   *
+   * If the path is the root of the map, all shards are replaced at once,
+   * like for erase_recursive.
+   */
+  void publish(const std::string& path, CtxMap&& staging);
+
+  /** Try to remove an element
+   *
+   * \return The number of removed elements (i.e. 0 or 1)
+   */
+  size_t erase(const key_view_type& key);
+
+  /** Try to remove a full submap path including all child key entries.
+   *
+   * If the path is the root of the map, all shards are cleared at once,
+   * i.e. subtree_size never observes a partially cleared map.
+   *
+   * \return The number of key-value entries removed from the map
+   */
+  size_t erase_recursive(const key_view_type& path);
+
+  /** Remove all elements from the map (or the submap) */
+  void clear() { erase_recursive("/"); }
+
+  /** Release the values replaced or removed by earlier modifications.
+   *
+   * The copy of a shard's tree not used by the readers keeps the values
+   * until the next modification of the shard (see the class documentation).
+   * This waits for the readers, which might still use them, and releases
+   * them right away. It never waits while holding the lock of a shard.
+   */
+  void reclaim();
+  ///@}
+
+  /** \name Obtaining elements */
+  ///@{
+  /** Return a copy of the value at a given key with the specified type.
+   *
+   * If the value cannot be found an out_of_range is thrown,
+   * if it has a different type a type_mismatch.
+   */
+  template <typename T>
+  T at(const key_view_type& key) const {
+    const std::string full_key = make_full_key(key);
+    EpochManager::Guard guard(m_state->epochs);
+    return value_at(key, full_key).get<T>();
+  }
+
+  /** Return a copy of the value at a given key or the provided default
+   *  if the key cannot be found. */
+  template <typename T>
+  T at(const key_view_type& key, const T& default_value) const {
+    const std::string full_key = make_full_key(key);
+    EpochManager::Guard guard(m_state->epochs);
+    const CtxMapValue* value = find_value(full_key);
+    return value == nullptr ? default_value : value->get<T>();
+  }
+
+  /** Return a pointer to the value of a specific key.
+   *
+   * Unlike the values returned by ``at`` the object is not copied,
+   * but it is not affected by later updates of the key either.
+   */
+  template <typename T>
+  std::shared_ptr<const T> at_ptr(const key_view_type& key) const {
+    const std::string full_key = make_full_key(key);
+    EpochManager::Guard guard(m_state->epochs);
+    return value_at(key, full_key).get_ptr<T>();
+  }
+
+  /** Return the current value of a key holding an AtomicSlot<T> */
+  template <typename T>
+  T at_atomic(const key_view_type& key) const {
+    const std::string full_key = make_full_key(key);
+    EpochManager::Guard guard(m_state->epochs);
+    return value_at(key, full_key).get<AtomicSlot<T>>().load();
+  }
+
+  /** Check weather a key exists */
+  bool exists(const key_view_type& key) const;
+
+  /** Return the number of keys stored under a path (see CtxMap::subtree_size) */
+  size_t subtree_size(const key_view_type& path) const;
+  ///@}
+
+  /** \name Submaps */
+  ///@{
+  /** Get a view of the subtree at a location (see CtxMap::submap for details).
+   *
+   * The submap refers to the same data, so modifications via the submap
+   * are visible in this map and vice versa. */
+  ConcurrentCtxMap submap(const std::string& location) const {
+    return ConcurrentCtxMap(m_state, make_full_key(location));
+  }
+  ///@}
+
+  /** Return the number of shards of the map */
+  size_t n_shards() const { return m_state->shards.size(); }
+
+ private:
+  /** A modification of a shard, which is called as modify(tree, last, replaced)
+   *  for both trees of the shard.
+   *
+   * For the second tree last is true, such that arguments may be moved into
+   * the tree. Subtrees removed from the tree may be put into replaced, which
+   * is destroyed after the lock of the shard has been released.
+   */
+  typedef std::function<void(CtxMapTree& tree, bool last,
+                             std::vector<CtxMapTree>& replaced)>
+        ShardModification;
+
+  /** A part of the map guarded by its own lock */
+  struct Shard {
+    /** Lock serialising the writers */
+    SharedMutex mutex;
+
+    /** The two copies of the entries of the shard with their full keys */
+    CtxMapTree trees[2];
+
+    /** The tree used by the readers, packed as (version << 1) | index:
+     *  Readers, which have seen this version of the map (see State::version)
+     *  or a later one, use trees[index], all others the other tree. */
+    std::atomic<uint64_t> state{0};
+
+    /** The last modification, which still needs to be repeated on the tree
+     *  not used by the readers, and the epoch after which no reader uses it
+     *  any more (only accessed with the lock held) */
+    ShardModification pending;
+    uint64_t pending_epoch = 0;
+
+    /** Return the index of the tree holding all modifications */
+    size_t latest() const { return state.load() & 1; }
+
+    /** Return the tree used by the readers, which have seen the given version */
+    const CtxMapTree& readers_tree(uint64_t version) const {
+      const uint64_t packed = state.load(std::memory_order_acquire);
+      const size_t index    = packed & 1;
+      return trees[(packed >> 1) <= version ? index : 1 - index];
+    }
+
+    /** Keep the locks of adjacent shards on separate cache lines */
+    char padding[64];
+  };
+
+  /** The data shared by all views of the map */
+  struct State {
+    explicit State(size_t n_shards) : shards(n_shards) {}
+
+    std::vector<Shard> shards;
+
+    /** Version of the map, which is incremented whenever writers direct the
+     *  readers to modified trees */
+    std::atomic<uint64_t> version{0};
+
+    /** Lock serialising the increments of the version */
+    std::mutex version_mutex;
+
+    /** Tracking of the readers of the map */
+    EpochManager epochs;
+  };
+
+  /** Construct a view of the shards at a location */
+  ConcurrentCtxMap(std::shared_ptr<State> state, std::string location)
+        : m_state{std::move(state)}, m_location{std::move(location)} {}
+
+  /** Make the full key from a key supplied by the user, i.e. either ""
+   *  or a key of the form "/a/b/c" (see CtxMap::make_full_key). */
+  std::string make_full_key(const key_view_type& key) const {
+    return CtxMapKey::full_key(m_location, key);
+  }
+
+  /** Return the shard responsible for a full key, which is determined
+   *  by the top-level component of the key. */
+  Shard& shard_of(const std::string& full_key) const {
+    return m_state->shards[shard_index(full_key)];
+  }
+
+  /** Apply the modifications of a batch */
+  void apply(std::vector<CtxMapTree::Modification> modifications);
+
+  /** Return the index of the shard responsible for a full key */
+  size_t shard_index(const std::string& full_key) const;
+
+  /** Insert or update the value stored under a full key */
+  void insert(std::string full_key, entry_value_type e);
+
+  /** Take the locks of the shards with the given indices (in increasing
+   *  order) once their pending modifications may be repeated.
+   *
+   * If readers might still use the trees the pending modifications need to
+   * be applied to, the locks are released while waiting for the readers.
+   */
+  std::vector<std::unique_lock<SharedMutex>> lock_shards(
+        const std::vector<size_t>& indices);
+
+  /** Apply modifications[i] to the shard indices[i] for all i and release
+   *  the locks of the shards (taken by lock_shards) afterwards.
+   *
+   * The pending modifications are repeated on the trees not used by the
+   * readers, which are then modified and the readers directed to them.
+   * The modifications become pending for the other trees.
+   */
+  void modify_shards(std::vector<std::unique_lock<SharedMutex>> locks,
+                     const std::vector<size_t>& indices,
+                     std::vector<ShardModification> modifications);
+
+  /** Return the value stored under a full key or nullptr.
+   *  Only valid while an EpochManager::Guard is held. */
+  const CtxMapValue* find_value(const std::string& full_key) const {
+    return shard_of(full_key).readers_tree(m_state->version.load()).find(full_key);
+  }
+
+  /** Return the value stored under a key (given in user and full form)
+   *  or throw if there is none. */
+  const CtxMapValue& value_at(const key_view_type& key,
+                              const std::string& full_key) const {
+    const CtxMapValue* value = find_value(full_key);
+    if (value == nullptr) {
+      throw out_of_range("Key '" + std::string(key) + "' is not known.");
+    }
+    return *value;
+  }
+
+  std::shared_ptr<State> m_state;
+
+  /** The location of the view (a full key like "/tree" or "" for the root) */
+  std::string m_location;
+};
+
+}  // namespace ctx
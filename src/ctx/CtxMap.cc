@@ -16,82 +16,62 @@
 
 #include "CtxMap.hh"
 #include <algorithm>
+#include <exception>
 #include <iomanip>
+#include <thread>
 #include <vector>
 
 namespace ctx {
 
-namespace {
-/** Return an iterator which points to the first key-value pair where the key begins
- * with the provided string ``start``.
- *
- * Together with subtree_keys_end this allows to iterate over a range of
- * values in the map, where the keys start with ``start``.
- */
-template <typename Map>
-auto subtree_keys_begin(Map& map, const std::string& start) -> decltype(std::begin(map)) {
-  return map.lower_bound(start);
-}
-
-/** Return an iterator which points to the first key-value pair where the key does
- *  not begin with the with the provided string ``start``.
- *
- * Together with subtree_keys_begin this allows to iterate over a range of
- * values in the map, where the keys start with ``start``.
- */
-template <typename Map>
-auto subtree_keys_end(Map& map, const std::string& start) -> decltype(std::end(map)) {
-  // If start is empty, then we iterate over the full map:
-  if (start.length() == 0) return std::end(map);
-
-  // Seek to the first key-value pair which is no longer part
-  // of the range we care about, i.e. which does not compare less or equal
-  // with reference to start + "/" using the comparator of the map,
-  // which sorts "/" before any other character.
-  //
-  // Note that this is inclusive both with respect to the root of the subtree
-  // (just start) as well as exclusive compared to keys such as start + "_blabla".
-  // This is done in order to distinguish keys such as /subkey_bla from /subkey/bla,
-  // where the latter should be part of the range and the former not.
-  auto it = subtree_keys_begin(map, start);
-  CtxMap::key_comparator_type comp{};
-  for (; it != std::end(map); ++it) {
-    if (comp(start + "/", it->first.substr(0, start.length() + 1))) break;
-  }
-  return it;
-}
-}  // namespace
-
-bool CtxMap::key_comparator_type::operator()(const std::string& x,
-                                             const std::string& y) const {
-  return std::lexicographical_compare(
-        x.begin(), x.end(), y.begin(), y.end(), [](const char& lhs, const char& rhs) {
-          if (lhs == '/') return rhs != '/';  // '/' sorts before anything unless its '/'
-          if (rhs == '/') return false;
-          return lhs < rhs;
-        });
-}
-
 CtxMap& CtxMap::operator=(CtxMap other) {
   m_location      = std::move(other.m_location);
   m_container_ptr = std::move(other.m_container_ptr);
   return *this;
 }
 
-CtxMap::CtxMap(const CtxMap& other) : CtxMap() {
-  if (other.m_location == std::string("")) {
-    // We are root, copy everything
-    m_container_ptr = std::make_shared<map_type>(*other.m_container_ptr);
-  } else {
-    update(other);
-  }
-}
+CtxMap::CtxMap(const CtxMap& other)
+      : m_container_ptr{std::make_shared<map_type>(*other.m_container_ptr,
+                                                   other.m_location)},
+        m_location{""} {}
 
 void CtxMap::update(std::initializer_list<entry_type> il) {
-  // Make each key a full path key and append/modify entry in map
-  for (entry_type t : il) {
-    (*m_container_ptr)[make_full_key(t.first)] = std::move(t.second);
+  load(make_entries(std::begin(il), std::end(il)), false);
+}
+
+void CtxMap::load(std::vector<map_type::Modification> entries, bool replace) {
+  // Normalising the keys dominates the cost of building the tree, so large
+  // inputs are split amongst several threads. Below this number of keys
+  // per thread starting the threads does not pay off.
+  const size_t min_keys_per_thread = 16384;
+  const size_t n_threads           = std::max<size_t>(
+        1, std::min<size_t>(std::thread::hardware_concurrency(),
+                            entries.size() / min_keys_per_thread));
+
+  const size_t chunk_size = (entries.size() + n_threads - 1) / n_threads;
+  std::vector<std::exception_ptr> errors(n_threads);
+  auto normalise_chunk    = [this, &entries, &errors, chunk_size](size_t chunk) {
+    try {
+      const size_t end = std::min(entries.size(), (chunk + 1) * chunk_size);
+      for (size_t i = chunk * chunk_size; i < end; ++i) {
+        entries[i].key = make_full_key(entries[i].key);
+      }
+    } catch (...) {
+      errors[chunk] = std::current_exception();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t chunk = 1; chunk < n_threads; ++chunk) {
+    threads.emplace_back(normalise_chunk, chunk);
+  }
+  normalise_chunk(0);
+  for (std::thread& thread : threads) thread.join();
+  for (const std::exception_ptr& error : errors) {
+    if (error) std::rethrow_exception(error);
   }
+
+  if (replace) clear();
+  m_container_ptr->apply(std::move(entries));
 }
 
 void CtxMap::clear() {
@@ -100,29 +80,79 @@ void CtxMap::clear() {
     m_container_ptr->clear();
   } else {
     // Clear only our stuff
-    erase(begin(), end());
+    m_container_ptr->erase_subtree(m_location);
   }
 }
 
+typename CtxMap::iterator CtxMap::erase(iterator position) {
+  // Find the successor before the node of position is potentially
+  // removed from the tree. Removing the key only prunes nodes which
+  // are not on the path to the successor, so it stays valid.
+  iterator next = position;
+  ++next;
+  m_container_ptr->erase(position.full_key());
+  return next;
+}
+
 void CtxMap::update(const std::string& key, const CtxMap& other) {
-  for (auto it = other.begin(); it != other.end(); ++it) {
-    // The iterator truncates the other key relative to the builtin
-    // location of other for us. We then make it full for our location
-    // and update.
-    (*m_container_ptr)[make_full_key(key + "/" + it->key())] = it->value_raw();
-  }
+  // Merge a tree sharing the nodes of the submap other views
+  const map_type subtree(other.container(), other.m_location);
+  m_container_ptr->merge(make_full_key(key), subtree);
 }
 
 void CtxMap::update(const std::string& key, CtxMap&& other) {
-  for (auto it = other.begin(); it != other.end(); ++it) {
-    // The iterator truncates the other key relative to the builtin
-    // location of other for us. We then make it full for our location
-    // and update.
-    (*m_container_ptr)[make_full_key(key + "/" + it->key())] = std::move(it->value_raw());
+  // Nodes still shared with other maps are not moved by the merge
+  m_container_ptr->merge(make_full_key(key), take_entries(std::move(other)));
+}
+
+CtxMap::map_type CtxMap::take_entries(CtxMap&& map) {
+  if (map.m_container_ptr.use_count() > 1) {
+    // Further maps (maybe even the one receiving the entries) view the
+    // container of map, so the entries need to stay where they are.
+    return map_type(map.container(), map.m_location);
   }
+
+  // Nobody else can see the entries of map, so take over its nodes
+  return map.m_container_ptr->extract(map.m_location);
+}
+
+namespace {
+/** Is the normalised key path equal to or below the normalised key parent */
+bool is_within(const std::string& path, const std::string& parent) {
+  return path.compare(0, parent.size(), parent) == 0 &&
+         (path.size() == parent.size() || path[parent.size()] == '/');
 }
+}  // namespace
 
-std::string CtxMap::make_full_key(const std::string& key) const {
+void CtxMap::rename_subtree(const key_view_type& from, const key_view_type& to) {
+  const std::string from_full = make_full_key(from);
+  const std::string to_full   = make_full_key(to);
+  if (from_full == to_full) return;
+  if (is_within(to_full, from_full)) {
+    throw invalid_argument("Cannot move the path '" + std::string(from) +
+                           "' to the path '" + std::string(to) + "' below it.");
+  }
+  if (m_container_ptr->subtree_size(from_full) == 0) {
+    throw out_of_range("Key '" + std::string(from) + "' is not known.");
+  }
+  m_container_ptr->exchange(to_full, m_container_ptr->extract(from_full));
+}
+
+void CtxMap::swap_subtrees(const key_view_type& a, const key_view_type& b) {
+  const std::string a_full = make_full_key(a);
+  const std::string b_full = make_full_key(b);
+  if (a_full == b_full) return;
+  if (is_within(a_full, b_full) || is_within(b_full, a_full)) {
+    throw invalid_argument("Cannot swap the path '" + std::string(a) +
+                           "' with the path '" + std::string(b) + "', which contain "
+                           "one another.");
+  }
+  map_type subtree_a = m_container_ptr->extract(a_full);
+  map_type subtree_b = m_container_ptr->exchange(b_full, std::move(subtree_a));
+  m_container_ptr->exchange(a_full, std::move(subtree_b));
+}
+
+std::string CtxMap::make_full_key(const key_view_type& key) const {
   if (m_location.length() > 0) {
     if (m_location[0] != '/' || m_location.back() == '/') {
       throw internal_error(
@@ -131,42 +161,7 @@ std::string CtxMap::make_full_key(const std::string& key) const {
     }
   }
 
-  // Make a stack out of the key:
-  std::vector<std::string> pathparts;
-
-  // start gives the location after the last '/',
-  // ie where the current part of the key path begins and end gives
-  // the location of the current '/', i.e. the past-the-end index
-  // of the current path part.
-  for (size_t start = 0; start < key.size(); ++start) {
-    // Past-the-end of the current path part:
-    const size_t end = key.find('/', start);
-
-    // Empty path part (i.e. something like '//' is encountered:
-    if (start == end) continue;
-
-    // Extract the part we deal with in this iteration:
-    std::string part = key.substr(start, end - start);
-
-    // Update start for next iteration:
-    start += part.length();
-
-    if (part == ".") {
-      // Ignore "." path part (does nothing)
-      continue;
-    } else if (part == "..") {
-      // If ".." path part, then pop the most recently added path part if any.
-      if (!pathparts.empty()) pathparts.pop_back();
-    } else {
-      pathparts.push_back(std::move(part));
-    }
-  }
-
-  std::string res{m_location};
-  for (const auto& part : pathparts) {
-    res += "/" + part;
-  }
-
+  const std::string res = CtxMapKey::full_key(m_location, key);
   if (res.length() > 0) {
     if (res[0] != '/' || res.back() == '/') {
       throw internal_error(
@@ -179,33 +174,32 @@ std::string CtxMap::make_full_key(const std::string& key) const {
 }
 
 typename CtxMap::iterator CtxMap::begin(const std::string& path) {
-  // Obtain iterator to the first key-value pair, which has a
-  // key starting with the full path plus a tailling "/" in order
-  // to distinguish a key such as /path/key from one such as /pathkey,
-  // with the former being included and the latter being excluded.
-  //
-  // (since the keys are sorted alphabetically in the map
-  //  the ones which follow next must all be below our current
-  //  location or already well past it.)
+  // The keys below the path are exactly the ones stored in the subtree
+  // of the node representing the path. Since the tree is traversed in
+  // preorder, the subtree root comes first, i.e. the key path + "/"
+  // is part of the range.
   const std::string path_full = make_full_key(path);
-  return iterator(subtree_keys_begin(*m_container_ptr, path_full), path_full);
+  map_type& container         = *m_container_ptr;
+  return iterator(&container, container.find_node(path_full), path_full);
 }
 
 typename CtxMap::const_iterator CtxMap::cbegin(const std::string& path) const {
   const std::string path_full = make_full_key(path);
-  return const_iterator(subtree_keys_begin(*m_container_ptr, path_full), path_full);
+  const map_type& container   = *m_container_ptr;
+  return const_iterator(&container, container.find_node(path_full), path_full);
 }
 
 typename CtxMap::iterator CtxMap::end(const std::string& path) {
-  // Obtain the first key which does no longer start with the pull path,
-  // i.e. where we are done processing the subpath.
+  // The iteration is done once the subtree of the path node is exhausted.
   const std::string path_full = make_full_key(path);
-  return iterator(subtree_keys_end(*m_container_ptr, path_full), path_full);
+  map_type& container         = *m_container_ptr;
+  return iterator::make_end(&container, container.find_node(path_full), path_full);
 }
 
 typename CtxMap::const_iterator CtxMap::cend(const std::string& path) const {
   const std::string path_full = make_full_key(path);
-  return const_iterator(subtree_keys_end(*m_container_ptr, path_full), path_full);
+  const map_type& container   = *m_container_ptr;
+  return const_iterator::make_end(&container, container.find_node(path_full), path_full);
 }
 
 std::ostream& operator<<(std::ostream& o, const CtxMap& map) {
@@ -15,11 +15,22 @@
 //
 
 #pragma once
+#include "AtomicCell.hh"
+#include "AtomicSlot.hh"
+#include "CtxMapBatch.hh"
+#include "CtxMapHandle.hh"
 #include "CtxMapIterator.hh"
+#include "CtxMapReclaimer.hh"
+#include "CtxMapRegion.hh"
+#include "FrozenCtxMap.hh"
 #include "exceptions.hh"
+#include <iterator>
+#include <vector>
 
 namespace ctx {
 
+class ConcurrentCtxMap;
+
 /** CtxMap implements a map from a std::string to objects of arbitrary
  *  type.
  *
@@ -39,15 +50,20 @@ class CtxMap {
  public:
   /** Custom comparator to sort key strings. Makes sure that slashes "/"
    *  sort before any other character. */
-  struct key_comparator_type {
-    bool operator()(const std::string& x, const std::string& y) const;
-    typedef std::string first_argument_type;
-    typedef std::string second_argument_type;
-    typedef bool result_type;
-  };
+  typedef CtxMapKeyComparator key_comparator_type;
 
   typedef CtxMapValue entry_value_type;
-  typedef std::map<std::string, entry_value_type, key_comparator_type> map_type;
+
+  /** Precompiled key type, see CtxMapKey for details */
+  typedef CtxMapKey Key;
+
+  /** The container used to store the data.
+   *
+   *  This is a tree with one node per key path component, such that
+   *  lookups and subtree operations only need to look at the components
+   *  of the key one by one instead of comparing full key strings.
+   */
+  typedef CtxMapTree map_type;
   typedef std::pair<const std::string, entry_value_type> entry_type;
   typedef CtxMapIterator<true> const_iterator;
   typedef CtxMapIterator<false> iterator;
@@ -58,9 +74,36 @@ class CtxMap {
    * Constructs empty map */
   CtxMap() : m_container_ptr{std::make_shared<map_type>()}, m_location{""} {}
 
+  /** \brief Construct an empty map, which allocates its memory from a resource.
+   *
+   * The nodes of the tree storing the entries (including the components
+   * of the keys) as well as the values the map constructs itself (cheaply
+   * copyable values passed to update, values created by emplace or
+   * update_copy) are allocated from the resource. So are copies of the map and
+   * maps obtained from it (like snapshots), such that the resource needs
+   * to outlive all of them. Entries taken over from other maps (e.g. via
+   * ``update(key, CtxMap&&)``) stay in the memory they were allocated in
+   * and so do objects handed over as a std::shared_ptr or moved into a
+   * CtxMapValue before they are passed to the map.
+   * The characters of key components too long for the internal buffer of a
+   * std::string (15 characters for libstdc++) still come from the global heap.
+   *
+   * With a std::pmr::monotonic_buffer_resource or a pool resource per job,
+   * maps of different jobs do not contend for the global heap.
+   */
+  explicit CtxMap(memory_resource* resource)
+        : m_container_ptr{std::make_shared<map_type>(resource)}, m_location{""} {}
+
   /** \brief Construct parameter map from initialiser list of entry_types */
   CtxMap(std::initializer_list<entry_type> il) : CtxMap{} { update(il); };
 
+  /** \brief Construct a map from a range of key-value pairs (see assign) */
+  template <typename InputIterator,
+            typename = typename std::iterator_traits<InputIterator>::iterator_category>
+  CtxMap(InputIterator first, InputIterator last) : CtxMap{} {
+    assign(first, last);
+  }
+
   ~CtxMap()        = default;
   CtxMap(CtxMap&&) = default;
 
@@ -92,6 +135,10 @@ class CtxMap {
    * std::cout << copy.at<int>("a");
    * ```
    * will print 42 twice.
+   *
+   * The copy is cheap (independent of the size of the map), since both
+   * maps share their storage until one of them is modified. Modifications
+   * only copy the tree nodes on the path to the modified key.
    * */
   CtxMap(const CtxMap& other);
 
@@ -111,15 +158,77 @@ class CtxMap {
    *   - Shared pointers
    */
   void update(const std::string& key, entry_value_type e) {
-    (*m_container_ptr)[make_full_key(key)] = std::move(e);
+    map_type& tree = *m_container_ptr;
+    tree.replace(tree[make_full_key(key)], std::move(e));
+  }
+
+  /** \brief Insert or update a key with a cheaply copyable value.
+   *
+   * The copy of the value is allocated from the memory resource of the
+   * node holding the key (see emplace).
+   */
+  template <typename T,
+            typename std::enable_if<IsCheaplyCopyable<T>::value, int>::type = 0>
+  void update(const std::string& key, T value) {
+    emplace<T>(key, std::move(value));
+  }
+
+  /** \brief Insert or update a key with a value of type T constructed from args.
+   *
+   * Unlike for ``update(key, T(args...))`` the object is allocated from the
+   * memory resource of the node holding the key (see CtxMapValue::allocate),
+   * i.e. from the resource of the map or from the region the key lies in
+   * (see attach_region).
+   */
+  template <typename T, typename... Args>
+  void emplace(const std::string& key, Args&&... args) {
+    m_container_ptr->emplace<T>(make_full_key(key), std::forward<Args>(args)...);
+  }
+
+  /** \brief Insert or update a key given as a precompiled Key.
+   *
+   * Equivalent to the std::string version, but skips the key normalisation.
+   */
+  void update(const Key& key, entry_value_type e) {
+    m_container_ptr->replace(m_container_ptr->insert(m_location, key), std::move(e));
+  }
+
+  /** \brief Insert or update a key given as a precompiled Key with a cheaply
+   *  copyable value (see the std::string version) */
+  template <typename T,
+            typename std::enable_if<IsCheaplyCopyable<T>::value, int>::type = 0>
+  void update(const Key& key, T value) {
+    m_container_ptr->emplace<T>(m_location, key, std::move(value));
   }
 
   /** \brief Update many entries using an initialiser list
    *
-   * TODO More details, have an example
+   * The entries are inserted in one go like in assign, but the existing
+   * entries are kept.
    * */
   void update(std::initializer_list<entry_type> il);
 
+  /** \brief Replace all entries by a range of key-value pairs.
+   *
+   * The range may hold any objects with a member ``first`` giving the key and
+   * a member ``second`` giving the value (anything convertible to an
+   * entry_value_type), e.g. the entries of a
+   * ``std::vector<std::pair<std::string, double>>``. If a key occurs
+   * more than once, the last value is kept. For a submap only the
+   * entries of the submap are replaced.
+   *
+   * This is much cheaper than inserting the entries one by one: The keys of
+   * large ranges are normalised on several threads and the tree is built in
+   * a single pass (see CtxMapTree::apply). If the keys are sorted according
+   * to the key_comparator_type (like the keys of another CtxMap), each entry
+   * is appended without any search, such that the cost is linear in the
+   * number of entries.
+   */
+  template <typename InputIterator>
+  void assign(InputIterator first, InputIterator last) {
+    load(make_entries(first, last), true);
+  }
+
   /** \brief Update many entries using another CtxMap
    *
    * The entries are updated relative to the given key paths.
@@ -142,6 +251,11 @@ class CtxMap {
    * The entries are updated relative to the given key paths.
    * I.e. if key == "blubber" and the map \t map contairs "foo" and
    * "bar", then "blubber/foo" and "blubber/bar" will be updated.
+   *
+   * If no other map views the storage of ``other`` (e.g. it is a map of its
+   * own and not a submap), the entries are moved: The storage is handed over
+   * to this map without copying any key or value and ``other`` is empty
+   * afterwards. Otherwise this is identical to the update from a const CtxMap.
    * */
   void update(const std::string& key, CtxMap&& other);
 
@@ -157,21 +271,36 @@ class CtxMap {
    */
   void update(CtxMap&& other) { update("/", std::move(other)); }
 
-  /** Insert or update a key with a copy of an element */
+  /** Insert or update a key with a copy of an element (allocated like
+   *  the values created by emplace) */
   template <typename T>
   void update_copy(std::string key, T object) {
-    (*m_container_ptr)[make_full_key(key)] =
-          entry_value_type{std::make_shared<T>(object)};
+    emplace<T>(key, std::move(object));
   }
 
+  /** \brief Insert or update a key holding an AtomicSlot<T>.
+   *
+   * If the key holds an AtomicSlot<T> already, the value is stored into the
+   * slot. This does not modify the map itself, such that other threads may
+   * read the key concurrently via at_atomic (or any other key via the const
+   * functions of the map). They obtain either the old or the new value.
+   * Like modifications via ``at``, this affects all copies of the map.
+   *
+   * Otherwise a new slot holding the value is inserted under the key,
+   * which is only safe if no other thread accesses the map at the same time.
+   */
+  template <typename T>
+  void update_atomic(const std::string& key, T value);
+
   /** Insert a default value for a key, i.e. no existing key will be touched,
    * only new ones inserted (That's why the method is still const)
    */
   void insert_default(const std::string& key, entry_value_type e) const {
-    auto itkey = m_container_ptr->find(make_full_key(key));
-    if (itkey == std::end(*m_container_ptr)) {
+    const std::string full_key = make_full_key(key);
+    if (container().find(full_key) == nullptr) {
       // Key not found, hence insert default.
-      (*m_container_ptr)[make_full_key(key)] = std::move(e);
+      map_type& tree = *m_container_ptr;
+      tree.replace(tree[full_key], std::move(e));
     }
   }
 
@@ -186,12 +315,27 @@ class CtxMap {
     }
   }
 
+  /** \brief Start a batch of modifications of this map.
+   *
+   * The updates and removals collected in the batch are applied on
+   * CtxMapBatch::commit in a single traversal of the tree, which is
+   * cheaper than the same number of calls to update or erase. Keys are
+   * relative to the location of this map. See CtxMapBatch for details.
+   */
+  CtxMapBatch batch() {
+    std::shared_ptr<map_type> container = m_container_ptr;
+    return CtxMapBatch(m_location,
+                       [container](std::vector<map_type::Modification> modifications) {
+                         container->apply(std::move(modifications));
+                       });
+  }
+
   /** \brief Try to remove an element
    *  which is referenced by this string
    *
    *  \return The number of removed elements (i.e. 0 or 1)
    **/
-  size_t erase(const std::string& key) {
+  size_t erase(const key_view_type& key) {
     return m_container_ptr->erase(make_full_key(key));
   }
 
@@ -200,13 +344,7 @@ class CtxMap {
    *  \return The iterator referencing the key *after* the last
    *          element removed
    **/
-  iterator erase(iterator position) {
-    // Extract actual map iterator by converting to it explictly:
-    typedef map_type::iterator mapiter;
-    auto pos_conv = static_cast<typename map_type::iterator>(position);
-    mapiter res   = m_container_ptr->erase(pos_conv);
-    return iterator(std::move(res), m_location);
-  }
+  iterator erase(iterator position);
 
   /** \brief Try to remove a range of elements
    *
@@ -214,12 +352,8 @@ class CtxMap {
    *          element removed
    **/
   iterator erase(iterator first, iterator last) {
-    // Extract actual map iterator by converting to it explictly:
-    typedef map_type::iterator mapiter;
-    auto first_conv = static_cast<typename map_type::iterator>(first);
-    auto last_conv  = static_cast<typename map_type::iterator>(last);
-    mapiter res     = m_container_ptr->erase(first_conv, last_conv);
-    return iterator(std::move(res), m_location);
+    while (first != last) first = erase(first);
+    return last;
   }
 
   /** \brief Try to remove a full submap path including all
@@ -228,7 +362,59 @@ class CtxMap {
    *  \note  The function is equivalent to ``this->submap(path).clear()``.
    *  \return The number of key-value entries removed from the map
    */
-  void erase_recursive(const std::string& path) { erase(begin(path), end(path)); }
+  size_t erase_recursive(const key_view_type& path) {
+    return m_container_ptr->erase_subtree(make_full_key(path));
+  }
+
+  /** \brief Allocate the keys and values to be stored below a path
+   *         from a memory region of their own.
+   *
+   * The nodes of the tree storing the entries (including the components
+   * of the keys) and the values the map constructs itself (see emplace) are
+   * carved from large chunks of memory (see CtxMapRegion). Memory of removed
+   * entries is reused for new ones and once the last entry is gone, all
+   * chunks are released at once, e.g.
+   * ```
+   * map.attach_region("scf/iter7");
+   * // ... store thousands of intermediate results below scf/iter7 ...
+   * map.erase_recursive("scf/iter7");
+   * ```
+   * This saves the individual calls into the global heap, but removing the
+   * path still visits every entry, since the stored objects are destroyed as
+   * usual (see set_reclaimer to do this in the background). If entries
+   * of the path are still referred to elsewhere, e.g. by a copy or a snapshot
+   * of the map, the chunks are only released once these are gone as well.
+   * Objects handed over as a std::shared_ptr stay where they were allocated.
+   *
+   * The region ends once the path is removed or becomes empty. If the path
+   * holds entries already or is the root, an invalid_argument is thrown.
+   */
+  void attach_region(const key_view_type& path,
+                     size_t chunk_size = CtxMapRegion::default_chunk_size) {
+    m_container_ptr->attach_region(make_full_key(path), chunk_size);
+  }
+
+  /** \brief Move all entries at and below one path to another path.
+   *
+   * The entries previously stored at and below ``to`` are removed.
+   * The subtree of entries is relinked as a whole, i.e. the cost is
+   * independent of the number of entries moved or replaced. This makes it
+   * cheap to e.g. turn the data of the current iteration into the data of
+   * the previous one.
+   *
+   * If ``from`` does not exist, an out_of_range is thrown, if ``to`` lies
+   * below ``from``, an invalid_argument is thrown.
+   */
+  void rename_subtree(const key_view_type& from, const key_view_type& to);
+
+  /** \brief Exchange the entries at and below two paths.
+   *
+   * Like rename_subtree the subtrees are relinked as a whole, such that the
+   * cost is independent of the number of entries. A path without entries
+   * is treated like an empty subtree. If one path lies below the other,
+   * an invalid_argument is thrown.
+   */
+  void swap_subtrees(const key_view_type& a, const key_view_type& b);
 
   /** Remove all elements from the map
    *
@@ -255,7 +441,7 @@ class CtxMap {
    * copy constructor for details.
    */
   template <typename T>
-  T& at(const std::string& key) {
+  T& at(const key_view_type& key) {
     return at_raw_value(key).get<T>();
   }
 
@@ -264,7 +450,23 @@ class CtxMap {
    * See non-const version for details.
    */
   template <typename T>
-  const T& at(const std::string& key) const {
+  const T& at(const key_view_type& key) const {
+    return at_raw_value(key).get<T>();
+  }
+
+  /** \brief Return a reference to the value at a given precompiled key
+   * with the specified type. See std::string version for details.
+   */
+  template <typename T>
+  T& at(const Key& key) {
+    return at_raw_value(key).get<T>();
+  }
+
+  /** \brief Return a reference to the value at a given precompiled key
+   * with the specified type. (const version)
+   */
+  template <typename T>
+  const T& at(const Key& key) const {
     return at_raw_value(key).get<T>();
   }
 
@@ -274,13 +476,13 @@ class CtxMap {
    * If the type requested is wrong the program is aborted.
    */
   template <typename T>
-  T& at(const std::string& key, T& default_value);
+  T& at(const key_view_type& key, T& default_value);
 
   /** \brief Get the value of an element (const version).
    * See non-const version for details.
    */
   template <typename T>
-  const T& at(const std::string& key, const T& default_value) const;
+  const T& at(const key_view_type& key, const T& default_value) const;
 
   /** \brief Return a pointer to the value of a specific key.
    *
@@ -295,7 +497,7 @@ class CtxMap {
    * Use the contains_shared_ptr() function to check this.
    */
   template <typename T>
-  std::shared_ptr<T> at_ptr(const std::string& key) {
+  std::shared_ptr<T> at_ptr(const key_view_type& key) {
     return at_raw_value(key).get_ptr<T>();
   }
 
@@ -304,10 +506,68 @@ class CtxMap {
    * See non-const version for details
    */
   template <typename T>
-  std::shared_ptr<const T> at_ptr(const std::string& key) const {
+  std::shared_ptr<const T> at_ptr(const key_view_type& key) const {
+    return at_raw_value(key).get_ptr<T>();
+  }
+
+  /** Return a pointer to the value of a specific precompiled key. */
+  template <typename T>
+  std::shared_ptr<T> at_ptr(const Key& key) {
     return at_raw_value(key).get_ptr<T>();
   }
 
+  /** Return a pointer to the value of a specific precompiled key. (const version) */
+  template <typename T>
+  std::shared_ptr<const T> at_ptr(const Key& key) const {
+    return at_raw_value(key).get_ptr<T>();
+  }
+
+  /** \brief Return the current value of a key holding an AtomicSlot<T>.
+   *
+   * This may be called while another thread stores new values into the
+   * slot via update_atomic (see there for details).
+   */
+  template <typename T>
+  T at_atomic(const key_view_type& key) const {
+    return at<AtomicSlot<T>>(key).load();
+  }
+
+  /** \brief Return a typed handle to the value of a specific key.
+   *
+   * The handle caches the location of the entry inside the map as well as
+   * the result of the type check, such that repeated accesses via the handle
+   * are as cheap as dereferencing a pointer. Unlike the pointer returned by
+   * at_ptr, the handle follows updates of the key, i.e. after an
+   * ``update(key, ...)`` it refers to the new value. See CtxMapHandle for
+   * details.
+   *
+   * Throws out_of_range if the key does not exist and type_mismatch if
+   * the value is not of type T.
+   */
+  template <typename T>
+  CtxMapHandle<T> handle(const std::string& key) {
+    return handle<T>(Key{key});
+  }
+
+  /** Return a typed handle to the value of a specific key (const version) */
+  template <typename T>
+  CtxMapHandle<const T> handle(const std::string& key) const {
+    return handle<T>(Key{key});
+  }
+
+  /** Return a typed handle to the value of a specific precompiled key */
+  template <typename T>
+  CtxMapHandle<T> handle(const Key& key) {
+    return CtxMapHandle<T>(m_container_ptr, m_location, key);
+  }
+
+  /** Return a typed handle to the value of a specific precompiled key
+   *  (const version) */
+  template <typename T>
+  CtxMapHandle<const T> handle(const Key& key) const {
+    return CtxMapHandle<const T>(m_container_ptr, m_location, key);
+  }
+
   //@{
   /** \brief Get the pointer to the value of a key or a default.
    *
@@ -315,7 +575,7 @@ class CtxMap {
    * If the type requested is wrong the program is aborted.
    */
   template <typename T>
-  std::shared_ptr<T> at_ptr(const std::string& key, std::shared_ptr<T> default_ptr);
+  std::shared_ptr<T> at_ptr(const key_view_type& key, std::shared_ptr<T> default_ptr);
   //@}
 
   //@{
@@ -324,7 +584,7 @@ class CtxMap {
    *  See the non-const version for details.
    */
   template <typename T>
-  std::shared_ptr<const T> at_ptr(const std::string& key,
+  std::shared_ptr<const T> at_ptr(const key_view_type& key,
                                   std::shared_ptr<const T> default_ptr) const;
 
   //@}
@@ -333,12 +593,12 @@ class CtxMap {
    *
    * \note This is an advanced method. Use only if you know what you are doing.
    * */
-  CtxMapValue& at_raw_value(const std::string& key) {
-    auto itkey = m_container_ptr->find(make_full_key(key));
-    if (itkey == std::end(*m_container_ptr)) {
-      throw out_of_range("Key '" + key + "' is not known.");
+  CtxMapValue& at_raw_value(const key_view_type& key) {
+    CtxMapValue* value = find_value(key);
+    if (value == nullptr) {
+      throw out_of_range("Key '" + std::string(key) + "' is not known.");
     }
-    return itkey->second;
+    return *value;
   }
 
   /** Return an CtxMapValue object representing the data behind the specified key
@@ -346,27 +606,162 @@ class CtxMap {
    *
    * \note This is an advanced method. Use only if you know what you are doing.
    * */
-  const CtxMapValue& at_raw_value(const std::string& key) const {
-    auto itkey = m_container_ptr->find(make_full_key(key));
-    if (itkey == std::end(*m_container_ptr)) {
-      throw out_of_range("Key '" + key + "' is not known.");
+  const CtxMapValue& at_raw_value(const key_view_type& key) const {
+    const CtxMapValue* value = find_value(key);
+    if (value == nullptr) {
+      throw out_of_range("Key '" + std::string(key) + "' is not known.");
+    }
+    return *value;
+  }
+
+  /** Return an CtxMapValue object representing the data behind the precompiled key
+   *
+   * \note This is an advanced method. Use only if you know what you are doing.
+   * */
+  CtxMapValue& at_raw_value(const Key& key) {
+    CtxMapValue* value = m_container_ptr->find(m_location, key);
+    if (value == nullptr) {
+      throw out_of_range("Key '" + key.str() + "' is not known.");
+    }
+    return *value;
+  }
+
+  /** Return an CtxMapValue object representing the data behind the precompiled key
+   * (const version)
+   *
+   * \note This is an advanced method. Use only if you know what you are doing.
+   * */
+  const CtxMapValue& at_raw_value(const Key& key) const {
+    const CtxMapValue* value = container().find(m_location, key);
+    if (value == nullptr) {
+      throw out_of_range("Key '" + key.str() + "' is not known.");
     }
-    return itkey->second;
+    return *value;
   }
   ///@}
 
   /** Check weather a key exists */
-  bool exists(const std::string& key) const {
-    return m_container_ptr->find(make_full_key(key)) != std::end(*m_container_ptr);
+  bool exists(const key_view_type& key) const { return find_value(key) != nullptr; }
+
+  /** Check weather a precompiled key exists */
+  bool exists(const Key& key) const {
+    return container().find(m_location, key) != nullptr;
+  }
+
+  /** Return the number of keys stored under a path
+   *
+   * This includes the key ``path + "/"`` itself, i.e. it is the number
+   * of elements visited when iterating from ``begin(path)`` to ``end(path)``.
+   * The number is maintained during insertion and removal of keys, so
+   * this function only costs a lookup of the path.
+   */
+  size_t subtree_size(const key_view_type& path) const {
+    return container().subtree_size(make_full_key(path));
+  }
+
+  /** Return the memory resource of the map (nullptr for the global heap) */
+  memory_resource* resource() const { return container().resource(); }
+
+  /** \brief Destroy removed and replaced values on a background thread.
+   *
+   * Erasing, clearing or overwriting entries may drop the last reference to
+   * a large object, whose destruction (freeing and unmapping its memory) then
+   * takes place inside the call modifying the map. With a reclaimer these
+   * objects are handed over to the reclaimer instead, which destroys them on
+   * a thread of its own, e.g.
+   * ```
+   * auto reclaimer = std::make_shared<CtxMapReclaimer>();
+   * map.set_reclaimer(reclaimer);
+   * map.erase("scf/fock");  // Only enqueues the matrix
+   * reclaimer->flush();     // Wait until it is destroyed
+   * ```
+   * The reclaimer applies to the full map (including all its submaps) and is
+   * passed on to copies of the map made afterwards. Passing a nullptr destroys
+   * the objects right away again. Subtrees removed via erase_recursive are
+   * destroyed by the reclaimer as well. See CtxMapReclaimer for the requirements
+   * on the objects and the memory resource of the map.
+   */
+  void set_reclaimer(std::shared_ptr<CtxMapReclaimer> reclaimer) {
+    m_container_ptr->set_reclaimer(std::move(reclaimer));
   }
 
   /** Return a string which describes the type of the
    * stored data
    */
-  std::string type_name_of(const std::string& key) const {
+  std::string type_name_of(const key_view_type& key) const {
     return at_raw_value(key).type_name();
   }
 
+  /** Make a read-only snapshot of the current contents of the map
+   *
+   * The returned FrozenCtxMap stores the keys and values in flat arrays,
+   * which makes lookups and iteration cheaper. Later changes to this map
+   * are not reflected in the snapshot (see FrozenCtxMap for details).
+   */
+  FrozenCtxMap freeze() const { return FrozenCtxMap(*this); }
+
+  /** \name Versions for concurrent readers */
+  ///@{
+  /** Publish the current contents of the map as the version returned by snapshot().
+   *
+   * The version includes the full tree, i.e. also keys outside a submap.
+   * Publishing is cheap if few keys have been changed since the last call.
+   *
+   * After publishing, the map continues to be modified without affecting the
+   * published version. Note that this only holds for modifications replacing
+   * the values (like update or erase). Modifying the objects behind the values
+   * in place, e.g. by assigning to the reference returned by ``at``, affects
+   * all versions (like for copies of the map) and is hence not safe while
+   * other threads read these objects.
+   */
+  void publish() { m_container_ptr->publish(); }
+
+  /** Return an immutable view of the version of the map published last.
+   *
+   * The snapshot is consistent, i.e. it contains the state of the map at
+   * the time of the respective call to publish() (or is empty if publish()
+   * has not been called yet). It is cheap to obtain, since the snapshot shares
+   * all data with the map. It is kept alive until the last copy of the
+   * snapshot is destroyed, independent of later versions.
+   *
+   * In contrast to all other functions of the map, this function may be
+   * called from other threads while a single thread modifies the map
+   * and publishes new versions, e.g.
+   * ```
+   * // Reader threads:
+   * const CtxMap view = map.snapshot();
+   * for (auto& kv : view) { ... }
+   *
+   * // Writer thread:
+   * map.update("scf/energy", energy);
+   * map.update("scf/converged", true);
+   * map.publish();
+   * ```
+   * Readers see either both or none of the two updates.
+   */
+  const CtxMap snapshot() const {
+    return CtxMap(std::make_shared<map_type>(container().published(), resource()),
+                  m_location);
+  }
+
+  /** Replace the entries at and below a path by the entries of a map built
+   *  elsewhere and publish the result (see publish()).
+   *
+   * The subtree of ``staging`` is linked into the map as a whole instead of
+   * being copied entry by entry (see rename_subtree), so snapshots show either
+   * none or all of its entries. Note that all other modifications since the
+   * last publication are published as well.
+   *
+   * The storage of ``staging`` is taken over like for ``update(key, CtxMap&&)``,
+   * so ``staging`` is empty afterwards unless it is a view of another map.
+   * The cost is independent of the number of entries.
+   */
+  void publish(const std::string& path, CtxMap&& staging) {
+    m_container_ptr->exchange(make_full_key(path), take_entries(std::move(staging)));
+    publish();
+  }
+  ///@}
+
   /** \name Submaps */
   ///@{
   /** \brief Get a submap starting pointing at a different location.
@@ -483,10 +878,66 @@ class CtxMap {
           m_location{other.make_full_key(newlocation)} {}
 
  private:
+  /** Collect the entries of a range of key-value pairs as modifications
+   *  of the container. The keys still need to be normalised. */
+  template <typename InputIterator>
+  static std::vector<map_type::Modification> make_entries(InputIterator first,
+                                                          InputIterator last) {
+    std::vector<map_type::Modification> entries;
+    for (; first != last; ++first) {
+      entries.push_back(map_type::Modification{std::string(first->first), false,
+                                               entry_value_type(first->second)});
+    }
+    return entries;
+  }
+
+  /** Normalise the keys of the entries and insert them into the container.
+   *  If replace is true the existing entries of the (sub)map are removed. */
+  void load(std::vector<map_type::Modification> entries, bool replace);
+
+  /** Construct a map viewing a container at a location */
+  CtxMap(std::shared_ptr<map_type> container_ptr, std::string location)
+        : m_container_ptr{std::move(container_ptr)}, m_location{std::move(location)} {}
+
   /** Make the actual container key from a key supplied by the user
    *  Care is taken such that we cannot escape the subtree.
    * */
-  std::string make_full_key(const std::string& key) const;
+  std::string make_full_key(const key_view_type& key) const;
+
+  /** Return the value stored under a key or nullptr if no such value.
+   *
+   * Unlike ``m_container_ptr->find(make_full_key(key))`` this avoids
+   * building the full key if possible. */
+  CtxMapValue* find_value(const key_view_type& key) {
+    // Keys without "." or ".." path parts can be looked up directly,
+    // else they need to be normalised first.
+    if (CtxMapKey::has_relative_components(key)) {
+      return m_container_ptr->find(make_full_key(key));
+    }
+    return m_container_ptr->find_relative(m_location, key);
+  }
+
+  /** Return the value stored under a key or nullptr (const version) */
+  const CtxMapValue* find_value(const key_view_type& key) const {
+    if (CtxMapKey::has_relative_components(key)) {
+      return container().find(make_full_key(key));
+    }
+    return container().find_relative(m_location, key);
+  }
+
+  /** Return the entries of a map as a tree of their own. If no other map views
+   *  the storage of map, its nodes are handed over and map is empty afterwards.
+   *  Otherwise the nodes are shared with the storage. */
+  static map_type take_entries(CtxMap&& map);
+
+  friend class ConcurrentCtxMap;
+
+  /** Return the container for read-only access.
+   *
+   * Read-only accesses need to use the const functions of the container,
+   * since the non-const ones make the accessed nodes private to this map
+   * if they are shared with a copy (see CtxMapTree). */
+  const map_type& container() const { return *m_container_ptr; }
 
   std::shared_ptr<map_type> m_container_ptr;
 
@@ -503,44 +954,57 @@ std::ostream& operator<<(std::ostream& o, const CtxMap& map);
 //
 
 template <typename T>
-T& CtxMap::at(const std::string& key, T& default_value) {
-  auto itkey = m_container_ptr->find(make_full_key(key));
-  if (itkey == std::end(*m_container_ptr)) {
+void CtxMap::update_atomic(const std::string& key, T value) {
+  // Only look at the key via the const functions, which never modify the tree
+  const CtxMap& self       = *this;
+  const CtxMapValue* entry = self.find_value(key);
+  if (entry != nullptr && entry->type_id() == TypeRegistry::id_of<AtomicSlot<T>>()) {
+    // Slots are made for being written while others read them
+    const_cast<AtomicSlot<T>&>(entry->get<AtomicSlot<T>>()).store(std::move(value));
+  } else {
+    update(key, std::make_shared<AtomicSlot<T>>(std::move(value)));
+  }
+}
+
+template <typename T>
+T& CtxMap::at(const key_view_type& key, T& default_value) {
+  CtxMapValue* value = find_value(key);
+  if (value == nullptr) {
     return default_value;  // Key not found
   } else {
-    return itkey->second.get<T>();
+    return value->get<T>();
   }
 }
 
 template <typename T>
-const T& CtxMap::at(const std::string& key, const T& default_value) const {
-  auto itkey = m_container_ptr->find(make_full_key(key));
-  if (itkey == std::end(*m_container_ptr)) {
+const T& CtxMap::at(const key_view_type& key, const T& default_value) const {
+  const CtxMapValue* value = find_value(key);
+  if (value == nullptr) {
     return default_value;  // Key not found
   } else {
-    return itkey->second.get<T>();
+    return value->get<T>();
   }
 }
 
 template <typename T>
-std::shared_ptr<T> CtxMap::at_ptr(const std::string& key,
+std::shared_ptr<T> CtxMap::at_ptr(const key_view_type& key,
                                   std::shared_ptr<T> default_ptr) {
-  auto itkey = m_container_ptr->find(make_full_key(key));
-  if (itkey == std::end(*m_container_ptr)) {
+  CtxMapValue* value = find_value(key);
+  if (value == nullptr) {
     return default_ptr;  // Key not found
   } else {
-    return itkey->second.get_ptr<T>();
+    return value->get_ptr<T>();
   }
 }
 
 template <typename T>
-std::shared_ptr<const T> CtxMap::at_ptr(const std::string& key,
+std::shared_ptr<const T> CtxMap::at_ptr(const key_view_type& key,
                                         std::shared_ptr<const T> default_ptr) const {
-  auto itkey = m_container_ptr->find(make_full_key(key));
-  if (itkey == std::end(*m_container_ptr)) {
+  const CtxMapValue* value = find_value(key);
+  if (value == nullptr) {
     return default_ptr;  // Key not found
   } else {
-    return itkey->second.get_ptr<T>();
+    return value->get_ptr<T>();
   }
 }
 
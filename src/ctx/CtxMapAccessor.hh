@@ -21,6 +21,13 @@
 
 namespace ctx {
 
+// Forward-declare. Proper declaration in CtxMapIterator.hh
+template <bool Const>
+class CtxMapIterator;
+
+// Forward-declare. Proper declaration in FrozenCtxMap.hh
+class FrozenCtxMapIterator;
+
 /** Accessor to a CtxMap object. Can be used to retrieve the key or the value
  *  or the typename of the value */
 template <bool Const>
@@ -29,13 +36,18 @@ class CtxMapAccessor {};
 template <>
 class CtxMapAccessor<true> {
  public:
-  /** Return the key of the key/value pair the accessor holds */
-  const std::string& key() const { return m_key; }
+  /** Return the key of the key/value pair the accessor holds.
+   *
+   * For accessors obtained from an iterator the key refers into the iterator,
+   * so it is only valid until the iterator is changed or destroyed. Copy the
+   * key to keep it for longer.
+   */
+  const std::string& key() const { return *m_key_ptr; }
 
   /** Return the type name of the value object referred to by the key, which
    * is held in this accessor.
    */
-  std::string type_name() const { return m_value.type_name(); }
+  std::string type_name() const { return m_value_ptr->type_name(); }
 
   /** Return the value of the key/value pair the accessor holds (Const version).
    *
@@ -44,7 +56,7 @@ class CtxMapAccessor<true> {
    **/
   template <typename T>
   const T& value() const {
-    return m_value.get<T>();
+    return m_value_ptr->get<T>();
   }
 
   /** Return the value of the key/value pair the accessor holds
@@ -55,22 +67,40 @@ class CtxMapAccessor<true> {
    **/
   template <typename T>
   std::shared_ptr<const T> value_ptr() const {
-    return m_value.get_ptr<T>();
+    return m_value_ptr->get_ptr<T>();
   }
 
   /** Return a reference to the raw value object the accessor holds. (Const version)
    *
    * \note This is an advanced method. Use only if you know what you are doing.
    **/
-  const CtxMapValue& value_raw() const { return m_value; }
+  const CtxMapValue& value_raw() const { return *m_value_ptr; }
 
-  /** Construct an accessor */
-  CtxMapAccessor(const std::string key, const CtxMapValue& value)
-        : m_key(key), m_value(value) {}
+  /** Construct an accessor.
+   *
+   * The accessor only refers to the key and the value, so both need to
+   * outlive it. */
+  CtxMapAccessor(const std::string& key, const CtxMapValue& value)
+        : m_key_ptr(&key), m_value_ptr(&value) {}
+
+ protected:
+  // The iterators embed an accessor and point it to the current entry
+  template <bool Const>
+  friend class CtxMapIterator;
+  friend class FrozenCtxMapIterator;
+
+  /** Construct an accessor referring to nothing */
+  CtxMapAccessor() : m_key_ptr(nullptr), m_value_ptr(nullptr) {}
+
+  /** Point the accessor to a different key and value */
+  void reset(const std::string& key, const CtxMapValue& value) {
+    m_key_ptr   = &key;
+    m_value_ptr = &value;
+  }
 
  private:
-  const std::string m_key;
-  const CtxMapValue& m_value;
+  const std::string* m_key_ptr;
+  const CtxMapValue* m_value_ptr;
 };
 
 template <>
@@ -86,7 +116,7 @@ class CtxMapAccessor<false> : public CtxMapAccessor<true> {
    **/
   template <typename T>
   T& value() {
-    return m_value.get<T>();
+    return m_value_ptr->get<T>();
   }
 
   /** Return the value of the key/value pair the accessor holds
@@ -97,7 +127,7 @@ class CtxMapAccessor<false> : public CtxMapAccessor<true> {
    **/
   template <typename T>
   std::shared_ptr<T> value_ptr() {
-    return m_value.get_ptr<T>();
+    return m_value_ptr->get_ptr<T>();
   }
 
   /** Return the value of the key/value pair the accessor holds (Const version).
@@ -107,7 +137,7 @@ class CtxMapAccessor<false> : public CtxMapAccessor<true> {
    **/
   template <typename T>
   const T& value() const {
-    return m_value.get<T>();
+    return base_type::value<T>();
   }
 
   /** Return the value of the key/value pair the accessor holds
@@ -118,27 +148,44 @@ class CtxMapAccessor<false> : public CtxMapAccessor<true> {
    **/
   template <typename T>
   std::shared_ptr<const T> value_ptr() const {
-    return m_value.get_ptr<T>();
+    return base_type::value_ptr<T>();
   }
 
   /** Return a reference to the raw value object the accessor holds. ( Const version)
    *
    * \note This is an advanced method. Use only if you know what you are doing.
    **/
-  const CtxMapValue& value_raw() const { return m_value; }
+  const CtxMapValue& value_raw() const { return *m_value_ptr; }
 
   /** Return a reference to the raw value object the accessor holds.
    *
    * \note This is an advanced method. Use only if you know what you are doing.
    **/
-  CtxMapValue& value_raw() { return m_value; }
+  CtxMapValue& value_raw() { return *m_value_ptr; }
 
-  /** Construct an accessor */
-  CtxMapAccessor(const std::string key, CtxMapValue& value)
-        : base_type(key, value), m_value(value) {}
+  /** Construct an accessor.
+   *
+   * The accessor only refers to the key and the value, so both need to
+   * outlive it. */
+  CtxMapAccessor(const std::string& key, CtxMapValue& value)
+        : base_type(key, value), m_value_ptr(&value) {}
+
+ protected:
+  // The iterators embed an accessor and point it to the current entry
+  template <bool Const>
+  friend class CtxMapIterator;
+
+  /** Construct an accessor referring to nothing */
+  CtxMapAccessor() : base_type(), m_value_ptr(nullptr) {}
+
+  /** Point the accessor to a different key and value */
+  void reset(const std::string& key, CtxMapValue& value) {
+    base_type::reset(key, value);
+    m_value_ptr = &value;
+  }
 
  private:
-  CtxMapValue& m_value;
+  CtxMapValue* m_value_ptr;
 };
 
 }  // namespace ctx
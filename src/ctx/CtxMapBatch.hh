@@ -0,0 +1,102 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#pragma once
+#include "CtxMapKey.hh"
+#include "CtxMapTree.hh"
+#include <functional>
+#include <vector>
+
+namespace ctx {
+
+/** Collects modifications of a map, which are then applied all at once.
+ *
+ * A batch is obtained via CtxMap::batch or ConcurrentCtxMap::batch, e.g.
+ * ```
+ * CtxMapBatch batch = map.submap("results").batch();
+ * for (size_t i = 0; i < energies.size(); ++i) {
+ *   batch.update("energy" + std::to_string(i), energies[i]);
+ * }
+ * batch.commit();
+ * ```
+ * The keys are normalised relative to the location of the map when they
+ * are added to the batch. On commit the modifications are applied in the
+ * order they were added, but each one only descends from the deepest node
+ * shared with the previous key (see CtxMapTree::apply) instead of looking
+ * up the full key starting from the root.
+ *
+ * The batch is deliberately not sorted on commit: Sorting the keys (strings
+ * on the heap, compared in random order) costs more than it saves when
+ * applying, unless the batch inserts many new keys scattered over the tree
+ * (see benchmarks/batch_update.cc). Keys added in the order of the
+ * CtxMapKeyComparator are cheapest, since new keys are then appended to
+ * the children of a node without any search.
+ *
+ * Modifications which have not been committed are discarded when the
+ * batch is destroyed.
+ */
+class CtxMapBatch {
+ public:
+  typedef CtxMapTree::Modification modification_type;
+
+  /** The function applying the modifications to the map */
+  typedef std::function<void(std::vector<modification_type>)> apply_type;
+
+  /** Construct an empty batch for a map at a location (a normalised key),
+   *  which commits using the given function. */
+  CtxMapBatch(std::string location, apply_type apply)
+        : m_location(std::move(location)), m_apply(std::move(apply)), m_modifications() {}
+
+  /** Insert or update a key on commit */
+  void update(const key_view_type& key, CtxMapValue e) {
+    m_modifications.push_back(
+          modification_type{CtxMapKey::full_key(m_location, key), false, std::move(e)});
+  }
+
+  /** Remove a key on commit (if it exists) */
+  void erase(const key_view_type& key) {
+    m_modifications.push_back(
+          modification_type{CtxMapKey::full_key(m_location, key), true, CtxMapValue{}});
+  }
+
+  /** Return the number of collected modifications */
+  size_t size() const { return m_modifications.size(); }
+
+  /** Are there no collected modifications */
+  bool empty() const { return m_modifications.empty(); }
+
+  /** Apply the collected modifications to the map. The batch is empty
+   *  afterwards and may be used to collect further modifications. */
+  void commit() {
+    std::vector<modification_type> modifications;
+    modifications.swap(m_modifications);
+    m_apply(std::move(modifications));
+  }
+
+  /** Discard the collected modifications */
+  void clear() { m_modifications.clear(); }
+
+ private:
+  /** Location of the map the keys are relative to */
+  std::string m_location;
+
+  apply_type m_apply;
+
+  std::vector<modification_type> m_modifications;
+};
+
+}  // namespace ctx
@@ -0,0 +1,137 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#pragma once
+#include "CtxMapTree.hh"
+#include <memory>
+#include <string>
+#include <type_traits>
+
+namespace ctx {
+
+/** A typed handle to an entry of a CtxMap.
+ *
+ * The handle remembers the tree node of the entry and the fact that the
+ * stored value can be obtained as a T. Accessing the value via the handle
+ * therefore costs neither a key lookup nor a type check, even if other keys
+ * are added or updated and even if the value itself is replaced by one of
+ * the same type. Only if nodes of the tree are replaced or removed, or the
+ * value is replaced by one of another type (which is detected by the
+ * generation counter of the underlying CtxMapTree), the entry is looked up
+ * and checked again on the next access. This way the handle always refers
+ * to the value currently stored under its key.
+ *
+ * Handles are obtained using CtxMap::handle. Handles obtained from a const
+ * CtxMap only provide const access, i.e. they are of type CtxMapHandle<const T>.
+ */
+template <typename T>
+class CtxMapHandle {
+ public:
+  /** The type of the value referred to without const qualification */
+  typedef typename std::remove_const<T>::type value_type;
+
+  /** Construct a handle to the value stored under the precompiled key
+   *  relative to the normalised location in a tree.
+   *
+   * The entry is resolved immediately, i.e. an out_of_range exception is thrown
+   * if the key does not exist and a type_mismatch exception if the value
+   * cannot be obtained as a T.
+   */
+  CtxMapHandle(std::shared_ptr<CtxMapTree> tree_ptr, std::string location, CtxMapKey key)
+        : m_tree_ptr(std::move(tree_ptr)),
+          m_location(std::move(location)),
+          m_key(std::move(key)),
+          m_value_ptr(nullptr),
+          m_generation(0) {
+    resolve();
+  }
+
+  /** Return a reference to the value currently stored under the key */
+  T& get() const {
+    if (!cached()) resolve();
+    return m_value_ptr->get_unchecked<value_type>();
+  }
+
+  /** Dereference the handle */
+  T& operator*() const { return get(); }
+
+  /** Access members of the value referred to */
+  T* operator->() const { return &get(); }
+
+  /** Return a shared pointer to the value currently stored under the key */
+  std::shared_ptr<T> get_ptr() const {
+    if (!cached()) resolve();
+    return m_value_ptr->get_ptr<value_type>();
+  }
+
+  /** Does the key of the handle still exist with a value of the correct type */
+  bool valid() const {
+    const CtxMapTree& tree   = *m_tree_ptr;
+    const CtxMapValue* value = tree.find(m_location, m_key);
+    return value != nullptr && value->can_get_value_as<value_type>();
+  }
+
+  /** Will the next access use the cached entry, i.e. skip the lookup
+   *  of the key and the type check */
+  bool cached() const { return m_generation == m_tree_ptr->generation(); }
+
+  /** Return the key this handle refers to */
+  const CtxMapKey& key() const { return m_key; }
+
+ private:
+  /** Look the key up again and check the type of the value.
+   *  Throws if the key does not exist or has the wrong type. */
+  void resolve() const {
+    CtxMapValue* value = lookup();
+    if (value == nullptr) {
+      throw out_of_range("Key '" + m_key.str() + "' is not known.");
+    }
+    value->assert_can_get_value_as<value_type>();
+
+    m_value_ptr  = value;
+    m_generation = m_tree_ptr->generation();
+  }
+
+  /** Find the value of the entry in the tree or return nullptr. Handles which
+   *  only provide const access do not need to make the path to the value
+   *  private to the tree (see CtxMapTree). */
+  CtxMapValue* lookup() const {
+    if (std::is_const<T>::value) {
+      const CtxMapTree& tree = *m_tree_ptr;
+      return const_cast<CtxMapValue*>(tree.find(m_location, m_key));
+    }
+    return m_tree_ptr->find(m_location, m_key);
+  }
+
+  /** The tree the entry lives in */
+  std::shared_ptr<CtxMapTree> m_tree_ptr;
+
+  /** The location of the map the handle was obtained from */
+  std::string m_location;
+
+  /** The key relative to m_location */
+  CtxMapKey m_key;
+
+  /** Cache for the value of the entry, valid while m_generation
+   *  agrees with the generation of the tree */
+  mutable CtxMapValue* m_value_ptr;
+
+  /** Tree generation at which m_value_ptr was obtained */
+  mutable size_t m_generation;
+};
+
+}  // namespace ctx
@@ -16,23 +16,54 @@
 
 #pragma once
 #include "CtxMapAccessor.hh"
+#include "CtxMapTree.hh"
+#include <array>
+#include <cstddef>
 #include <iterator>
-#include <map>
+#include <memory>
 #include <type_traits>
+#include <vector>
 
 namespace ctx {
 
+// Forward-declare. Proper declaration in CtxMap.hh
+class CtxMap;
+
+/** Iterator over the key-value pairs of a subtree of a CtxMapTree.
+ *
+ * The keys are visited in the order of the CtxMap::key_comparator_type,
+ * which is a preorder traversal of the tree. Inner nodes without a value
+ * are skipped.
+ *
+ * Since the non-const iterator gives modifying access to the values,
+ * it makes each node it visits private to its tree (see CtxMapTree).
+ *
+ * Neither stepping nor copying the iterator allocates (unless the tree is
+ * deeper than the path stored inline): The key of the current entry is kept
+ * up to date in a buffer owned by the iterator, which is not copied along
+ * with the iterator, but assembled from the path again if needed. The key
+ * returned by the accessor therefore refers into the iterator and is only
+ * valid until the iterator is changed or destroyed.
+ */
 template <bool Const>
-class CtxMapIterator
-      : std::iterator<std::bidirectional_iterator_tag, CtxMapAccessor<Const>> {
+class CtxMapIterator {
  public:
+  typedef std::bidirectional_iterator_tag iterator_category;
+  typedef CtxMapAccessor<Const> value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef value_type* pointer;
+  typedef value_type& reference;
+
   typedef CtxMapValue entry_value_type;
-  typedef std::map<std::string, entry_value_type> map_type;
+  typedef CtxMapTree map_type;
 
-  /** The iterator type which is used in this class
-   * to iterate over the map contained in CtxMap. */
-  typedef typename std::conditional<Const, typename map_type::const_iterator,
-                                    typename map_type::iterator>::type iter_type;
+  /** The node type this iterator points to */
+  typedef typename std::conditional<Const, const CtxMapNode, CtxMapNode>::type
+        node_type;
+
+  /** The tree type this iterator iterates over */
+  typedef typename std::conditional<Const, const CtxMapTree, CtxMapTree>::type
+        tree_type;
 
   /** Dereference CtxMap iterator */
   CtxMapAccessor<Const>& operator*() const { return *operator->(); }
@@ -42,8 +73,9 @@ class CtxMapIterator
 
   /** Prefix increment to the next key */
   CtxMapIterator& operator++() {
-    ++m_iter;
-    m_acc_ptr.reset();  // Reset cache
+    do {
+      advance();
+    } while (m_node != nullptr && !m_node->has_value);
     return *this;
   }
 
@@ -56,8 +88,9 @@ class CtxMapIterator
 
   /** Prefix decrement to the next key */
   CtxMapIterator& operator--() {
-    --m_iter;
-    m_acc_ptr.reset();  // Reset cache
+    do {
+      retreat();
+    } while (!m_node->has_value);
     return *this;
   }
 
@@ -68,32 +101,191 @@ class CtxMapIterator
     return copy;
   }
 
-  bool operator==(const CtxMapIterator& other) const { return m_iter == other.m_iter; }
-  bool operator!=(const CtxMapIterator& other) const { return m_iter != other.m_iter; }
+  bool operator==(const CtxMapIterator& other) const { return m_node == other.m_node; }
+  bool operator!=(const CtxMapIterator& other) const { return m_node != other.m_node; }
+
+  /** Construct an iterator to the first key-value pair in the subtree starting
+   *  at ``root`` of the tree ``tree``, which is located at the full key ``location``.
+   *
+   *  If root is a nullptr, the range is empty and the iterator is identical
+   *  to the end iterator. For non-const iterators root needs to be private
+   *  to the tree.
+   */
+  CtxMapIterator(tree_type* tree, node_type* root, std::string location)
+        : m_acc(),
+          m_tree(tree),
+          m_root(root),
+          m_node(root),
+          m_stack(),
+          m_key(),
+          m_key_valid(true),
+          m_location(location.empty()
+                           ? nullptr
+                           : std::make_shared<const std::string>(std::move(location))) {
+    if (m_node != nullptr && !m_node->has_value) operator++();
+  }
+
+  /** Construct an end iterator for the subtree starting at ``root``, which
+   *  is located at the full key ``location``. */
+  static CtxMapIterator make_end(tree_type* tree, node_type* root, std::string location) {
+    CtxMapIterator ret(tree, nullptr, std::move(location));
+    ret.m_root = root;
+    return ret;
+  }
 
-  /** Explicit conversion to the inner iterator type */
-  explicit operator iter_type() { return m_iter; }
+  CtxMapIterator()
+        : m_acc(),
+          m_tree(nullptr),
+          m_root(nullptr),
+          m_node(nullptr),
+          m_stack(),
+          m_key(),
+          m_key_valid(false),
+          m_location() {}
 
-  CtxMapIterator(iter_type iter, std::string location)
-        : m_acc_ptr(nullptr), m_iter(iter), m_location(std::move(location)) {}
+  /** Copy an iterator. The key is not copied, but assembled again if needed. */
+  CtxMapIterator(const CtxMapIterator& other)
+        : m_acc(),
+          m_tree(other.m_tree),
+          m_root(other.m_root),
+          m_node(other.m_node),
+          m_stack(other.m_stack),
+          m_key(),
+          m_key_valid(false),
+          m_location(other.m_location) {}
 
-  CtxMapIterator() : m_acc_ptr(nullptr), m_iter(), m_location() {}
+  /** Assign an iterator. The key is assembled again if needed. */
+  CtxMapIterator& operator=(const CtxMapIterator& other) {
+    m_tree      = other.m_tree;
+    m_root      = other.m_root;
+    m_node      = other.m_node;
+    m_stack     = other.m_stack;
+    m_key_valid = false;
+    m_location  = other.m_location;
+    return *this;
+  }
 
  private:
-  /** Undo the operation of CtxMap::make_full_key, i.e. strip off the
-   * first location part and get a relative path to it*/
-  std::string strip_location_prefix(const std::string& key) const;
+  friend class CtxMap;
+
+  typedef typename std::conditional<Const, CtxMapNode::children_type::const_iterator,
+                                    CtxMapNode::children_type::iterator>::type
+        child_iter_type;
+
+  /** Move to the next node in preorder (regardless whether it has a value) */
+  void advance();
 
-  /** Cache for the accessor of the current value.
-   *  A stored nullptr implies that the accessor needs to rebuild
-   *  before using it.*/
-  mutable std::shared_ptr<CtxMapAccessor<Const>> m_acc_ptr;
+  /** Move to the previous node in preorder (regardless whether it has a value) */
+  void retreat();
 
-  /** Iterator to the current key,value pair */
-  iter_type m_iter;
+  /** Descend from the current node to the last node in preorder
+   *  of the subtree starting at it. */
+  void descend_last();
 
-  /** Subtree location we iterate over */
-  std::string m_location;
+  /** Return the node a child iterator points to. For non-const iterators the
+   *  node is made private to the tree first. */
+  node_type* enter(const child_iter_type& it) const {
+    return enter(it, std::integral_constant<bool, Const>{});
+  }
+  node_type* enter(const child_iter_type& it, std::true_type) const {
+    return it->second.get();
+  }
+  node_type* enter(const child_iter_type& it, std::false_type) const {
+    return m_tree->make_exclusive(it->second);
+  }
+
+  /** The path from the root of the subtree to the current node as iterators
+   *  into the respective children maps. The first levels are stored inline,
+   *  such that copying the path does not allocate for common trees. */
+  class Path {
+   public:
+    bool empty() const { return m_size == 0; }
+    size_t size() const { return m_size; }
+
+    const child_iter_type& operator[](size_t i) const {
+      return i < n_inline ? m_inline[i] : m_overflow[i - n_inline];
+    }
+    child_iter_type& back() {
+      return m_size <= n_inline ? m_inline[m_size - 1] : m_overflow.back();
+    }
+
+    void push_back(const child_iter_type& it) {
+      if (m_size < n_inline) {
+        m_inline[m_size] = it;
+      } else {
+        m_overflow.push_back(it);
+      }
+      ++m_size;
+    }
+    void pop_back() {
+      if (m_size > n_inline) m_overflow.pop_back();
+      --m_size;
+    }
+
+   private:
+    static constexpr size_t n_inline = 8;
+    std::array<child_iter_type, n_inline> m_inline;
+    std::vector<child_iter_type> m_overflow;
+    size_t m_size = 0;
+  };
+
+  /** Return the parent of the current node (only valid if m_stack is not empty) */
+  node_type* parent_node() const {
+    return m_stack.size() > 1 ? m_stack[m_stack.size() - 2]->second.get() : m_root;
+  }
+
+  /** Return the key of the current node relative to m_root, i.e. with the
+   *  location prefix stripped. It is assembled into m_key if necessary. */
+  const std::string& key() const;
+
+  /** Enter the child it points to into the path (and the key) */
+  void push(const child_iter_type& it) {
+    m_stack.push_back(it);
+    if (m_key_valid) m_key.append("/").append(it->first);
+  }
+
+  /** Remove the last component from the key (if it is valid) */
+  void pop_key() {
+    if (m_key_valid) m_key.erase(m_key.rfind('/'));
+  }
+
+  /** Append the component it points to to the key (if it is valid) */
+  void append_key(const child_iter_type& it) {
+    if (m_key_valid) m_key.append("/").append(it->first);
+  }
+
+  /** Return the full key of the current node, i.e. undo the stripping
+   *  of the location prefix from the keys */
+  std::string full_key() const {
+    return m_location == nullptr ? key() : *m_location + key();
+  }
+
+  /** Accessor for the current value. It only refers to m_key and the value
+   *  of the current node, so it is pointed to them on each dereference. */
+  mutable CtxMapAccessor<Const> m_acc;
+
+  /** The tree we iterate over */
+  tree_type* m_tree;
+
+  /** Root of the subtree we iterate over */
+  node_type* m_root;
+
+  /** The current node (nullptr for the past-the-end state) */
+  node_type* m_node;
+
+  /** The path from m_root to the current node */
+  Path m_stack;
+
+  /** Buffer for the key of the current node (see key()) */
+  mutable std::string m_key;
+
+  /** Does m_key hold the key of the current node. If so, it is updated on each
+   *  step, otherwise it is assembled again on the next dereference. */
+  mutable bool m_key_valid;
+
+  /** Subtree location we iterate over (shared by all copies of the iterator).
+   *  A nullptr stands for the root of the tree, which is the common case. */
+  std::shared_ptr<const std::string> m_location;
 };
 
 //
@@ -102,37 +294,88 @@ class CtxMapIterator
 
 template <bool Const>
 CtxMapAccessor<Const>* CtxMapIterator<Const>::operator->() const {
-  if (m_acc_ptr == nullptr) {
-    // Generate accessor for current state
-    const std::string key_stripped = strip_location_prefix(m_iter->first);
-    m_acc_ptr = std::make_shared<CtxMapAccessor<Const>>(key_stripped, m_iter->second);
+  // The root of the subtree is exposed with the key "/"
+  static const std::string root_key{"/"};
+  const std::string& current = key();
+  m_acc.reset(current.empty() ? root_key : current, m_node->value);
+  return &m_acc;
+}
+
+template <bool Const>
+const std::string& CtxMapIterator<Const>::key() const {
+  if (!m_key_valid) {
+    // Keep the capacity of the buffer, such that this does not allocate
+    m_key.clear();
+    for (size_t i = 0; i < m_stack.size(); ++i) {
+      m_key.append("/").append(m_stack[i]->first);
+    }
+    m_key_valid = true;
+  }
+  return m_key;
+}
+
+template <bool Const>
+void CtxMapIterator<Const>::advance() {
+  if (!m_node->children.empty()) {
+    // Go down to the first child
+    auto it = std::begin(m_node->children);
+    push(it);
+    m_node = enter(it);
+    return;
   }
 
-  return m_acc_ptr.get();
+  // Go up until we find a node with a next sibling or leave the subtree
+  while (!m_stack.empty()) {
+    child_iter_type& it     = m_stack.back();
+    node_type* const parent = parent_node();
+    pop_key();
+
+    if (++it != std::end(parent->children)) {
+      append_key(it);
+      m_node = enter(it);
+      return;
+    }
+    m_stack.pop_back();
+  }
+  m_node = nullptr;  // Past the end
 }
 
 template <bool Const>
-std::string CtxMapIterator<Const>::strip_location_prefix(const std::string& key) const {
-  // The first part needs to be exactly the location:
-  if (key.size() < m_location.size() ||
-      0 != key.compare(0, m_location.size(), m_location)) {
-    throw internal_error("key does not start with the expected location prefix.");
+void CtxMapIterator<Const>::retreat() {
+  if (m_node == nullptr) {
+    // Go from past-the-end to the very last node
+    m_node = m_root;
+    descend_last();
+    return;
   }
 
-  if (key.size() <= m_location.size()) {
-    return "/";
+  if (m_stack.empty()) {
+    throw out_of_range("Cannot decrement CtxMap iterator pointing to the first element.");
+  }
+
+  child_iter_type& it     = m_stack.back();
+  node_type* const parent = parent_node();
+  pop_key();
+
+  if (it == std::begin(parent->children)) {
+    // First child: the previous node is the parent
+    m_stack.pop_back();
+    m_node = parent;
   } else {
-    std::string res = key.substr(m_location.size());
-
-    if (res.length() > 0) {
-      if (res[0] != '/' || res.back() == '/') {
-        throw internal_error(
-              "strip_location_prefix did something unexpected: The key does not start "
-              "with a / or "
-              "it ends with a /");
-      }  // if
-    }    // if
-    return res;
+    // Previous sibling and then the last node in its subtree
+    --it;
+    append_key(it);
+    m_node = enter(it);
+    descend_last();
+  }
+}
+
+template <bool Const>
+void CtxMapIterator<Const>::descend_last() {
+  while (!m_node->children.empty()) {
+    auto it = std::prev(std::end(m_node->children));
+    push(it);
+    m_node = enter(it);
   }
 }
 
@@ -0,0 +1,96 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "CtxMapKey.hh"
+#include <algorithm>
+
+namespace ctx {
+
+CtxMapKey::CtxMapKey(const std::string& key)
+      : m_components{normalised_components(key)}, m_key{}, m_hash{0} {
+  for (const auto& part : m_components) {
+    m_key.append("/").append(part);
+  }
+  m_hash = std::hash<std::string>{}(m_key);
+}
+
+std::vector<std::string> CtxMapKey::normalised_components(const key_view_type& key) {
+  // Make a stack out of the key:
+  std::vector<std::string> pathparts;
+
+  // start gives the location after the last '/',
+  // ie where the current part of the key path begins and end gives
+  // the location of the current '/', i.e. the past-the-end index
+  // of the current path part.
+  for (size_t start = 0; start < key.size(); ++start) {
+    // Past-the-end of the current path part:
+    const size_t end = key.find('/', start);
+
+    // Empty path part (i.e. something like '//' is encountered:
+    if (start == end) continue;
+
+    // Extract the part we deal with in this iteration:
+    std::string part{key.substr(start, end - start)};
+
+    // Update start for next iteration:
+    start += part.length();
+
+    if (part == ".") {
+      // Ignore "." path part (does nothing)
+      continue;
+    } else if (part == "..") {
+      // If ".." path part, then pop the most recently added path part if any.
+      if (!pathparts.empty()) pathparts.pop_back();
+    } else {
+      pathparts.push_back(std::move(part));
+    }
+  }
+  return pathparts;
+}
+
+std::string CtxMapKey::full_key(const std::string& location, const key_view_type& key) {
+  std::string res{location};
+  if (has_relative_components(key)) {
+    // Resolve "." and ".." and split into the path parts:
+    for (const auto& part : normalised_components(key)) {
+      res.append("/").append(part);
+    }
+    return res;
+  }
+
+  // Only empty path parts need to be skipped
+  for (size_t start = 0; start < key.size(); ++start) {
+    const size_t end = std::min(key.find('/', start), key.size());
+    if (end == start) continue;
+    res.append("/").append(key.data() + start, end - start);
+    start = end;
+  }
+  return res;
+}
+
+bool CtxMapKey::has_relative_components(const key_view_type& key) {
+  for (size_t pos = 0; pos < key.size(); ++pos) {
+    // pos is the start of a path part, check whether it is "." or ".."
+    if (key[pos] == '.') {
+      const size_t end = std::min(key.find('/', pos), key.size());
+      if (end - pos == 1 || (end - pos == 2 && key[pos + 1] == '.')) return true;
+    }
+    pos = std::min(key.find('/', pos), key.size());
+  }
+  return false;
+}
+
+}  // namespace ctx
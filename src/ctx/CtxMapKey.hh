@@ -0,0 +1,92 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "string_view.hh"
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace ctx {
+
+/** A precompiled key for accessing a CtxMap.
+ *
+ * The key is subject to the same UNIX path normalisation as the std::string
+ * keys passed to the CtxMap (see CtxMap::submap for details), but this is
+ * only done once on construction. Afterwards the key stores both the
+ * normalised path and its individual components, such that lookups via
+ * the CtxMapKey can walk the tree of the CtxMap directly without any
+ * further parsing or string concatenation.
+ *
+ * This is useful if the same key is accessed many times, e.g.
+ * ```
+ * const CtxMap::Key energy_key("scf/energy");
+ * for (...) {
+ *   map.at<double>(energy_key) = ...
+ * }
+ * ```
+ */
+class CtxMapKey {
+ public:
+  /** Normalise and precompile a key */
+  explicit CtxMapKey(const std::string& key);
+
+  /** Normalise and precompile a key */
+  explicit CtxMapKey(const char* key) : CtxMapKey(std::string(key)) {}
+
+  /** Return the normalised key, i.e. either the empty string (for the root)
+   *  or a string of the form "/a/b/c" */
+  const std::string& str() const { return m_key; }
+
+  /** Return the path components of the normalised key */
+  const std::vector<std::string>& components() const { return m_components; }
+
+  /** Return the hash of the normalised key */
+  size_t hash() const { return m_hash; }
+
+  bool operator==(const CtxMapKey& other) const {
+    return m_hash == other.m_hash && m_key == other.m_key;
+  }
+  bool operator!=(const CtxMapKey& other) const { return !operator==(other); }
+
+  /** Split a key into its components, thereby resolving "." and ".." path parts
+   *  and ignoring empty parts like in "a//b". Leading ".." parts have no effect,
+   *  i.e. the root of the path cannot be escaped. */
+  static std::vector<std::string> normalised_components(const key_view_type& key);
+
+  /** Return the full key of a key relative to a location, i.e. the location
+   *  (either "" or a normalised key like "/a/b") followed by the normalised
+   *  components of the key. */
+  static std::string full_key(const std::string& location, const key_view_type& key);
+
+  /** Does the key contain "." or ".." path parts, i.e. path parts which need to be
+   *  resolved before the key can be looked up component by component. */
+  static bool has_relative_components(const key_view_type& key);
+
+ private:
+  std::vector<std::string> m_components;
+  std::string m_key;
+  size_t m_hash;
+};
+
+}  // namespace ctx
+
+namespace std {
+template <>
+struct hash<ctx::CtxMapKey> {
+  size_t operator()(const ctx::CtxMapKey& key) const { return key.hash(); }
+};
+}  // namespace std
@@ -0,0 +1,99 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "CtxMapReclaimer.hh"
+#include "CtxMapTree.hh"
+#include <utility>
+
+namespace ctx {
+
+constexpr size_t CtxMapReclaimer::default_capacity;
+
+CtxMapReclaimer::CtxMapReclaimer(size_t capacity)
+      : m_state{std::make_shared<State>(capacity)},
+        m_worker{&CtxMapReclaimer::run, m_state} {}
+
+CtxMapReclaimer::~CtxMapReclaimer() {
+  {
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    m_state->stop = true;
+  }
+  m_state->wake_worker.notify_one();
+
+  // The thread cannot join itself. It owns the state as well, so let it go.
+  if (std::this_thread::get_id() == m_worker.get_id()) {
+    m_worker.detach();
+  } else {
+    m_worker.join();
+  }
+}
+
+void CtxMapReclaimer::retire(CtxMapValue& value) {
+  std::shared_ptr<void> object = std::move(value.m_object_ptr);
+  value                        = CtxMapValue{};
+  if (object != nullptr && object.use_count() == 1) push(std::move(object));
+}
+
+void CtxMapReclaimer::retire(std::shared_ptr<CtxMapNode>& node) {
+  std::shared_ptr<void> object = std::move(node);
+  if (object != nullptr && object.use_count() == 1) push(std::move(object));
+}
+
+void CtxMapReclaimer::push(std::shared_ptr<void>&& object) {
+  bool wake = false;
+  {
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    if (m_state->queue.size() < m_state->capacity) {
+      m_state->queue.push_back(std::move(object));
+      wake = m_state->queue.size() == 1;  // Otherwise the worker has been woken already
+    }
+  }
+  if (wake) m_state->wake_worker.notify_one();
+
+  // If the queue is full, object is left untouched and destroyed by the
+  // caller on the calling thread (without holding the lock).
+}
+
+void CtxMapReclaimer::flush() {
+  if (std::this_thread::get_id() == m_worker.get_id()) return;
+
+  std::unique_lock<std::mutex> lock(m_state->mutex);
+  m_state->wake_flush.wait(
+        lock, [this] { return m_state->queue.empty() && m_state->n_destroying == 0; });
+}
+
+void CtxMapReclaimer::run(std::shared_ptr<State> state) {
+  std::unique_lock<std::mutex> lock(state->mutex);
+  while (true) {
+    state->wake_worker.wait(lock,
+                            [&state] { return state->stop || !state->queue.empty(); });
+    if (state->queue.empty()) return;  // Stopped and nothing left to destroy
+
+    // Take all waiting objects at once and destroy them without holding the lock
+    std::deque<std::shared_ptr<void>> batch;
+    batch.swap(state->queue);
+    state->n_destroying = batch.size();
+    lock.unlock();
+    batch.clear();
+    lock.lock();
+
+    state->n_destroying = 0;
+    if (state->queue.empty()) state->wake_flush.notify_all();
+  }
+}
+
+}  // namespace ctx
@@ -0,0 +1,137 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#pragma once
+#include "CtxMapValue.hh"
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace ctx {
+
+// Forward-declare. Proper declaration in CtxMapTree.hh
+struct CtxMapNode;
+
+/** Destroys the objects released by a CtxMap on a background thread
+ *  (see CtxMap::set_reclaimer).
+ *
+ * Removing or replacing a value may drop the last reference to a large
+ * object (e.g. a matrix of several GB), whose destructor then frees and
+ * unmaps its memory on the thread modifying the map. A map with a reclaimer
+ * instead hands such objects (and removed subtrees) over to the reclaimer,
+ * which destroys them on a thread of its own. The map only pays for
+ * enqueuing a pointer.
+ *
+ * The queue of objects waiting for destruction is bounded. Once it holds
+ * capacity() objects, further objects are destroyed right away on the
+ * calling thread, such that a map releasing objects faster than they can
+ * be destroyed does not accumulate an unbounded amount of memory.
+ *
+ * Since the objects are destroyed on another thread, their destructors and
+ * the memory resources of the maps using the reclaimer need to be safe to
+ * use from several threads.
+ */
+class CtxMapReclaimer {
+ public:
+  /** Default number of objects which may wait for their destruction */
+  static constexpr size_t default_capacity = 1024;
+
+  /** Start the background thread */
+  explicit CtxMapReclaimer(size_t capacity = default_capacity);
+
+  /** Destroy all objects still waiting and stop the background thread.
+   *
+   * If the reclaimer is destroyed by one of the objects it destroys, the
+   * background thread finishes the queue on its own instead. */
+  ~CtxMapReclaimer();
+
+  CtxMapReclaimer(const CtxMapReclaimer&) = delete;
+  CtxMapReclaimer& operator=(const CtxMapReclaimer&) = delete;
+
+  /** Release the object a value refers to. The value is empty afterwards.
+   *
+   * The object is only handed over to the background thread if the value
+   * holds the last reference to it. Values shared with other places are
+   * released right away, which is cheap.
+   */
+  void retire(CtxMapValue& value);
+
+  /** Release a subtree of nodes. The pointer is a nullptr afterwards.
+   *
+   * Like for values, the subtree is only handed over if it is not shared.
+   */
+  void retire(std::shared_ptr<CtxMapNode>& node);
+
+  /** Wait until all objects handed over so far have been destroyed.
+   *
+   * Called by an object destroyed by the reclaimer itself, this returns
+   * right away, since the background thread cannot wait for itself. */
+  void flush();
+
+  /** Return the maximal number of objects waiting for their destruction */
+  size_t capacity() const { return m_state->capacity; }
+
+ private:
+  /** The state shared between the reclaimer and its background thread.
+   *
+   * The thread keeps the state alive by itself, since the last reference to the
+   * reclaimer may be dropped by an object destroyed on the thread (e.g. a map
+   * stored inside a removed value). The reclaimer cannot wait for the thread to
+   * finish in this case, but only lets it go.
+   */
+  struct State {
+    explicit State(size_t capacity_) : capacity{capacity_} {}
+
+    /** Maximal size of the queue */
+    const size_t capacity;
+
+    /** Guards all members below */
+    std::mutex mutex;
+
+    /** Signals the background thread that objects are waiting or it should stop */
+    std::condition_variable wake_worker;
+
+    /** Signals flush() that the queue has been emptied */
+    std::condition_variable wake_flush;
+
+    /** The objects waiting for their destruction */
+    std::deque<std::shared_ptr<void>> queue;
+
+    /** Number of objects the background thread is destroying at the moment */
+    size_t n_destroying = 0;
+
+    /** Should the background thread stop once the queue is empty */
+    bool stop = false;
+  };
+
+  /** Queue an object, which is only referenced by the pointer passed */
+  void push(std::shared_ptr<void>&& object);
+
+  /** The loop run by the background thread */
+  static void run(std::shared_ptr<State> state);
+
+  /** The state shared with the background thread */
+  std::shared_ptr<State> m_state;
+
+  /** The background thread (started last, once all other members exist) */
+  std::thread m_worker;
+};
+
+}  // namespace ctx
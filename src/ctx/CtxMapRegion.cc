@@ -0,0 +1,129 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "CtxMapRegion.hh"
+#include <algorithm>
+#include <memory>
+#include <new>
+
+namespace ctx {
+
+constexpr size_t CtxMapRegion::default_chunk_size;
+constexpr size_t CtxMapRegion::granularity;
+constexpr size_t CtxMapRegion::max_pooled_size;
+constexpr size_t CtxMapRegion::n_size_classes;
+
+namespace {
+/** Size class of a small block (the class of n granules is n - 1) */
+inline size_t size_class_of(size_t bytes) {
+  const size_t granularity = CtxMapRegion::granularity;
+  return std::max<size_t>(1, (bytes + granularity - 1) / granularity) - 1;
+}
+}  // namespace
+
+CtxMapRegion::~CtxMapRegion() {
+  ResourceAllocator<char> allocator(m_upstream);
+  for (const Chunk& chunk : m_chunks) allocator.deallocate(chunk.data, chunk.size);
+}
+
+void* CtxMapRegion::carve(std::size_t bytes) {
+  void* ptr = nullptr;
+  if (!m_chunks.empty()) {
+    void* next   = m_chunks.back().data + m_used;
+    size_t space = m_chunks.back().size - m_used;
+    ptr          = std::align(granularity, bytes, next, space);
+  }
+  if (ptr == nullptr) {
+    // The upstream resource may not align the chunk, so leave room for aligning
+    const size_t size = std::max(bytes + granularity, m_chunk_size);
+    m_chunks.reserve(m_chunks.size() + 1);  // Such that pushing the chunk cannot throw
+    m_chunks.push_back(Chunk{ResourceAllocator<char>(m_upstream).allocate(size), size});
+    void* next   = m_chunks.back().data;
+    size_t space = size;
+    ptr          = std::align(granularity, bytes, next, space);
+  }
+  m_used = static_cast<size_t>(static_cast<char*>(ptr) - m_chunks.back().data) + bytes;
+  return ptr;
+}
+
+void* CtxMapRegion::do_allocate(std::size_t bytes, std::size_t alignment) {
+  void* ptr = nullptr;
+  if (bytes > max_pooled_size || alignment > granularity) {
+    ptr = m_upstream != nullptr ? m_upstream->allocate(bytes, alignment)
+                                : detail::heap_allocate(bytes, alignment);
+  } else {
+    const size_t size_class = size_class_of(bytes);
+    const bool owner        = std::this_thread::get_id() == m_owner;
+
+    // The owner serves allocations from its own list without locking
+    FreeBlock* block = nullptr;
+    if (owner) {
+      FreeBlock*& free = m_local_free[size_class];
+      if (free == nullptr) {
+        free = m_returned[size_class].exchange(nullptr, std::memory_order_acquire);
+      }
+      if (free != nullptr) {
+        block = free;
+        free  = free->next;
+      }
+    }
+
+    if (block != nullptr) {
+      ptr = block;
+    } else {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      FreeBlock*& free = m_free[size_class];
+      if (!owner && free == nullptr) {
+        free = m_returned[size_class].exchange(nullptr, std::memory_order_acquire);
+      }
+      if (free != nullptr) {
+        ptr  = free;
+        free = free->next;
+      } else {
+        ptr = carve((size_class + 1) * granularity);
+      }
+    }
+  }
+  m_n_allocations.fetch_add(1);
+  return ptr;
+}
+
+void CtxMapRegion::do_deallocate(void* p, std::size_t bytes, std::size_t alignment) {
+  if (bytes > max_pooled_size || alignment > granularity) {
+    if (m_upstream != nullptr) {
+      m_upstream->deallocate(p, bytes, alignment);
+    } else {
+      detail::heap_deallocate(p, alignment);
+    }
+  } else if (std::this_thread::get_id() == m_owner) {
+    const size_t size_class  = size_class_of(bytes);
+    m_local_free[size_class] = ::new (p) FreeBlock{m_local_free[size_class]};
+  } else {
+    const size_t size_class           = size_class_of(bytes);
+    std::atomic<FreeBlock*>& returned = m_returned[size_class];
+    FreeBlock* block = ::new (p) FreeBlock{returned.load(std::memory_order_relaxed)};
+    while (!returned.compare_exchange_weak(block->next, block, std::memory_order_release,
+                                           std::memory_order_relaxed)) {
+    }
+  }
+
+  // The chunks are only returned as a whole. Once the last block
+  // is given back, nothing refers to the region any more.
+  if (m_n_allocations.fetch_sub(1) == 1) delete this;
+}
+
+}  // namespace ctx
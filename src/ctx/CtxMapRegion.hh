@@ -0,0 +1,143 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#pragma once
+#include "memory_resource.hh"
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ctx {
+
+/** A memory region holding the nodes and values of a subtree of a CtxMapTree
+ *  (see CtxMapTree::attach_region).
+ *
+ * The region hands out memory from large chunks obtained from an upstream
+ * resource (or the global heap). Small blocks are rounded up to size classes
+ * of ``granularity`` bytes and given back blocks are kept in a free list per
+ * size class, from which later requests of the same class are served. A
+ * subtree, whose entries are replaced or erased and inserted over and over,
+ * therefore only needs as much memory as it holds at its peak. Blocks larger
+ * than ``max_pooled_size`` or aligned beyond ``granularity`` are obtained
+ * from the upstream resource directly and given back right away.
+ *
+ * Only once the last block has been returned, the region gives all chunks
+ * back to the upstream resource at once and deletes itself. Regions are
+ * therefore always created with new and are owned by the memory allocated
+ * from them: As long as any node allocated from the region exists (e.g.
+ * since it is shared with a copy of the map), the region exists as well.
+ *
+ * Blocks given back on the thread, which created the region, go to a free
+ * list only this thread uses, those given back on other threads to a
+ * lock-free list the other threads or the owner take over as a whole.
+ *
+ * Note that this makes each deallocation cheap (a push onto a free list),
+ * but it does not save the walk over the subtree when it is removed: Nodes
+ * and values may be shared with copies of the map, so their reference counts
+ * still need to be dropped and the destructors of the values need to run.
+ * A CtxMapReclaimer moves this walk to a background thread.
+ */
+class CtxMapRegion : public memory_resource {
+ public:
+  /** Default size of the chunks memory is handed out from */
+  static constexpr size_t default_chunk_size = 64 * 1024;
+
+  /** Sizes of small blocks are rounded up to multiples of this */
+  static constexpr size_t granularity = alignof(std::max_align_t);
+
+  /** Largest block, which is carved from the chunks and reused */
+  static constexpr size_t max_pooled_size = 64 * granularity;
+
+  /** Construct a region obtaining its chunks from upstream (the global heap
+   *  if it is a nullptr) */
+  explicit CtxMapRegion(size_t chunk_size = default_chunk_size,
+                        memory_resource* upstream = nullptr)
+        : m_chunk_size{chunk_size}, m_upstream{upstream} {}
+
+  /** Give all chunks back to the upstream resource */
+  ~CtxMapRegion();
+
+  CtxMapRegion(const CtxMapRegion&) = delete;
+  CtxMapRegion& operator=(const CtxMapRegion&) = delete;
+
+  /** Return the number of blocks allocated from the region, which have
+   *  not been deallocated yet. */
+  size_t n_allocations() const { return m_n_allocations.load(); }
+
+ private:
+  /** A chunk memory is handed out from */
+  struct Chunk {
+    char* data;
+    size_t size;
+  };
+
+  /** A block in a free list */
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  /** Number of size classes of small blocks */
+  static constexpr size_t n_size_classes = max_pooled_size / granularity;
+
+  /** Carve a block of the given (rounded) size from the chunks */
+  void* carve(std::size_t bytes);
+
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+  void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+  bool do_is_equal(const memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+
+  /** Size of the chunks to allocate */
+  const size_t m_chunk_size;
+
+  /** The resource chunks are obtained from (nullptr for the global heap) */
+  memory_resource* const m_upstream;
+
+  /** Guards the chunks and m_free, since copies of the nodes may be made
+   *  on several threads */
+  std::mutex m_mutex;
+
+  /** The chunks memory is handed out from */
+  std::vector<Chunk> m_chunks;
+
+  /** Bytes of the last chunk handed out already */
+  size_t m_used = 0;
+
+  /** The thread, which created the region and typically fills and empties it */
+  const std::thread::id m_owner = std::this_thread::get_id();
+
+  /** Blocks given back on the owner thread for each size class (the class
+   *  of n granules is n - 1). Only the owner thread touches these. */
+  FreeBlock* m_local_free[n_size_classes] = {};
+
+  /** Blocks given back on other threads for each size class. Deallocating
+   *  pushes onto these lists without locking, allocating takes a whole list
+   *  over at once (neither is prone to the ABA problem). */
+  std::atomic<FreeBlock*> m_returned[n_size_classes] = {};
+
+  /** Blocks taken over from m_returned by threads other than the owner,
+   *  guarded by the mutex */
+  FreeBlock* m_free[n_size_classes] = {};
+
+  /** Number of blocks handed out and not returned yet */
+  std::atomic<size_t> m_n_allocations{0};
+};
+
+}  // namespace ctx
@@ -0,0 +1,562 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "CtxMapTree.hh"
+#include "CtxMapRegion.hh"
+#include <algorithm>
+
+namespace ctx {
+
+namespace {
+#ifdef CTX_HAVE_STRING_VIEW
+// The comparator is transparent, so the children can be searched using views
+typedef std::string_view component_type;
+inline void assign_component(component_type& part, const char* begin, size_t size) {
+  part = component_type(begin, size);
+}
+#else
+typedef std::string component_type;
+#endif
+
+inline void assign_component(std::string& part, const char* begin, size_t size) {
+  part.assign(begin, size);
+}
+
+/** Extract the next path component of a normalised key.
+ *
+ * ``pos`` is the index of the '/' in front of the component to extract. On return
+ * ``part`` contains the component and ``pos`` points to the '/' after it (or the
+ * key size if there is none). Returns false if there are no more components.
+ */
+template <typename Part>
+bool next_component(const std::string& key, size_t& pos, Part& part) {
+  if (pos >= key.size()) return false;
+  if (key[pos] != '/') {
+    throw internal_error("Encountered unexpected key format: Keys passed to CtxMapTree "
+                         "need to be normalised.");
+  }
+
+  const size_t end = std::min(key.find('/', pos + 1), key.size());
+  assign_component(part, key.data() + pos + 1, end - pos - 1);
+  pos = end;
+  return true;
+}
+
+/** Obtain the value of a modification. It is moved out of the modification,
+ *  unless the modifications are const (e.g. since they are applied again). */
+inline CtxMapValue take_value(CtxMapTree::Modification& mod) {
+  return std::move(mod.value);
+}
+inline const CtxMapValue& take_value(const CtxMapTree::Modification& mod) {
+  return mod.value;
+}
+
+/** Release a value, handing it over to the reclaimer if there is one */
+inline void release_value(CtxMapValue& value, CtxMapReclaimer* reclaimer) {
+  if (reclaimer != nullptr) {
+    reclaimer->retire(value);
+  } else {
+    value = CtxMapValue{};
+  }
+}
+
+/** Remove the value referred to by ``key`` (or the full subtree if ``recursive``)
+ * from the subtree below ``parent``. ``pos`` is the position in the key where the
+ * component of the child of ``parent`` to look at starts.
+ *
+ * The subtree sizes are updated and nodes which neither hold a value nor have any
+ * children any more are pruned on the way back up the tree. Returns the number of
+ * removed values. ``parent`` needs to be private to the tree and so will be all
+ * modified nodes below it. Removed values and subtrees are handed over to the
+ * ``reclaimer`` unless it is a nullptr.
+ */
+size_t erase_below(CtxMapNode& parent, const std::string& key, size_t pos,
+                   bool recursive, CtxMapReclaimer* reclaimer) {
+  std::string part;
+  next_component(key, pos, part);
+
+  auto it = parent.children.find(part);
+  if (it == std::end(parent.children)) return 0;
+  if (pos >= key.size() && recursive) {
+    // The subtree is dropped, so there is no need to copy it if it is shared.
+    // It is destroyed in the background if there is a reclaimer.
+    const size_t count = it->second->size;
+    if (reclaimer != nullptr) reclaimer->retire(it->second);
+    parent.children.erase(it);
+    return count;
+  }
+
+  // parent is private to our tree, so we can make the child private as well
+  unshare_node(it->second);
+  CtxMapNode& child = *it->second;
+
+  size_t count = 0;
+  if (pos < key.size()) {
+    count = erase_below(child, key, pos, recursive, reclaimer);
+  } else if (child.has_value) {
+    release_value(child.value, reclaimer);
+    child.has_value = false;
+    count           = 1;
+  }
+
+  child.size -= count;
+  if (!child.has_value && child.children.empty()) parent.children.erase(it);
+  return count;
+}
+}  // namespace
+
+bool CtxMapKeyComparator::operator()(const key_view_type& x,
+                                     const key_view_type& y) const {
+  // Only the first character which differs decides, so skip the common
+  // prefix in one go and only then take care of the special role of '/'.
+  const size_t common = std::min(x.size(), y.size());
+  const auto mismatch = std::mismatch(x.data(), x.data() + common, y.data());
+  if (mismatch.first == x.data() + common) return x.size() < y.size();
+
+  const unsigned char lhs = static_cast<unsigned char>(*mismatch.first);
+  const unsigned char rhs = static_cast<unsigned char>(*mismatch.second);
+  if (lhs == '/') return true;  // '/' sorts before anything else
+  if (rhs == '/') return false;
+  return lhs < rhs;
+}
+
+CtxMapTree::CtxMapTree(const CtxMapTree& other, const std::string& path)
+      : m_resource(other.m_resource), m_reclaimer(other.m_reclaimer) {
+  // Share the node of the path with the other tree
+  const std::shared_ptr<node_type>* node_ptr = &other.m_root;
+  component_type part;
+  for (size_t pos = 0; next_component(path, pos, part);) {
+    auto it = (*node_ptr)->children.find(part);
+    if (it == std::end((*node_ptr)->children)) return;  // Stay empty
+    node_ptr = &it->second;
+  }
+  m_root = *node_ptr;
+}
+
+template <typename Part>
+CtxMapTree::node_type* CtxMapTree::exclusive_child(node_type* node, const Part& part) {
+  auto it = node->children.find(part);
+  return it == std::end(node->children) ? nullptr : make_exclusive(it->second);
+}
+
+const CtxMapTree::node_type* CtxMapTree::find_node(const node_type* node,
+                                                   const std::string& key) {
+  component_type part;
+  for (size_t pos = 0; node != nullptr && next_component(key, pos, part);) {
+    auto it = node->children.find(part);
+    node    = it == std::end(node->children) ? nullptr : it->second.get();
+  }
+  return node;
+}
+
+CtxMapTree::node_type* CtxMapTree::find_node(const std::string& key) {
+  node_type* node = make_exclusive(m_root);
+  component_type part;
+  for (size_t pos = 0; node != nullptr && next_component(key, pos, part);) {
+    node = exclusive_child(node, part);
+  }
+  return node;
+}
+
+CtxMapTree::node_type* CtxMapTree::find_node(const std::string& location,
+                                             const CtxMapKey& key) {
+  node_type* node = find_node(location);
+  for (auto part = std::begin(key.components());
+       node != nullptr && part != std::end(key.components()); ++part) {
+    node = exclusive_child(node, *part);
+  }
+  return node;
+}
+
+const CtxMapTree::node_type* CtxMapTree::find_node(const std::string& location,
+                                                   const CtxMapKey& key) const {
+  const node_type* node = find_node(m_root.get(), location);
+  for (auto part = std::begin(key.components());
+       node != nullptr && part != std::end(key.components()); ++part) {
+    auto it = node->children.find(*part);
+    node    = it == std::end(node->children) ? nullptr : it->second.get();
+  }
+  return node;
+}
+
+CtxMapValue* CtxMapTree::find_relative(const std::string& location,
+                                       const key_view_type& key) {
+  node_type* node = find_node(location);
+  component_type part;
+  for (size_t start = 0; node != nullptr && start < key.size(); ++start) {
+    const size_t end = std::min(key.find('/', start), key.size());
+    if (end == start) continue;  // Skip empty path parts
+
+    assign_component(part, key.data() + start, end - start);
+    node  = exclusive_child(node, part);
+    start = end;
+  }
+  return node != nullptr && node->has_value ? &node->value : nullptr;
+}
+
+const CtxMapValue* CtxMapTree::find_relative(const std::string& location,
+                                             const key_view_type& key) const {
+  const node_type* node = find_node(m_root.get(), location);
+  component_type part;
+  for (size_t start = 0; node != nullptr && start < key.size(); ++start) {
+    const size_t end = std::min(key.find('/', start), key.size());
+    if (end == start) continue;  // Skip empty path parts
+
+    assign_component(part, key.data() + start, end - start);
+    auto it = node->children.find(part);
+    node    = it == std::end(node->children) ? nullptr : it->second.get();
+    start   = end;
+  }
+  return node != nullptr && node->has_value ? &node->value : nullptr;
+}
+
+CtxMapTree::node_type* CtxMapTree::child_for_insert(node_type* node,
+                                                    const std::string& part) {
+  auto it = node->children.lower_bound(part);
+  if (it == std::end(node->children) ||
+      component_comparator_type{}(part, it->first)) {
+    it = node->children.emplace_hint(it, part, make_node(node->resource()));
+  }
+  node_type* child = make_exclusive(it->second);
+  child->size += 1;
+  return child;
+}
+
+size_t CtxMapTree::merge_nodes(node_type& target,
+                               const std::shared_ptr<node_type>& source, bool may_move) {
+  // Nodes which other trees refer to need to stay intact
+  const bool move = may_move && source.use_count() == 1;
+  if (move) std::atomic_thread_fence(std::memory_order_acquire);  // See unshare_node
+
+  size_t n_added = 0;
+  if (source->has_value) {
+    if (!target.has_value) n_added += 1;
+    release_value(target.value, m_reclaimer.get());
+    if (move) {
+      target.value = std::move(source->value);
+    } else {
+      target.value = source->value;
+    }
+    target.has_value = true;
+  }
+
+  // Both lists of children are sorted, so walk them in parallel
+  auto it       = std::begin(target.children);
+  auto& sources = source->children;
+  for (auto child = std::begin(sources); child != std::end(sources);) {
+    while (it != std::end(target.children) &&
+           component_comparator_type{}(it->first, child->first)) {
+      ++it;
+    }
+
+    if (it != std::end(target.children) && it->first == child->first) {
+      node_type& target_child = *make_exclusive(it->second);
+      const size_t n_child    = merge_nodes(target_child, child->second, move);
+      target_child.size += n_child;
+      n_added += n_child;
+      ++child;
+      continue;
+    }
+
+    // Take over the whole subtree
+    if (!move) {
+      it = target.children.emplace_hint(it, child->first, child->second);
+      ++child;
+    } else {
+#if __cplusplus >= 201703L
+      // Transfer the entry of the children map including its key,
+      // which requires both maps to use the same memory resource.
+      if (target.children.get_allocator() == sources.get_allocator()) {
+        auto next = std::next(child);
+        it        = target.children.insert(it, sources.extract(child));
+        child     = next;
+        n_added += it->second->size;
+        continue;
+      }
+#endif
+      it = target.children.emplace_hint(it, child->first, std::move(child->second));
+      ++child;
+    }
+    n_added += it->second->size;
+  }
+  return n_added;
+}
+
+std::vector<CtxMapTree::node_type*> CtxMapTree::exclusive_path(const std::string& path) {
+  std::vector<node_type*> path_nodes{make_exclusive(m_root)};
+  std::string part;
+  for (size_t pos = 0; next_component(path, pos, part);) {
+    auto& children = path_nodes.back()->children;
+    auto it        = children.lower_bound(part);
+    if (it == std::end(children) || component_comparator_type{}(part, it->first)) {
+      it = children.emplace_hint(it, part, make_node(path_nodes.back()->resource()));
+    }
+    path_nodes.push_back(make_exclusive(it->second));
+  }
+  return path_nodes;
+}
+
+void CtxMapTree::merge(const std::string& path, const CtxMapTree& other) {
+  // Keep the nodes of other alive, even if other is a copy of a subtree
+  // of this tree, whose nodes are replaced on the way down.
+  const std::shared_ptr<node_type> source = other.m_root;
+  if (source->size == 0) return;
+
+  ++m_generation;
+  const std::vector<node_type*> path_nodes = exclusive_path(path);
+  const size_t n_added = merge_nodes(*path_nodes.back(), source, /* may_move = */ false);
+  for (node_type* node : path_nodes) node->size += n_added;
+}
+
+void CtxMapTree::merge(const std::string& path, CtxMapTree&& other) {
+  const std::shared_ptr<node_type> source = std::move(other.m_root);
+  other.m_root                            = make_node(other.m_resource);
+  ++other.m_generation;
+  if (source->size == 0) return;
+
+  ++m_generation;
+  const std::vector<node_type*> path_nodes = exclusive_path(path);
+  const size_t n_added = merge_nodes(*path_nodes.back(), source, /* may_move = */ true);
+  for (node_type* node : path_nodes) node->size += n_added;
+}
+
+CtxMapTree CtxMapTree::exchange(const std::string& path, CtxMapTree subtree) {
+  // An empty subtree leaves no node behind, like an erase
+  if (subtree.m_root->size == 0) return extract(path);
+
+  ++m_generation;
+  ++subtree.m_generation;
+  if (path.empty()) {
+    std::swap(m_root, subtree.m_root);
+    return subtree;
+  }
+
+  // Make the path to the parent private and relink the node below it
+  const size_t last_sep                    = path.rfind('/');
+  const std::vector<node_type*> path_nodes = exclusive_path(path.substr(0, last_sep));
+  std::string part                         = path.substr(last_sep + 1);
+  auto& children                           = path_nodes.back()->children;
+  auto it                                  = children.lower_bound(part);
+  if (it == std::end(children) || component_comparator_type{}(part, it->first)) {
+    it = children.emplace_hint(it, std::move(part),
+                               make_node(path_nodes.back()->resource()));
+  }
+  std::swap(it->second, subtree.m_root);
+
+  const size_t n_removed = subtree.m_root->size;
+  const size_t n_added   = it->second->size;
+  for (node_type* node : path_nodes) node->size = node->size - n_removed + n_added;
+  return subtree;
+}
+
+void CtxMapTree::attach_region(const std::string& path, size_t chunk_size) {
+  if (path.empty()) {
+    throw invalid_argument(
+          "Cannot attach a region to the root of a map. Construct the map with a "
+          "memory resource instead.");
+  }
+  if (subtree_size(path) > 0) {
+    throw invalid_argument("Cannot attach a region to the path '" + path +
+                           "', which holds values already.");
+  }
+
+  ++m_generation;
+  const size_t last_sep                    = path.rfind('/');
+  const std::vector<node_type*> path_nodes = exclusive_path(path.substr(0, last_sep));
+  std::string part                         = path.substr(last_sep + 1);
+  auto& children                           = path_nodes.back()->children;
+
+  // The region is owned by the memory allocated from it (see CtxMapRegion),
+  // so it goes away with the last node allocated from it.
+  std::unique_ptr<CtxMapRegion> region(
+        new CtxMapRegion(chunk_size, path_nodes.back()->resource()));
+  std::shared_ptr<node_type> node = make_node(region.get());
+  region.release();
+  children[std::move(part)] = std::move(node);
+}
+
+void CtxMapTree::publish() {
+  std::atomic_store(&m_published, m_root);
+
+  // The nodes are shared now, so cached pointers for modifying values
+  // need to be obtained again (which makes the path private once more).
+  ++m_generation;
+}
+
+template <typename Modifications>
+void CtxMapTree::apply_modifications(Modifications& modifications) {
+  ++m_generation;
+
+  // The path from the root to the node currently looked at
+  struct Level {
+    node_type* node;
+    node_type::children_type::iterator position;  // In the children of the parent
+    size_t n_added;                                // Values added below the node
+    size_t n_removed;                              // Values removed below the node
+  };
+  std::vector<Level> stack{Level{make_exclusive(m_root), {}, 0, 0}};
+
+  // Leave the deepest node, passing the counts to the parent and
+  // pruning the node if it became empty.
+  auto pop = [&stack]() {
+    const Level level = stack.back();
+    stack.pop_back();
+    level.node->size += level.n_added;
+    level.node->size -= level.n_removed;
+    stack.back().n_added += level.n_added;
+    stack.back().n_removed += level.n_removed;
+    if (!level.node->has_value && level.node->children.empty()) {
+      stack.back().node->children.erase(level.position);
+    }
+  };
+
+  std::string part;
+  for (auto& mod : modifications) {
+    // Keep the part of the current path shared with the key ...
+    size_t depth = 0;
+    size_t pos   = 0;
+    for (; depth + 1 < stack.size(); ++depth) {
+      const std::string& component = stack[depth + 1].position->first;
+      if (pos >= mod.key.size() ||
+          mod.key.compare(pos + 1, component.size(), component) != 0 ||
+          (pos + 1 + component.size() < mod.key.size() &&
+           mod.key[pos + 1 + component.size()] != '/')) {
+        break;
+      }
+      pos += 1 + component.size();
+    }
+    while (stack.size() > depth + 1) pop();
+
+    // ... and descend along the remaining components
+    bool found = true;
+    while (found && next_component(mod.key, pos, part)) {
+      node_type* parent = stack.back().node;
+      auto& children    = parent->children;
+      auto it           = std::end(children);
+      if (!children.empty() &&
+          component_comparator_type{}(std::prev(std::end(children))->first, part)) {
+        // Appending after the last child: No need to search (it is the
+        // common case when a new subtree is filled)
+      } else {
+        it = children.lower_bound(part);
+        if (it != std::end(children) && it->first == part) {
+          stack.push_back(Level{make_exclusive(it->second), it, 0, 0});
+          continue;
+        }
+      }
+
+      if (mod.erase) {
+        found = false;  // Nothing to erase
+      } else {
+        it = children.emplace_hint(it, part, make_node(parent->resource()));
+        stack.push_back(Level{it->second.get(), it, 0, 0});
+      }
+    }
+    if (!found) continue;
+
+    node_type* node = stack.back().node;
+    if (mod.erase) {
+      if (node->has_value) {
+        release_value(node->value, m_reclaimer.get());
+        node->has_value = false;
+        stack.back().n_removed += 1;
+      }
+    } else {
+      if (!node->has_value) stack.back().n_added += 1;
+      release_value(node->value, m_reclaimer.get());
+      node->value     = take_value(mod);
+      node->has_value = true;
+    }
+  }
+
+  while (stack.size() > 1) pop();
+  stack.back().node->size += stack.back().n_added;
+  stack.back().node->size -= stack.back().n_removed;
+}
+
+void CtxMapTree::apply(std::vector<Modification>&& modifications) {
+  apply_modifications(modifications);
+}
+
+void CtxMapTree::apply(const std::vector<Modification>& modifications) {
+  apply_modifications(modifications);
+}
+
+CtxMapTree::node_type& CtxMapTree::insert_node(const std::string& key) {
+  // Fast path: The key exists already and the subtree sizes stay as they are
+  node_type* existing = find_node(key);
+  if (existing != nullptr && existing->has_value) return *existing;
+
+  // A new value is added, so each node on the way down gains one value.
+  node_type* node = make_exclusive(m_root);
+  node->size += 1;
+  std::string part;
+  for (size_t pos = 0; next_component(key, pos, part);) {
+    node = child_for_insert(node, part);
+  }
+  node->has_value = true;
+  return *node;
+}
+
+CtxMapTree::node_type& CtxMapTree::insert_node(const std::string& location,
+                                               const CtxMapKey& key) {
+  node_type* existing = find_node(location, key);
+  if (existing != nullptr && existing->has_value) return *existing;
+
+  node_type* node = make_exclusive(m_root);
+  node->size += 1;
+  std::string part;
+  for (size_t pos = 0; next_component(location, pos, part);) {
+    node = child_for_insert(node, part);
+  }
+  for (const auto& component : key.components()) {
+    node = child_for_insert(node, component);
+  }
+  node->has_value = true;
+  return *node;
+}
+
+size_t CtxMapTree::erase(const std::string& key) {
+  ++m_generation;
+  node_type& root = *make_exclusive(m_root);
+  size_t count    = 0;
+  if (!key.empty()) {
+    count = erase_below(root, key, 0, /* recursive = */ false, m_reclaimer.get());
+  } else if (root.has_value) {
+    release_value(root.value, m_reclaimer.get());
+    root.has_value = false;
+    count          = 1;
+  }
+  root.size -= count;
+  return count;
+}
+
+size_t CtxMapTree::erase_subtree(const std::string& path) {
+  if (path.empty()) {
+    const size_t count = m_root->size;
+    clear();
+    return count;
+  }
+
+  ++m_generation;
+  node_type& root    = *make_exclusive(m_root);
+  const size_t count =
+        erase_below(root, path, 0, /* recursive = */ true, m_reclaimer.get());
+  root.size -= count;
+  return count;
+}
+
+}  // namespace ctx
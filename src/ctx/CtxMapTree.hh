@@ -0,0 +1,551 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "CtxMapKey.hh"
+#include "CtxMapReclaimer.hh"
+#include "CtxMapValue.hh"
+#include "memory_resource.hh"
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ctx {
+
+/** Custom comparator to sort key strings. Makes sure that slashes "/"
+ *  sort before any other character. All other characters are compared
+ *  as unsigned bytes. */
+struct CtxMapKeyComparator {
+  bool operator()(const key_view_type& x, const key_view_type& y) const;
+
+#ifdef CTX_HAVE_STRING_VIEW
+  // Allow lookups in maps using this comparator without constructing strings
+  typedef void is_transparent;
+#endif
+
+  typedef std::string first_argument_type;
+  typedef std::string second_argument_type;
+  typedef bool result_type;
+};
+
+/** Comparator for the path components of keys, i.e. strings without any "/".
+ *
+ * Since a component never contains a slash, the special role of the slash
+ * in the CtxMapKeyComparator does not matter and components are plainly
+ * compared as unsigned bytes (i.e. using memcmp). Ordering the children
+ * of each tree node by their component makes a preorder traversal of the
+ * tree visit the keys in the order of the CtxMapKeyComparator.
+ */
+struct CtxMapComponentComparator {
+  bool operator()(const key_view_type& x, const key_view_type& y) const {
+    return x.compare(y) < 0;
+  }
+
+#ifdef CTX_HAVE_STRING_VIEW
+  // Allow lookups in maps using this comparator without constructing strings
+  typedef void is_transparent;
+#endif
+};
+
+/** A node of the CtxMapTree.
+ *
+ * Each node represents a single component of a key path, i.e. the
+ * key "/scf/iter/energy" is represented by the chain of nodes
+ * "scf", "iter" and "energy" below the root node of the tree.
+ * Nodes only used to reach deeper keys carry no value.
+ *
+ * Nodes may be shared between several trees (see CtxMapTree for details).
+ * Copying a node copies the value and the pointers to the children,
+ * such that the children remain shared.
+ *
+ * The entries of the map of children are allocated from the memory
+ * resource the node is constructed with (see make_node). The children
+ * and copies of the node are allocated from the same resource. Note that
+ * the keys of the entries are plain std::string objects, so the characters
+ * of components too long for their internal buffer come from the global heap.
+ */
+struct CtxMapNode {
+  typedef std::map<std::string, std::shared_ptr<CtxMapNode>, CtxMapComponentComparator,
+                   ResourceAllocator<std::pair<const std::string,
+                                               std::shared_ptr<CtxMapNode>>>>
+        children_type;
+
+  /** Construct an empty node using the given memory resource (or the global heap) */
+  explicit CtxMapNode(memory_resource* resource = nullptr)
+        : children(children_type::allocator_type(resource)) {}
+
+  /** Copy a node, allocating the copy of the map of children from resource */
+  CtxMapNode(const CtxMapNode& other, memory_resource* resource)
+        : value(other.value),
+          has_value(other.has_value),
+          size(other.size),
+          children(other.children, children_type::allocator_type(resource)) {}
+
+  /** The value stored at this node. Only meaningful if has_value is true. */
+  CtxMapValue value;
+
+  /** Does this node hold a value or is it only an inner node of the tree */
+  bool has_value = false;
+
+  /** Number of values stored in the subtree starting at this node
+   *  (including the value of the node itself) */
+  size_t size = 0;
+
+  /** The child nodes sorted by their path component */
+  children_type children;
+
+  /** The memory resource the node has been allocated from (nullptr for the heap) */
+  memory_resource* resource() const { return children.get_allocator().resource(); }
+};
+
+/** Allocate an empty node and its reference count from a memory resource
+ *  (or the global heap if it is a nullptr) */
+inline std::shared_ptr<CtxMapNode> make_node(memory_resource* resource) {
+  if (resource == nullptr) return std::make_shared<CtxMapNode>();
+  return std::allocate_shared<CtxMapNode>(ResourceAllocator<CtxMapNode>(resource),
+                                          resource);
+}
+
+/** Allocate a copy of a node from a memory resource (or the global heap) */
+inline std::shared_ptr<CtxMapNode> make_node(memory_resource* resource,
+                                             const CtxMapNode& other) {
+  if (resource == nullptr) return std::make_shared<CtxMapNode>(other, resource);
+  return std::allocate_shared<CtxMapNode>(ResourceAllocator<CtxMapNode>(resource),
+                                          other, resource);
+}
+
+/** Make sure the node owned by ptr is not shared with another tree, by
+ *  replacing it with a copy (allocated from the same resource) if necessary.
+ *  Returns true if a copy was made. */
+inline bool unshare_node(std::shared_ptr<CtxMapNode>& ptr) {
+  if (ptr.use_count() == 1) {
+    // Other threads (e.g. holding a snapshot) may just have dropped their
+    // reference. Make sure their accesses are complete before we modify the node.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return false;
+  }
+  ptr = make_node(ptr->resource(), *ptr);
+  return true;
+}
+
+/** The storage engine behind the CtxMap: A tree (trie) with one node per
+ *  path component of the stored keys.
+ *
+ * All keys passed to this class need to be normalised, i.e. they need
+ * to be of the form returned by CtxMap::make_full_key (either the empty
+ * string or a string like "/a/b/c"). Lookups only cost a search amongst
+ * the children of a node for each component of the key and whole subtrees
+ * can be accessed (or removed) via a single node.
+ *
+ * A preorder traversal of the tree, where children are visited in the order
+ * given by CtxMapKeyComparator, visits the keys in exactly the order, which a
+ * flat std::map with the CtxMapKeyComparator would provide.
+ *
+ * The tree is persistent: Copies of a tree (or of a subtree) share all
+ * nodes with the original, so copying only costs a lookup of the subtree.
+ * Before a node is modified or handed out for modification, it is replaced
+ * by a private copy if it is shared with another tree (copy on write).
+ * Since the parent needs to be modified to refer to the copy, this clones
+ * the path from the root to the node, but nothing else. The functions
+ * providing non-const access to nodes or values therefore make the path
+ * to the node private, while the const functions never copy.
+ *
+ * The tree can publish versions of its contents (see publish()), which
+ * may be read by other threads while the tree is further modified.
+ *
+ * The nodes of a tree (including the entries of the maps of children) are
+ * allocated from memory resources: The root node is allocated from the
+ * resource of the tree, which is passed on to copies of the tree, all other
+ * nodes from the resource of their parent. A subtree may be placed into a
+ * region of its own (see attach_region) this way. Nodes shared with or
+ * taken over from other trees stay where they were allocated, so a resource
+ * needs to outlive all trees, which might refer to its nodes.
+ *
+ * If the tree has a CtxMapReclaimer (see set_reclaimer), removed or replaced
+ * values and subtrees are handed over to it instead of being destroyed on
+ * the thread modifying the tree. So is the root, once the tree is destroyed.
+ */
+class CtxMapTree {
+ public:
+  typedef CtxMapNode node_type;
+  typedef CtxMapKeyComparator key_comparator_type;
+  typedef CtxMapComponentComparator component_comparator_type;
+
+  /** A modification of the tree (see apply) */
+  struct Modification {
+    /** The normalised key to modify */
+    std::string key;
+
+    /** Remove the key (true) or store value under it (false) */
+    bool erase;
+
+    /** The value to store */
+    CtxMapValue value;
+  };
+
+  /** Construct an empty tree */
+  CtxMapTree() = default;
+
+  /** Construct an empty tree allocating its nodes from a memory resource.
+   *  A nullptr selects the global heap. */
+  explicit CtxMapTree(memory_resource* resource) : m_resource(resource) {}
+
+  /** Copy the tree. Both trees share their nodes until they are modified,
+   *  such that this is cheap. Once the nodes are copied, only the pointers
+   *  to the actual data of the values are copied. */
+  CtxMapTree(const CtxMapTree& other)
+        : m_resource(other.m_resource),
+          m_root(other.m_root),
+          m_reclaimer(other.m_reclaimer) {}
+
+  /** Destroy the tree, handing the nodes over to the reclaimer (if any) */
+  ~CtxMapTree() {
+    if (m_reclaimer != nullptr) m_reclaimer->retire(m_root);
+  }
+
+  /** Make a new tree from a copy of the subtree at path of another tree */
+  CtxMapTree(const CtxMapTree& other, const std::string& path);
+
+  /** Make a tree from a root node (e.g. obtained from published()), which
+   *  is shared with the trees it stems from. A nullptr yields an empty tree. */
+  explicit CtxMapTree(std::shared_ptr<node_type> root,
+                      memory_resource* resource = nullptr)
+        : m_resource(resource),
+          m_root(root != nullptr ? std::move(root) : make_node(resource)) {}
+
+  /** Return the node representing the given key or nullptr if no such node exists.
+   *
+   * The path to the node is made private to this tree (see the class
+   * documentation), such that the node may be modified.
+   *
+   * \note The node might exist without holding a value, if it only serves
+   *       as an inner node for deeper keys.
+   */
+  node_type* find_node(const std::string& key);
+
+  /** Return the node representing the given key or nullptr (const version) */
+  const node_type* find_node(const std::string& key) const {
+    return find_node(m_root.get(), key);
+  }
+
+  /** Return the node representing the precompiled key relative to the normalised
+   *  location or nullptr if no such node exists. The path to the node is made
+   *  private to this tree. */
+  node_type* find_node(const std::string& location, const CtxMapKey& key);
+
+  /** Return the node representing the precompiled key relative to the normalised
+   *  location or nullptr (const version) */
+  const node_type* find_node(const std::string& location, const CtxMapKey& key) const;
+
+  /** Return the value stored under the given key or nullptr if no such value */
+  CtxMapValue* find(const std::string& key) {
+    node_type* node = find_node(key);
+    return node != nullptr && node->has_value ? &node->value : nullptr;
+  }
+
+  /** Return the value stored under the given key or nullptr (const version) */
+  const CtxMapValue* find(const std::string& key) const {
+    const node_type* node = find_node(key);
+    return node != nullptr && node->has_value ? &node->value : nullptr;
+  }
+
+  /** Return the value stored under the given precompiled key relative to the
+   *  normalised location or nullptr if no such value */
+  CtxMapValue* find(const std::string& location, const CtxMapKey& key) {
+    node_type* node = find_node(location, key);
+    return node != nullptr && node->has_value ? &node->value : nullptr;
+  }
+
+  /** Return the value stored under the given precompiled key relative to the
+   *  normalised location or nullptr (const version) */
+  const CtxMapValue* find(const std::string& location, const CtxMapKey& key) const {
+    const node_type* node = find_node(location, key);
+    return node != nullptr && node->has_value ? &node->value : nullptr;
+  }
+
+  /** Return the value stored under a key relative to the normalised location
+   *  or nullptr if no such value.
+   *
+   * The key needs not be normalised, but may only contain empty path parts
+   * (like in "a//b" or "a/"), no "." or ".." path parts
+   * (see CtxMapKey::has_relative_components).
+   */
+  CtxMapValue* find_relative(const std::string& location, const key_view_type& key);
+
+  /** Return the value stored under a key relative to the normalised location
+   *  or nullptr (const version) */
+  const CtxMapValue* find_relative(const std::string& location,
+                                   const key_view_type& key) const;
+
+  /** Return the value stored under the given key, inserting an empty value
+   *  if the key does not yet exist.
+   *
+   * Adding a node does not move any other node, so the generation only
+   * changes if nodes on the path had to be copied (see make_exclusive).
+   * Values should be stored into the returned slot via replace.
+   */
+  CtxMapValue& operator[](const std::string& key) { return insert_node(key).value; }
+
+  /** Return the value stored under the precompiled key relative to the normalised
+   *  location, inserting an empty value if the key does not yet exist. */
+  CtxMapValue& insert(const std::string& location, const CtxMapKey& key) {
+    return insert_node(location, key).value;
+  }
+
+  /** Store a T constructed from args under the given key, inserting the key
+   *  if it does not yet exist.
+   *
+   * The object is allocated from the memory resource of the node holding
+   * the key (see CtxMapValue::allocate), i.e. from the resource of the tree
+   * or from the region the key lies in (see attach_region). The old value is
+   * released like in replace. If constructing the object throws, the old
+   * value is kept and a newly inserted key is removed again.
+   */
+  template <typename T, typename... Args>
+  void emplace(const std::string& key, Args&&... args) {
+    node_type& node = insert_node(key);
+    try {
+      replace(node.value,
+              CtxMapValue::allocate<T>(node.resource(), std::forward<Args>(args)...));
+    } catch (...) {
+      if (!node.value.has_value()) erase(key);
+      throw;
+    }
+  }
+
+  /** Store a T constructed from args under the precompiled key relative to
+   *  the normalised location (see the other emplace) */
+  template <typename T, typename... Args>
+  void emplace(const std::string& location, const CtxMapKey& key, Args&&... args) {
+    node_type& node = insert_node(location, key);
+    try {
+      replace(node.value,
+              CtxMapValue::allocate<T>(node.resource(), std::forward<Args>(args)...));
+    } catch (...) {
+      if (!node.value.has_value()) erase(CtxMapKey::full_key(location, key.str()));
+      throw;
+    }
+  }
+
+  /** Remove the value stored under a key
+   *
+   * \return The number of removed values (i.e. 0 or 1)
+   */
+  size_t erase(const std::string& key);
+
+  /** Remove a key and all keys below it
+   *
+   * \return The number of removed values
+   */
+  size_t erase_subtree(const std::string& path);
+
+  /** Apply many modifications in the given order.
+   *
+   * The path to the previously modified key is kept, such that each
+   * modification only descends from the deepest node shared with the
+   * previous key instead of from the root. Modifications of many keys in
+   * one subtree therefore look up the nodes on the way to the subtree only
+   * once. Children appended at the end of a node (e.g. when keys are added
+   * in sorted order) are inserted without searching. Subtree sizes are
+   * updated and emptied nodes removed only once the path is left.
+   */
+  void apply(std::vector<Modification>&& modifications);
+
+  /** Apply many modifications in the given order, copying the values */
+  void apply(const std::vector<Modification>& modifications);
+
+  /** Insert all values of another tree below path, replacing the values
+   *  stored under the same keys.
+   *
+   * The children of the nodes of both trees are sorted, so they are merged
+   * in a single pass. Subtrees which only exist in the other tree are not
+   * copied at all, but shared with it (see the class documentation).
+   * The cost is therefore at most linear in the number of nodes of both
+   * trees and no key is built or normalised. The other tree may share
+   * nodes with this tree (e.g. be a copy of a subtree of it).
+   */
+  void merge(const std::string& path, const CtxMapTree& other);
+
+  /** Insert all values of another tree below path, moving its nodes.
+   *
+   * Like the const version, but the nodes of other, which are not shared
+   * with any further tree, are moved into this tree: Neither the nodes and
+   * their keys nor the values are copied. Other is empty afterwards.
+   */
+  void merge(const std::string& path, CtxMapTree&& other);
+
+  /** Remove the subtree at path and return it as a tree of its own.
+   *
+   * The nodes are not copied, but handed over to the returned tree,
+   * such that this only costs a lookup of the path.
+   */
+  CtxMapTree extract(const std::string& path) {
+    CtxMapTree subtree(*this, path);
+    erase_subtree(path);
+    return subtree;
+  }
+
+  /** Replace the subtree at path by another tree and return the replaced subtree.
+   *
+   * Only the pointer to the node at path is exchanged and the sizes of the
+   * nodes on the way to it are adjusted, such that neither the nodes below
+   * the path nor their keys and values are touched. The cost is therefore
+   * independent of the size of both subtrees.
+   */
+  CtxMapTree exchange(const std::string& path, CtxMapTree subtree);
+
+  /** Make the empty subtree at path allocate its nodes from a new CtxMapRegion.
+   *
+   * Values stored via emplace below the path are allocated from the region
+   * as well. Freed memory is reused by the region and once the last
+   * node is gone, the region gives all its chunks back to the resource of
+   * the parent at once (see CtxMapRegion). The region ends once the subtree
+   * is removed or becomes empty. If the path holds
+   * values already or is the root, an invalid_argument is thrown.
+   */
+  void attach_region(const std::string& path, size_t chunk_size);
+
+  /** Replace the value in slot (stored in a node of this tree) by value.
+   *  The old value is released via the reclaimer of the tree (if any). */
+  void replace(CtxMapValue& slot, CtxMapValue&& value) {
+    // Pointers to the slot stay valid, but their type check might not
+    if (slot.has_value() && slot.type_id() != value.type_id()) ++m_generation;
+    if (m_reclaimer != nullptr) m_reclaimer->retire(slot);
+    slot = std::move(value);
+  }
+
+  /** Remove all values from the tree */
+  void clear() {
+    ++m_generation;
+    std::shared_ptr<node_type> old_root = std::move(m_root);
+    m_root                              = make_node(m_resource);
+    if (m_reclaimer != nullptr) m_reclaimer->retire(old_root);
+  }
+
+  /** Return the number of values stored at the key or below it */
+  size_t subtree_size(const std::string& path) const {
+    const node_type* node = find_node(path);
+    return node == nullptr ? 0 : node->size;
+  }
+
+  /** Return the generation of the tree.
+   *
+   * The generation changes whenever nodes are replaced or removed and
+   * whenever replace stores a value of another type into a slot, i.e.
+   * whenever pointers to values obtained from the tree may have become
+   * invalid or may refer to a value of another type. Storing a value of the
+   * same type or adding keys leaves the generation unchanged.
+   */
+  size_t generation() const { return m_generation; }
+
+  /** Publish the current contents of the tree as a new version.
+   *
+   * The nodes of the version are shared with the tree afterwards, such that
+   * they are copied rather than modified on the next modifications of the tree.
+   * Since only a pointer to the root is stored, this does not depend on the
+   * number of entries.
+   */
+  void publish();
+
+  /** Return the root node of the version published last (or nullptr if
+   *  nothing has been published yet).
+   *
+   * This function may be called concurrently with modifications of the
+   * tree or publish(). The returned nodes are not modified any more.
+   */
+  std::shared_ptr<node_type> published() const { return std::atomic_load(&m_published); }
+
+  /** Return the memory resource nodes are allocated from (nullptr for the heap) */
+  memory_resource* resource() const { return m_resource; }
+
+  /** Hand removed values and subtrees over to a reclaimer, which destroys
+   *  them on a background thread. A nullptr destroys them right away.
+   *  Copies of the tree made afterwards share the reclaimer. */
+  void set_reclaimer(std::shared_ptr<CtxMapReclaimer> reclaimer) {
+    m_reclaimer = std::move(reclaimer);
+  }
+
+  /** Return the reclaimer of the tree (or nullptr) */
+  const std::shared_ptr<CtxMapReclaimer>& reclaimer() const { return m_reclaimer; }
+
+  /** Return the root node. It is made private to this tree. */
+  node_type& root() { return *make_exclusive(m_root); }
+
+  /** Return the root node (const version) */
+  const node_type& root() const { return *m_root; }
+
+  /** Make sure the node owned by ptr (which needs to be the root or a child
+   *  of a node private to this tree) is private to this tree as well. */
+  node_type* make_exclusive(std::shared_ptr<node_type>& ptr) {
+    // The node is replaced, so pointers into it may become outdated
+    if (unshare_node(ptr)) ++m_generation;
+    return ptr.get();
+  }
+
+ private:
+  /** Implementation of apply for const and non-const modifications */
+  template <typename Modifications>
+  void apply_modifications(Modifications& modifications);
+
+  /** Descend from node along the components of a normalised key */
+  static const node_type* find_node(const node_type* node, const std::string& key);
+
+  /** Return the node holding the value for the key, inserting the key (with
+   *  an empty value) if it does not yet exist (see operator[]) */
+  node_type& insert_node(const std::string& key);
+
+  /** Return the node holding the value for the precompiled key relative to
+   *  the normalised location, inserting the key if it does not yet exist */
+  node_type& insert_node(const std::string& location, const CtxMapKey& key);
+
+  /** Return the child of node with the given path component (private to
+   *  this tree) or nullptr if no such child exists. */
+  template <typename Part>
+  node_type* exclusive_child(node_type* node, const Part& part);
+
+  /** Merge the values of the subtree at source into the subtree at target
+   *  (which needs to be private to this tree). Returns the number of added keys.
+   *  If may_move is true, nodes referenced only by source are moved. */
+  size_t merge_nodes(node_type& target, const std::shared_ptr<node_type>& source,
+                     bool may_move);
+
+  /** Make the nodes along path (creating missing ones) private to this tree
+   *  and return them, starting with the root. */
+  std::vector<node_type*> exclusive_path(const std::string& path);
+
+  /** Return the child of node with the given path component. Creates it if
+   *  it does not exist and marks it to contain one more value. */
+  node_type* child_for_insert(node_type* node, const std::string& part);
+
+  /** The memory resource new nodes are allocated from (nullptr for the heap) */
+  memory_resource* m_resource = nullptr;
+
+  /** The root node, which is never a nullptr */
+  std::shared_ptr<node_type> m_root = make_node(m_resource);
+
+  /** The root of the version published last. Only accessed atomically. */
+  std::shared_ptr<node_type> m_published;
+
+  /** Destroys removed values and subtrees, if not nullptr (see set_reclaimer) */
+  std::shared_ptr<CtxMapReclaimer> m_reclaimer;
+
+  /** Generation counter, see generation() */
+  size_t m_generation = 0;
+};
+
+}  // namespace ctx
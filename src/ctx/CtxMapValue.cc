@@ -16,40 +16,23 @@
 
 #include "CtxMapValue.hh"
 #include <iomanip>
+#include <sstream>
 
 namespace ctx {
 
-// TODO Generalise into a static map where a user can
-//      register check and conversion functions
-
-#define IF_TYPE_PRINT(TYPE)                                              \
-  if (value.type_name_raw() == std::string(typeid(TYPE).name()) ||       \
-      value.type_name_raw() == std::string(typeid(const TYPE).name())) { \
-    o << std::setw(10) << std::left << value.get<const TYPE>();          \
-  }
-
 /** Try to provide a string representation of the CtxMapValue. If this fails, just print
  * the type */
 std::ostream& operator<<(std::ostream& o, const CtxMapValue& value) {
-
-  /* clang-format off */
-       IF_TYPE_PRINT(bool)
-  else IF_TYPE_PRINT(char)
-  else IF_TYPE_PRINT(int)
-  else IF_TYPE_PRINT(long)
-  else IF_TYPE_PRINT(long long)
-  else IF_TYPE_PRINT(unsigned char)
-  else IF_TYPE_PRINT(unsigned int)
-  else IF_TYPE_PRINT(unsigned long)
-  else IF_TYPE_PRINT(unsigned long long)
-  else IF_TYPE_PRINT(float)
-  else IF_TYPE_PRINT(double)
-  else IF_TYPE_PRINT(long double)
-  else IF_TYPE_PRINT(std::string)
-  else {
-    o << std::setw(10) << std::left << "???";
+  // The printers for the individual types are held by the TypeRegistry.
+  // Print to a buffer first, such that the padding applies to the full output.
+  std::ostringstream ss;
+  ss.copyfmt(o);
+  ss.width(0);
+  if (!value.has_value() ||
+      !TypeRegistry::instance().print(ss, value.type_id(), value.object_ptr())) {
+    ss.str("???");
   }
-  /* clang-format on */
+  o << std::setw(10) << std::left << ss.str();
 
   o << "  (" << value.type_name() << ")";
   return o;
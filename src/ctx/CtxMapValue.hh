@@ -16,16 +16,23 @@
 
 #pragma once
 #include "IsCheaplyCopyable.hh"
+#include "TypeRegistry.hh"
 #include "demangle.hh"
 #include "exceptions.hh"
+#include "memory_resource.hh"
 #include <memory>
 #include <type_traits>
+#include <utility>
 
 namespace ctx {
 
 // Forward-declare. Proper declaration in CtxMap.hh
 class CtxMap;
 
+// Forward-declare. Proper declaration in CtxMapHandle.hh
+template <typename T>
+class CtxMapHandle;
+
 /** \brief Class to contain an entry value in a CtxMap, i.e. the thing the
  *  key string actually points to.
  *
@@ -33,11 +40,24 @@ class CtxMap;
  * a std::shared_ptr or a SubscriptionPointer to the object we emplace in the
  * map or from an object which is subscribable (which will automatically be
  * subscribed to.
+ *
+ * The object is always kept in a shared heap block, which never moves.
+ * References obtained via get and pointers obtained via get_ptr therefore
+ * stay valid as long as the object is part of the map and all copies of a
+ * CtxMapValue refer to the same object. None of the const functions modify
+ * the CtxMapValue, such that they may be called from several threads.
+ *
+ * This holds for small values like numbers as well, although an inline
+ * buffer would save their heap block: A copy of the value (e.g. in a node
+ * cloned for copy on write) would hold a separate object, such that
+ * references would no longer follow the map. The block is small compared
+ * to the tree node holding the value (about 32 of 250 bytes per entry for
+ * a map of numbers), so keeping it costs little memory.
  */
 class CtxMapValue {
  public:
   /** \brief Default constructor: Constructs empty object */
-  CtxMapValue() : m_object_ptr{nullptr} {}
+  CtxMapValue() : m_object_ptr{nullptr}, m_type_id{TypeRegistry::no_type} {}
 
   /** \brief Make a CtxMapValue out of a type which is cheap to copy.
    *
@@ -53,6 +73,28 @@ class CtxMapValue {
   //     reference)
   //   - T should be cheap to copy
 
+  /** Copy a CtxMapValue. Both copies refer to the same object afterwards */
+  CtxMapValue(const CtxMapValue& other) = default;
+
+  /** Move a CtxMapValue. The moved-from value is empty afterwards */
+  CtxMapValue(CtxMapValue&& other) noexcept
+        : m_object_ptr{std::move(other.m_object_ptr)}, m_type_id{other.m_type_id} {
+    other.m_type_id = TypeRegistry::no_type;
+  }
+
+  /** Copy-assign a CtxMapValue. Both copies refer to the same object afterwards */
+  CtxMapValue& operator=(const CtxMapValue& other) = default;
+
+  /** Move-assign a CtxMapValue. The moved-from value is empty afterwards */
+  CtxMapValue& operator=(CtxMapValue&& other) noexcept {
+    if (this != &other) {
+      m_object_ptr    = std::move(other.m_object_ptr);
+      m_type_id       = other.m_type_id;
+      other.m_type_id = TypeRegistry::no_type;
+    }
+    return *this;
+  }
+
   /** \brief Make an CtxMapValue out of a const char*.
    *
    * This behaves like the equivalent CtxMapValue of a  std::string */
@@ -62,27 +104,44 @@ class CtxMapValue {
   template <typename T, typename = typename std::enable_if<!std::is_same<
                               CtxMap, typename std::decay<T>::type>::value>::type>
   CtxMapValue(std::shared_ptr<T> t_ptr)
-        : m_object_ptr(t_ptr), m_type_name(typeid(T).name()) {}
+        : m_object_ptr(t_ptr), m_type_id(TypeRegistry::id_of<T>()) {}
 
   /** \brief Make a CtxMapValue from a shared pointer */
   template <typename T, typename = typename std::enable_if<!std::is_same<
                               CtxMap, typename std::decay<T>::type>::value>::type>
   CtxMapValue(std::shared_ptr<const T> t_ptr)
         : m_object_ptr{std::const_pointer_cast<T>(t_ptr)},
-          m_type_name(typeid(const T).name()) {}
+          m_type_id(TypeRegistry::id_of<const T>()) {}
 
   /** Make an CtxMapValue from an rvalue reference */
   template <typename T,
             typename = typename std::enable_if<
                   !std::is_reference<T>::value && !IsCheaplyCopyable<T>::value &&
                   !std::is_same<CtxMap, typename std::decay<T>::type>::value>::type>
-  CtxMapValue(T&& t) : CtxMapValue{std::make_shared<T>(std::move(t))} {}
+  CtxMapValue(T&& t) : CtxMapValue{allocate<T>(nullptr, std::move(t))} {}
   // Note about the enable_if:
   //   - We need to make sure that T is the actual type (and not a
   //     reference)
   //   - T should not be cheap to copy (else first constructor applies)
   //   - T should not be a CtxMap (we do not want maps in maps)
 
+  /** Make a CtxMapValue holding a T constructed from args.
+   *
+   * The object is allocated together with its reference count from the
+   * given memory resource (or the global heap if it is a nullptr). Note that
+   * memory the object allocates by itself (e.g. the characters of a long
+   * std::string) is not affected.
+   */
+  template <typename T, typename... Args>
+  static CtxMapValue allocate(memory_resource* resource, Args&&... args) {
+    // make_shared only honours over-alignment from C++17 on
+    if (resource == nullptr && alignof(T) <= alignof(std::max_align_t)) {
+      return CtxMapValue(std::make_shared<T>(std::forward<Args>(args)...));
+    }
+    return CtxMapValue(std::allocate_shared<T>(ResourceAllocator<T>(resource),
+                                               std::forward<Args>(args)...));
+  }
+
   /** Obtain a non-const pointer to the internal object */
   template <typename T>
   std::shared_ptr<T> get_ptr();
@@ -94,42 +153,74 @@ class CtxMapValue {
   /** Obtain a reference to the internal object */
   template <typename T>
   T& get() {
-    return *get_ptr<T>();
+    assert_can_get_value_as<T>();
+    return get_unchecked<T>();
   }
 
   /** Obtain a const reference to the internal object */
   template <typename T>
   const T& get() const {
-    return *get_ptr<T>();
+    assert_can_get_value_as<T>();
+    return get_unchecked<T>();
   }
 
   /** Return the demangled typename of the type of the internal object. */
-  std::string type_name() const { return demangle(m_type_name); }
+  const std::string& type_name() const {
+    return TypeRegistry::instance().name(m_type_id);
+  }
 
   /** Return the raw typename without demangling
    *
    * \note This is most likely not what you want. Try type_name() instead.
    **/
-  const std::string& type_name_raw() const { return m_type_name; }
+  const std::string& type_name_raw() const {
+    return TypeRegistry::instance().raw_name(m_type_id);
+  }
+
+  /** Return the id of the type of the internal object in the TypeRegistry */
+  TypeRegistry::id_type type_id() const { return m_type_id; }
 
   bool has_value() const { return m_object_ptr != nullptr; }
 
  private:
+  // Handles verify the type once and afterwards use get_unchecked.
+  template <typename T>
+  friend class CtxMapHandle;
+
+  // The reclaimer takes over the shared heap block of released values
+  friend class CtxMapReclaimer;
+
+  // Printing needs access to the untyped object pointer
+  friend std::ostream& operator<<(std::ostream& o, const CtxMapValue& value);
+
+  /** Throw an exception if the internal object cannot be obtained as a T */
+  template <typename T>
+  void assert_can_get_value_as() const;
+
+  /** Obtain a reference to the internal object without checking the type */
+  template <typename T>
+  T& get_unchecked() const {
+    return *static_cast<T*>(object_ptr());
+  }
+
+  /** Return an untyped pointer to the internal object */
+  void* object_ptr() const { return m_object_ptr.get(); }
+
   /** Check whether the object pointer stored in m_object_ptr_ptr
    *  can be obtained as a RCPWrapper<T>
    */
   template <typename T>
   bool can_get_value_as() const {
-    typedef typename std::remove_const<T>::type nonconstT;
-
     // Allow if the type is identical to the type originally stored
-    // or if a simple addition of const does the trick.
-    return m_type_name == std::string(typeid(T).name()) ||
-           m_type_name == std::string(typeid(nonconstT).name());
+    // or if a simple addition of const does the trick. Since T and
+    // const T share the type id, this is a single comparison.
+    return m_type_id == TypeRegistry::id_of<T>();
   }
 
+  /** Pointer to the internal object (null if the value is empty) */
   std::shared_ptr<void> m_object_ptr;
-  std::string m_type_name;
+
+  TypeRegistry::id_type m_type_id;
 };
 
 /** Try to provide a string representation of the CtxMapValue. If this fails, just print
@@ -141,26 +232,25 @@ std::ostream& operator<<(std::ostream& o, const CtxMapValue& value);
 //
 
 template <typename T>
-std::shared_ptr<T> CtxMapValue::get_ptr() {
-  if (m_object_ptr == nullptr) {
+void CtxMapValue::assert_can_get_value_as() const {
+  if (!has_value()) {
     throw runtime_error("CtxMapValue is empty.");
   }
   if (!can_get_value_as<T>()) {
     throw type_mismatch("Requested invalid type '" + demangle(typeid(T)) +
                         "' from CtxMap. The value has type '" + type_name() + "'.");
   }
+}
+
+template <typename T>
+std::shared_ptr<T> CtxMapValue::get_ptr() {
+  assert_can_get_value_as<T>();
   return std::static_pointer_cast<T>(m_object_ptr);
 }
 
 template <typename T>
 std::shared_ptr<const T> CtxMapValue::get_ptr() const {
-  if (m_object_ptr == nullptr) {
-    throw runtime_error("CtxMapValue is empty.");
-  }
-  if (!can_get_value_as<T>()) {
-    throw type_mismatch("Requested invalid type '" + demangle(typeid(T)) +
-                        "' from CtxMap. The value has type '" + type_name() + "'.");
-  }
+  assert_can_get_value_as<T>();
   return std::static_pointer_cast<const T>(m_object_ptr);
 }
 
@@ -0,0 +1,165 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "EpochManager.hh"
+#include "exceptions.hh"
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ctx {
+
+constexpr size_t EpochManager::max_blocks;
+constexpr size_t EpochManager::block_size;
+
+namespace {
+/** Epoch of slots of threads outside of a guard */
+constexpr uint64_t idle_epoch = std::numeric_limits<uint64_t>::max();
+
+/** Index of threads, which have not yet been assigned one */
+constexpr size_t no_index = std::numeric_limits<size_t>::max();
+
+/** The indices of the running threads, which are reused once a thread has
+ *  ended. Each manager keeps the slot of a thread at the thread's index. */
+struct ThreadIndices {
+  std::mutex mutex;
+
+  /** Indices of threads which have ended */
+  std::vector<size_t> unused;
+
+  /** Number of indices handed out so far, i.e. a bound for the indices */
+  std::atomic<size_t> n_indices{0};
+};
+
+ThreadIndices& thread_indices() {
+  static ThreadIndices instance;
+  return instance;
+}
+
+/** Owner of the index of a thread, which returns it when the thread ends */
+struct IndexOwner {
+  size_t index = no_index;
+  ~IndexOwner() {
+    if (index == no_index) return;
+    ThreadIndices& indices = thread_indices();
+    std::lock_guard<std::mutex> lock(indices.mutex);
+    indices.unused.push_back(index);
+  }
+};
+
+thread_local IndexOwner thread_index;
+
+size_t current_thread_index() {
+  size_t& index = thread_index.index;
+  if (index == no_index) {
+    ThreadIndices& indices = thread_indices();
+    std::lock_guard<std::mutex> lock(indices.mutex);
+    if (indices.unused.empty()) {
+      index = indices.n_indices.fetch_add(1);
+    } else {
+      index = indices.unused.back();
+      indices.unused.pop_back();
+    }
+  }
+  return index;
+}
+}  // namespace
+
+struct EpochManager::ReaderSlot {
+  /** Epoch at which the outermost guard was entered or idle_epoch */
+  std::atomic<uint64_t> epoch{idle_epoch};
+
+  /** Nesting depth of the guards (only accessed by the owning thread) */
+  size_t depth = 0;
+
+  /** Keep the slots of different threads on separate cache lines */
+  char padding[64];
+};
+
+struct EpochManager::SlotBlock {
+  ReaderSlot slots[block_size];
+};
+
+EpochManager::EpochManager() {
+  for (auto& block : m_blocks) block.store(nullptr, std::memory_order_relaxed);
+}
+
+EpochManager::~EpochManager() {
+  for (auto& block : m_blocks) delete block.load();
+}
+
+EpochManager::ReaderSlot& EpochManager::slot(size_t thread_index) const {
+  if (thread_index >= max_blocks * block_size) {
+    throw runtime_error("More threads than supported by the EpochManager (" +
+                        std::to_string(max_blocks * block_size) + ") are running.");
+  }
+
+  std::atomic<SlotBlock*>& entry = m_blocks[thread_index / block_size];
+  SlotBlock* block               = entry.load(std::memory_order_acquire);
+  if (block == nullptr) {
+    // Another thread with an index in the same block might race us here
+    SlotBlock* fresh = new SlotBlock;
+    if (entry.compare_exchange_strong(block, fresh)) {
+      block = fresh;
+    } else {
+      delete fresh;
+    }
+  }
+  return block->slots[thread_index % block_size];
+}
+
+EpochManager::Guard::Guard(const EpochManager& manager)
+      : m_slot{&manager.slot(current_thread_index())} {
+  // Announce the epoch before any shared data is read (see advance)
+  if (m_slot->depth++ == 0) m_slot->epoch.store(manager.m_epoch.load());
+}
+
+EpochManager::Guard::~Guard() {
+  if (--m_slot->depth == 0) m_slot->epoch.store(idle_epoch, std::memory_order_release);
+}
+
+uint64_t EpochManager::advance() {
+  // A reader which entered its guard before the epoch is advanced here
+  // announces an epoch not larger than the current one. A reader which
+  // announces a larger epoch entered its guard after the epoch was advanced
+  // and hence after the writer redirected the readers to the new data.
+  return m_epoch.fetch_add(1);
+}
+
+bool EpochManager::passed(uint64_t epoch) const {
+  // Threads, which have not been handed an index yet, have not entered a guard
+  const size_t n_indices = std::min(thread_indices().n_indices.load(),
+                                    max_blocks * block_size);
+  const size_t own       = thread_index.index;
+  for (size_t i = 0; i < n_indices; i += block_size) {
+    const SlotBlock* block = m_blocks[i / block_size].load();
+    if (block == nullptr) continue;
+    for (size_t j = 0; j < block_size && i + j < n_indices; ++j) {
+      if (i + j != own && block->slots[j].epoch.load() <= epoch) return false;
+    }
+  }
+  return true;
+}
+
+void EpochManager::wait_for(uint64_t epoch) const {
+  while (!passed(epoch)) std::this_thread::yield();
+}
+
+}  // namespace ctx
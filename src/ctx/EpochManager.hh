@@ -0,0 +1,108 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace ctx {
+
+/** Epoch-based tracking of readers, which access shared data without locks.
+ *
+ * Readers enclose their accesses to such data in an EpochManager::Guard.
+ * A writer, which has redirected the readers to a different copy of the
+ * data (e.g. switched the tree readers use for lookups), calls advance()
+ * and remembers the returned epoch. Once passed() returns true for this
+ * epoch, all readers which might still access the old copy have left their
+ * guards and the old copy may be modified or destroyed. Writers, which do
+ * not want to check back later, may use wait_for() or synchronize().
+ *
+ * Each manager tracks its own readers, such that the readers of one data
+ * structure do not hold up the writers of another. Entering and leaving a
+ * guard only writes to a slot private to the reading thread, such that
+ * readers do not contend with each other. Guards should only be held for
+ * the duration of a few lookups, since writers wait for them.
+ */
+class EpochManager {
+ public:
+  /** The epoch announced by a reading thread (defined in EpochManager.cc) */
+  struct ReaderSlot;
+
+  /** Mark the current thread as reading the data of a manager for the
+   *  lifetime of the guard. Guards may be nested. */
+  class Guard {
+   public:
+    explicit Guard(const EpochManager& manager);
+    ~Guard();
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+
+   private:
+    ReaderSlot* m_slot;
+  };
+
+  EpochManager();
+  ~EpochManager();
+  EpochManager(const EpochManager&) = delete;
+  EpochManager& operator=(const EpochManager&) = delete;
+
+  /** Advance the epoch and return the epoch before the call.
+   *
+   * All guards entered before the call announce an epoch not larger
+   * than the returned one, all guards entered afterwards a larger one.
+   */
+  uint64_t advance();
+
+  /** Have all guards, which were entered by other threads at or before the
+   *  given epoch, been left? */
+  bool passed(uint64_t epoch) const;
+
+  /** Wait until passed(epoch) is true.
+   *
+   * Guards of the calling thread are not waited for, such that the
+   * calling thread must not access data obtained inside its guards after
+   * the call, if the data may have been modified or destroyed.
+   */
+  void wait_for(uint64_t epoch) const;
+
+  /** Wait until all guards, which have been entered by other threads before
+   *  the call, have been left (see wait_for). */
+  void synchronize() { wait_for(advance()); }
+
+ private:
+  /** A block of slots for consecutive thread indices (see EpochManager.cc) */
+  struct SlotBlock;
+
+  /** Maximal number of blocks and number of slots per block, i.e. at most
+   *  max_blocks * block_size threads may enter guards at the same time */
+  static constexpr size_t max_blocks = 128;
+  static constexpr size_t block_size = 32;
+
+  /** Return the slot of the thread with the given index,
+   *  allocating its block if needed */
+  ReaderSlot& slot(size_t thread_index) const;
+
+  /** The epoch, which is advanced by each advance() */
+  std::atomic<uint64_t> m_epoch{1};
+
+  /** The slots of the reading threads, allocated in blocks on first use
+   *  and indexed by a number unique amongst the running threads */
+  mutable std::atomic<SlotBlock*> m_blocks[max_blocks];
+};
+
+}  // namespace ctx
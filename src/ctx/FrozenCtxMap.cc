@@ -0,0 +1,428 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "FrozenCtxMap.hh"
+#include "CtxMap.hh"
+#include <algorithm>
+#include <iomanip>
+#include <limits>
+
+namespace ctx {
+
+/** The arrays behind a FrozenCtxMap */
+struct FrozenCtxMapData {
+  typedef FrozenCtxMapIterator::index_type index_type;
+
+  /** Index representing "no entry" */
+  static constexpr index_type npos = std::numeric_limits<index_type>::max();
+
+  /** A path of the map, i.e. a key or an inner path leading to deeper keys */
+  struct Entry {
+    /** Hash of the full path of the entry (see hash_component), starting
+     *  from the hash of the root entry, which acts as a seed */
+    std::uint64_t hash;
+
+    /** Index of the parent entry (npos for the root) */
+    index_type parent;
+
+    /** Location of the last path component inside ``components`` */
+    index_type component_begin;
+    index_type component_size;
+
+    /** The range of values stored at this path or below it */
+    index_type value_begin;
+    index_type value_end;
+  };
+
+  /** The entries in iteration order. The first entry is the root "/". */
+  std::vector<Entry> entries;
+
+  /** The last path components of all entries, concatenated */
+  std::string components;
+
+  /** The values in iteration order */
+  std::vector<CtxMapValue> values;
+
+  /** The entry each value belongs to */
+  std::vector<index_type> value_entries;
+
+  /** Displacement for each bucket of the minimal perfect hash */
+  std::vector<std::uint32_t> displacements;
+
+  /** The entry belonging to each slot of the minimal perfect hash */
+  std::vector<index_type> slots;
+
+  /** Return the entry for a given path hash. If no entry with this hash
+   *  exists, some other entry is returned. */
+  index_type candidate(std::uint64_t hash) const;
+
+  /** Build the minimal perfect hash over the entry hashes, reseeding
+   *  the path hashes if necessary */
+  void build_hash();
+
+  /** Recompute the path hashes of all entries starting from the given
+   *  hash for the root */
+  void rehash(std::uint64_t seed);
+
+  /** Try to build the minimal perfect hash over the current entry hashes.
+   *  Returns false if this is not possible. */
+  bool try_build_hash();
+};
+
+constexpr FrozenCtxMapData::index_type FrozenCtxMapData::npos;
+
+namespace {
+typedef FrozenCtxMapData::index_type index_type;
+
+/** Extend the hash of a path by one more path component (FNV-1a of "/component") */
+inline std::uint64_t hash_component(std::uint64_t hash, const char* begin, size_t size) {
+  const std::uint64_t prime = 0x100000001b3ull;
+  hash                      = (hash ^ static_cast<unsigned char>('/')) * prime;
+  for (const char* c = begin; c != begin + size; ++c) {
+    hash = (hash ^ static_cast<unsigned char>(*c)) * prime;
+  }
+  return hash;
+}
+
+/** Hash of the root path */
+const std::uint64_t root_hash = 0xcbf29ce484222325ull;
+
+/** Scramble a hash with a displacement to obtain a slot of the perfect hash */
+inline std::uint64_t mix(std::uint64_t hash, std::uint64_t displacement) {
+  std::uint64_t x = hash + displacement * 0x9e3779b97f4a7c15ull;
+  x               = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x               = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+/** Number of buckets of the perfect hash for n entries */
+inline size_t n_buckets(size_t n) { return std::max<size_t>(1, n / 2); }
+
+/** Bucket of the perfect hash for an entry hash. The FNV hash itself is not
+ *  well-distributed enough for this, so it is scrambled first. */
+inline size_t bucket_of(std::uint64_t hash, size_t n_buckets) {
+  return mix(hash, 0) % n_buckets;
+}
+
+/** Split a key into its non-empty path components */
+void split_key(const std::string& key, std::vector<std::string>& parts) {
+  parts.clear();
+  for (size_t start = 0; start < key.size(); ++start) {
+    const size_t end = std::min(key.find('/', start), key.size());
+    if (end != start) parts.push_back(key.substr(start, end - start));
+    start = end;
+  }
+}
+
+/** Build the arrays from the contents of a CtxMap */
+std::shared_ptr<FrozenCtxMapData> make_data(const CtxMap& map) {
+  typedef FrozenCtxMapData::Entry Entry;
+  const size_t n_values = map.subtree_size("/");
+  if (n_values >= FrozenCtxMapData::npos) {
+    throw invalid_argument("CtxMap is too large to be frozen.");
+  }
+
+  std::shared_ptr<FrozenCtxMapData> data = std::make_shared<FrozenCtxMapData>();
+  data->values.reserve(n_values);
+  data->value_entries.reserve(n_values);
+  data->entries.push_back(Entry{root_hash, FrozenCtxMapData::npos, 0, 0, 0, 0});
+
+  // The entries of the path to the current key (starting with the root)
+  // and their path components.
+  std::vector<index_type> stack{0};
+  std::vector<std::string> stack_parts;
+  std::vector<std::string> parts;
+
+  auto pop_entry = [&data, &stack, &stack_parts]() {
+    data->entries[stack.back()].value_end = static_cast<index_type>(data->values.size());
+    stack.pop_back();
+    stack_parts.pop_back();
+  };
+
+  // The map is iterated in preorder, so the entries are created in preorder
+  // as well and the values below each entry form a contiguous range.
+  for (const auto& kv : map) {
+    split_key(kv.key(), parts);
+
+    size_t common = 0;
+    while (common < stack_parts.size() && common < parts.size() &&
+           stack_parts[common] == parts[common]) {
+      ++common;
+    }
+    while (stack_parts.size() > common) pop_entry();
+
+    for (size_t i = common; i < parts.size(); ++i) {
+      if (data->entries.size() >= FrozenCtxMapData::npos) {
+        throw invalid_argument("CtxMap is too large to be frozen.");
+      }
+      const std::uint64_t parent_hash = data->entries[stack.back()].hash;
+      const index_type value_begin    = static_cast<index_type>(data->values.size());
+      data->entries.push_back(
+            Entry{hash_component(parent_hash, parts[i].data(), parts[i].size()),
+                  stack.back(), static_cast<index_type>(data->components.size()),
+                  static_cast<index_type>(parts[i].size()), value_begin, value_begin});
+      data->components.append(parts[i]);
+
+      stack.push_back(static_cast<index_type>(data->entries.size() - 1));
+      stack_parts.push_back(parts[i]);
+    }
+
+    data->values.push_back(kv.value_raw());
+    data->value_entries.push_back(stack.back());
+  }
+  while (!stack_parts.empty()) pop_entry();
+  data->entries[0].value_end = static_cast<index_type>(data->values.size());
+
+  data->build_hash();
+  return data;
+}
+
+/** The data of an empty map, shared amongst all empty FrozenCtxMaps */
+const std::shared_ptr<FrozenCtxMapData>& empty_data() {
+  static const std::shared_ptr<FrozenCtxMapData> empty = make_data(CtxMap{});
+  return empty;
+}
+}  // namespace
+
+FrozenCtxMapData::index_type FrozenCtxMapData::candidate(std::uint64_t hash) const {
+  const std::uint32_t d = displacements[bucket_of(hash, displacements.size())];
+  return slots[mix(hash, d) % slots.size()];
+}
+
+void FrozenCtxMapData::build_hash() {
+  // Entries sharing a hash cannot be told apart by any displacement and an
+  // unlucky distribution may leave no displacement for a bucket. In both cases
+  // the path hashes are recomputed from a differently seeded root hash.
+  const size_t max_attempts = 16;
+  for (size_t attempt = 0; attempt < max_attempts; ++attempt) {
+    if (attempt > 0) rehash(mix(root_hash, attempt));
+    if (try_build_hash()) return;
+  }
+  throw internal_error("Could not construct perfect hash for FrozenCtxMap.");
+}
+
+void FrozenCtxMapData::rehash(std::uint64_t seed) {
+  // The parent of an entry always precedes it.
+  entries[0].hash = seed;
+  for (size_t i = 1; i < entries.size(); ++i) {
+    Entry& e = entries[i];
+    e.hash   = hash_component(entries[e.parent].hash,
+                            components.data() + e.component_begin, e.component_size);
+  }
+}
+
+bool FrozenCtxMapData::try_build_hash() {
+  const size_t n = entries.size();
+  {
+    std::vector<std::uint64_t> hashes(n);
+    for (size_t i = 0; i < n; ++i) hashes[i] = entries[i].hash;
+    std::sort(std::begin(hashes), std::end(hashes));
+    if (std::adjacent_find(std::begin(hashes), std::end(hashes)) != std::end(hashes)) {
+      return false;
+    }
+  }
+
+  // Hash and displace: The entries are distributed into buckets by their hash.
+  // Starting with the largest bucket a displacement is searched for each bucket,
+  // which maps all its entries to distinct free slots.
+  std::vector<std::vector<index_type>> buckets(n_buckets(n));
+  for (index_type i = 0; i < n; ++i) {
+    buckets[bucket_of(entries[i].hash, buckets.size())].push_back(i);
+  }
+
+  std::vector<index_type> order(buckets.size());
+  for (index_type b = 0; b < order.size(); ++b) order[b] = b;
+  std::stable_sort(std::begin(order), std::end(order),
+                   [&buckets](index_type a, index_type b) {
+                     return buckets[a].size() > buckets[b].size();
+                   });
+
+  // Even the last free slot is hit within this many displacements
+  // unless the distribution is very unlucky, which a reseed resolves.
+  const std::uint64_t max_displacement = std::min<std::uint64_t>(
+        std::numeric_limits<std::uint32_t>::max(), 64 * static_cast<std::uint64_t>(n));
+
+  displacements.assign(buckets.size(), 1);
+  slots.assign(n, npos);
+  std::vector<std::uint64_t> taken;
+  for (const index_type b : order) {
+    const std::vector<index_type>& bucket = buckets[b];
+    if (bucket.empty()) break;
+
+    // Displacement 0 is used for determining the bucket, so start at 1
+    for (std::uint64_t d = 1;; ++d) {
+      if (d > max_displacement) return false;
+
+      taken.clear();
+      bool fits = true;
+      for (const index_type entry : bucket) {
+        const std::uint64_t slot = mix(entries[entry].hash, d) % n;
+        if (slots[slot] != npos ||
+            std::find(std::begin(taken), std::end(taken), slot) != std::end(taken)) {
+          fits = false;
+          break;
+        }
+        taken.push_back(slot);
+      }
+      if (!fits) continue;
+
+      displacements[b] = static_cast<std::uint32_t>(d);
+      for (size_t i = 0; i < bucket.size(); ++i) {
+        slots[taken[i]] = bucket[i];
+      }
+      break;
+    }
+  }
+  return true;
+}
+
+//
+// -----------------------------------------------
+//
+
+CtxMapAccessor<true>* FrozenCtxMapIterator::operator->() const {
+  // Collect the entries from the current one up to (excluding) the root
+  // and assemble the key from their path components. The root of the
+  // range is exposed with the key "/".
+  m_chain.clear();
+  for (index_type entry = m_data->value_entries[m_value]; entry != m_root;
+       entry            = m_data->entries[entry].parent) {
+    m_chain.push_back(entry);
+  }
+
+  m_key.clear();
+  if (m_chain.empty()) m_key.push_back('/');
+  for (auto it = m_chain.rbegin(); it != m_chain.rend(); ++it) {
+    const FrozenCtxMapData::Entry& e = m_data->entries[*it];
+    m_key.push_back('/');
+    m_key.append(m_data->components, e.component_begin, e.component_size);
+  }
+
+  m_acc.reset(m_key, m_data->values[m_value]);
+  return &m_acc;
+}
+
+//
+// -----------------------------------------------
+//
+
+FrozenCtxMap::FrozenCtxMap() : m_data_ptr(empty_data()), m_root(0) {}
+
+FrozenCtxMap::FrozenCtxMap(const CtxMap& map)
+      : m_data_ptr(map.subtree_size("/") == 0 ? empty_data() : make_data(map)),
+        m_root(0) {}
+
+FrozenCtxMap::index_type FrozenCtxMap::find_entry(const key_view_type& path) const {
+  if (CtxMapKey::has_relative_components(path)) {
+    // Resolve "." and ".." first (we may not escape our root, just like
+    // the CtxMap::submap)
+    std::string normalised;
+    for (const auto& part : CtxMapKey::normalised_components(path)) {
+      normalised.append("/").append(part);
+    }
+    return find_entry(normalised);
+  }
+
+  // Hash the path relative to our root, skipping empty path parts
+  const Data& data   = *m_data_ptr;
+  std::uint64_t hash = data.entries[m_root].hash;
+  size_t depth       = 0;
+  for (size_t start = 0; start < path.size(); ++start) {
+    const size_t end = std::min(path.find('/', start), path.size());
+    if (end == start) continue;
+    hash  = hash_component(hash, path.data() + start, end - start);
+    start = end;
+    ++depth;
+  }
+  if (depth == 0) return m_root;
+
+  // The perfect hash yields the only candidate entry
+  const index_type entry = data.candidate(hash);
+  if (data.entries[entry].hash != hash) return Data::npos;
+
+  // Verify the candidate by walking from it up to our root,
+  // matching the path components from the back of the path.
+  index_type current = entry;
+  for (size_t end = path.size(); depth > 0; --depth) {
+    while (path[end - 1] == '/') --end;
+    size_t start = end;
+    while (start > 0 && path[start - 1] != '/') --start;
+
+    if (current == m_root || current == Data::npos) return Data::npos;
+    const Data::Entry& e = data.entries[current];
+    if (path.compare(start, end - start, data.components, e.component_begin,
+                     e.component_size) != 0) {
+      return Data::npos;
+    }
+    current = data.entries[current].parent;
+    end     = start;
+  }
+  return current == m_root ? entry : Data::npos;
+}
+
+const CtxMapValue* FrozenCtxMap::find_value(const key_view_type& key) const {
+  const index_type entry = find_entry(key);
+  if (entry == Data::npos) return nullptr;
+
+  // An entry holds a value if the first value of its range belongs to it
+  const Data::Entry& e = m_data_ptr->entries[entry];
+  if (e.value_begin == e.value_end || m_data_ptr->value_entries[e.value_begin] != entry) {
+    return nullptr;
+  }
+  return &m_data_ptr->values[e.value_begin];
+}
+
+size_t FrozenCtxMap::subtree_size(const key_view_type& path) const {
+  const index_type entry = find_entry(path);
+  if (entry == Data::npos) return 0;
+  const Data::Entry& e = m_data_ptr->entries[entry];
+  return e.value_end - e.value_begin;
+}
+
+FrozenCtxMap FrozenCtxMap::submap(const key_view_type& location) const {
+  const index_type entry = find_entry(location);
+  if (entry == Data::npos) return FrozenCtxMap();
+  return FrozenCtxMap(m_data_ptr, entry);
+}
+
+FrozenCtxMap::const_iterator FrozenCtxMap::cbegin(const key_view_type& path) const {
+  const index_type entry = find_entry(path);
+  if (entry == Data::npos) return const_iterator(m_data_ptr.get(), m_root, 0);
+  const Data::Entry& e = m_data_ptr->entries[entry];
+  return const_iterator(m_data_ptr.get(), entry, e.value_begin);
+}
+
+FrozenCtxMap::const_iterator FrozenCtxMap::cend(const key_view_type& path) const {
+  const index_type entry = find_entry(path);
+  if (entry == Data::npos) return const_iterator(m_data_ptr.get(), m_root, 0);
+  const Data::Entry& e = m_data_ptr->entries[entry];
+  return const_iterator(m_data_ptr.get(), entry, e.value_end);
+}
+
+std::ostream& operator<<(std::ostream& o, const FrozenCtxMap& map) {
+  int maxlen = 0;
+  for (auto& kv : map) {
+    maxlen = std::max(maxlen, static_cast<int>(kv.key().size()));
+  }
+
+  for (auto& kv : map) {
+    o << std::setw(maxlen) << std::left << kv.key() << "  :  " << kv.value_raw() << "\n";
+  }
+  return o;
+}
+
+}  // namespace ctx
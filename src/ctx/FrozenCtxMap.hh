@@ -0,0 +1,301 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#pragma once
+#include "CtxMapAccessor.hh"
+#include "CtxMapKey.hh"
+#include "CtxMapTree.hh"
+#include "CtxMapValue.hh"
+#include "exceptions.hh"
+#include "string_view.hh"
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ctx {
+
+// Forward-declare. Proper declaration in CtxMap.hh
+class CtxMap;
+
+/** The arrays behind a FrozenCtxMap. Defined in FrozenCtxMap.cc */
+struct FrozenCtxMapData;
+
+/** Iterator over the key-value pairs of a FrozenCtxMap
+ *
+ * Only reading access is possible. The values are visited in the order of
+ * the CtxMap::key_comparator_type. The key exposed by the accessor is built
+ * from the path components of the entries on dereference.
+ */
+class FrozenCtxMapIterator {
+ public:
+  typedef std::bidirectional_iterator_tag iterator_category;
+  typedef CtxMapAccessor<true> value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef value_type* pointer;
+  typedef value_type& reference;
+
+  typedef CtxMapValue entry_value_type;
+
+  /** Type used to index the arrays of the FrozenCtxMap */
+  typedef std::uint32_t index_type;
+
+  /** Construct an iterator to the value with index ``value`` of the data,
+   *  such that keys are made relative to the entry ``root``. */
+  FrozenCtxMapIterator(const FrozenCtxMapData* data, index_type root, index_type value)
+        : m_acc(), m_data(data), m_root(root), m_value(value), m_key(), m_chain() {}
+
+  FrozenCtxMapIterator() : FrozenCtxMapIterator(nullptr, 0, 0) {}
+
+  /** Dereference the iterator */
+  CtxMapAccessor<true>& operator*() const { return *operator->(); }
+
+  /** Obtain pointer to the accessor */
+  CtxMapAccessor<true>* operator->() const;
+
+  /** Prefix increment to the next key */
+  FrozenCtxMapIterator& operator++() {
+    ++m_value;
+    return *this;
+  }
+
+  /** Postfix increment to the next key */
+  FrozenCtxMapIterator operator++(int) {
+    FrozenCtxMapIterator copy(*this);
+    ++m_value;
+    return copy;
+  }
+
+  /** Prefix decrement to the previous key */
+  FrozenCtxMapIterator& operator--() {
+    --m_value;
+    return *this;
+  }
+
+  /** Postfix decrement to the previous key */
+  FrozenCtxMapIterator operator--(int) {
+    FrozenCtxMapIterator copy(*this);
+    --m_value;
+    return copy;
+  }
+
+  bool operator==(const FrozenCtxMapIterator& other) const {
+    return m_value == other.m_value;
+  }
+  bool operator!=(const FrozenCtxMapIterator& other) const {
+    return m_value != other.m_value;
+  }
+
+ private:
+  /** Accessor for the current value. It only refers to m_key and the value,
+   *  so it is pointed to them on each dereference. */
+  mutable CtxMapAccessor<true> m_acc;
+
+  /** The arrays we iterate over */
+  const FrozenCtxMapData* m_data;
+
+  /** The entry the iteration is rooted at. Keys are relative to it. */
+  index_type m_root;
+
+  /** The index of the current value */
+  index_type m_value;
+
+  /** The key of the current value relative to m_root */
+  mutable std::string m_key;
+
+  /** Scratch space for the entries from the current one up to m_root */
+  mutable std::vector<index_type> m_chain;
+};
+
+/** A read-only snapshot of the contents of a CtxMap.
+ *
+ * The FrozenCtxMap offers the same const interface for reading values
+ * as the CtxMap (``at``, ``at_ptr``, ``exists``, ``begin``, ``end``, ``submap``, ...),
+ * but stores all data in a few contiguous arrays instead of a tree of nodes:
+ *   - All paths of the map (keys with values as well as the inner paths only
+ *     leading to deeper keys) are stored as a flat array of entries in iteration
+ *     order. The keys are front-coded on the level of path components, i.e. each
+ *     entry only stores its last path component (in one common character buffer)
+ *     and refers to the entry of its parent for the remaining prefix.
+ *   - The values are stored in a dense array in iteration order, such that
+ *     the values below a path are a contiguous range. The bounds of this
+ *     range are precomputed for each entry.
+ *   - Entries are looked up via a minimal perfect hash of their full path.
+ *
+ * Use it for data which is no longer modified, e.g. after input parsing:
+ * ```
+ * CtxMap map = parse_input();
+ * const FrozenCtxMap frozen = map.freeze();
+ * frozen.at<double>("scf/convergence");
+ * ```
+ *
+ * Like for the copy constructor of the CtxMap only the pointers to the
+ * values are copied upon freezing, so both maps refer to the same objects.
+ * Copies and submaps of a FrozenCtxMap share the same arrays, so they are cheap.
+ */
+class FrozenCtxMap {
+ public:
+  /** Custom comparator to sort key strings. Makes sure that slashes "/"
+   *  sort before any other character. */
+  typedef CtxMapKeyComparator key_comparator_type;
+
+  typedef CtxMapValue entry_value_type;
+
+  /** Precompiled key type, see CtxMapKey for details */
+  typedef CtxMapKey Key;
+
+  typedef FrozenCtxMapIterator const_iterator;
+  typedef FrozenCtxMapIterator iterator;
+
+  /** Construct an empty frozen map */
+  FrozenCtxMap();
+
+  /** Freeze the current contents of a CtxMap (or a submap).
+   *  Equivalent to ``map.freeze()``. */
+  explicit FrozenCtxMap(const CtxMap& map);
+
+  /** \name Access to values */
+  ///@{
+  /** Return a reference to the value at a given key with the specified type.
+   *
+   * Throws out_of_range if the key does not exist and type_mismatch if
+   * the type is wrong. */
+  template <typename T>
+  const T& at(const key_view_type& key) const {
+    return at_raw_value(key).get<T>();
+  }
+
+  /** Return a reference to the value at a given precompiled key */
+  template <typename T>
+  const T& at(const Key& key) const {
+    return at_raw_value(key).get<T>();
+  }
+
+  /** Return the value at a key or the provided default if the key does not exist */
+  template <typename T>
+  const T& at(const key_view_type& key, const T& default_value) const {
+    const CtxMapValue* value = find_value(key);
+    return value == nullptr ? default_value : value->get<T>();
+  }
+
+  /** Return a pointer to the value of a specific key */
+  template <typename T>
+  std::shared_ptr<const T> at_ptr(const key_view_type& key) const {
+    return at_raw_value(key).get_ptr<T>();
+  }
+
+  /** Return a pointer to the value of a specific precompiled key */
+  template <typename T>
+  std::shared_ptr<const T> at_ptr(const Key& key) const {
+    return at_raw_value(key).get_ptr<T>();
+  }
+
+  /** Return a pointer to the value of a key or the provided default
+   *  if the key does not exist */
+  template <typename T>
+  std::shared_ptr<const T> at_ptr(const key_view_type& key,
+                                  std::shared_ptr<const T> default_ptr) const {
+    const CtxMapValue* value = find_value(key);
+    return value == nullptr ? default_ptr : value->get_ptr<T>();
+  }
+
+  /** Return the CtxMapValue object representing the data behind the specified key
+   *
+   * \note This is an advanced method. Use only if you know what you are doing.
+   * */
+  const CtxMapValue& at_raw_value(const key_view_type& key) const {
+    const CtxMapValue* value = find_value(key);
+    if (value == nullptr) {
+      throw out_of_range("Key '" + std::string(key) + "' is not known.");
+    }
+    return *value;
+  }
+
+  /** Return the CtxMapValue object representing the data behind the precompiled key
+   *
+   * \note This is an advanced method. Use only if you know what you are doing.
+   * */
+  const CtxMapValue& at_raw_value(const Key& key) const {
+    const CtxMapValue* value = find_value(key);
+    if (value == nullptr) {
+      throw out_of_range("Key '" + key.str() + "' is not known.");
+    }
+    return *value;
+  }
+  ///@}
+
+  /** Check weather a key exists */
+  bool exists(const key_view_type& key) const { return find_value(key) != nullptr; }
+
+  /** Check weather a precompiled key exists */
+  bool exists(const Key& key) const { return find_value(key) != nullptr; }
+
+  /** Return the number of keys stored under a path (see CtxMap::subtree_size) */
+  size_t subtree_size(const key_view_type& path) const;
+
+  /** Return a string which describes the type of the stored data */
+  std::string type_name_of(const key_view_type& key) const {
+    return at_raw_value(key).type_name();
+  }
+
+  /** Get a submap pointing at a different location (see CtxMap::submap).
+   *  The submap shares the data with this object. */
+  FrozenCtxMap submap(const key_view_type& location) const;
+
+  /** \name Iterators */
+  ///@{
+  /** Return an iterator to the beginning of the map or the beginning of a
+   *  specified subpath (see CtxMap::begin). */
+  const_iterator begin(const key_view_type& path = "/") const { return cbegin(path); }
+  const_iterator cbegin(const key_view_type& path = "/") const;
+
+  /** Returns the matching end iterator to begin() or cbegin(). */
+  const_iterator end(const key_view_type& path = "/") const { return cend(path); }
+  const_iterator cend(const key_view_type& path = "/") const;
+  ///@}
+
+ private:
+  typedef FrozenCtxMapData Data;
+  typedef FrozenCtxMapIterator::index_type index_type;
+
+  /** Construct a view into data rooted at the entry root */
+  FrozenCtxMap(std::shared_ptr<const Data> data_ptr, index_type root)
+        : m_data_ptr(std::move(data_ptr)), m_root(root) {}
+
+  /** Return the index of the entry of a path relative to m_root
+   *  or FrozenCtxMapData::npos if the path does not exist */
+  index_type find_entry(const key_view_type& path) const;
+
+  /** Return the value stored under a key or nullptr if no such value */
+  const CtxMapValue* find_value(const key_view_type& key) const;
+
+  /** Return the value stored under a precompiled key or nullptr if no such value */
+  const CtxMapValue* find_value(const Key& key) const { return find_value(key.str()); }
+
+  /** The shared arrays */
+  std::shared_ptr<const Data> m_data_ptr;
+
+  /** The entry this map is rooted at */
+  index_type m_root;
+};
+
+std::ostream& operator<<(std::ostream& o, const FrozenCtxMap& map);
+
+}  // namespace ctx
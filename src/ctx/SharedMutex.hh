@@ -0,0 +1,94 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+namespace ctx {
+
+/** A small reader/writer lock.
+ *
+ * Any number of readers (lock_shared) or a single writer (lock) may hold the
+ * lock. Writers take precedence: Once a writer waits for the lock, no new
+ * readers are admitted. Waiting is done by spinning and yielding, so the lock
+ * is meant for short critical sections like the lookups in a ConcurrentCtxMap.
+ *
+ * The class fulfils the requirements of the standard's SharedMutex, such that
+ * it can be used with std::unique_lock and with the SharedLock guard below.
+ */
+class SharedMutex {
+ public:
+  SharedMutex() : m_state(0) {}
+  SharedMutex(const SharedMutex&) = delete;
+  SharedMutex& operator=(const SharedMutex&) = delete;
+
+  /** Acquire exclusive ownership */
+  void lock() {
+    // Announce ourselves, such that no new readers enter ...
+    std::uint32_t state = m_state.load(std::memory_order_relaxed);
+    while ((state & writer_bit) != 0 ||
+           !m_state.compare_exchange_weak(state, state | writer_bit,
+                                          std::memory_order_acquire)) {
+      std::this_thread::yield();
+      state = m_state.load(std::memory_order_relaxed);
+    }
+
+    // ... and wait for the readers to leave
+    while ((m_state.load(std::memory_order_acquire) & ~writer_bit) != 0) {
+      std::this_thread::yield();
+    }
+  }
+
+  /** Release exclusive ownership */
+  void unlock() { m_state.store(0, std::memory_order_release); }
+
+  /** Acquire shared ownership */
+  void lock_shared() {
+    std::uint32_t state = m_state.load(std::memory_order_relaxed);
+    while ((state & writer_bit) != 0 ||
+           !m_state.compare_exchange_weak(state, state + 1, std::memory_order_acquire)) {
+      std::this_thread::yield();
+      state = m_state.load(std::memory_order_relaxed);
+    }
+  }
+
+  /** Release shared ownership */
+  void unlock_shared() { m_state.fetch_sub(1, std::memory_order_release); }
+
+ private:
+  /** Bit of m_state signalling a (waiting) writer */
+  static constexpr std::uint32_t writer_bit = std::uint32_t(1) << 31;
+
+  /** Writer bit and number of readers holding the lock */
+  std::atomic<std::uint32_t> m_state;
+};
+
+/** RAII guard for shared ownership of a SharedMutex (like the C++14 std::shared_lock) */
+class SharedLock {
+ public:
+  explicit SharedLock(SharedMutex& mutex) : m_mutex(mutex) { m_mutex.lock_shared(); }
+  ~SharedLock() { m_mutex.unlock_shared(); }
+  SharedLock(const SharedLock&) = delete;
+  SharedLock& operator=(const SharedLock&) = delete;
+
+ private:
+  SharedMutex& m_mutex;
+};
+
+}  // namespace ctx
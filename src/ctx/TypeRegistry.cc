@@ -0,0 +1,97 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "TypeRegistry.hh"
+#include "demangle.hh"
+#include "exceptions.hh"
+#include <ostream>
+
+namespace ctx {
+
+constexpr TypeRegistry::id_type TypeRegistry::no_type;
+
+TypeRegistry& TypeRegistry::instance() {
+  static TypeRegistry registry;
+  return registry;
+}
+
+TypeRegistry::TypeRegistry() : m_mutex{}, m_entries{Entry{"", "", nullptr}}, m_ids{} {
+  register_default_printer<bool>();
+  register_default_printer<char>();
+  register_default_printer<int>();
+  register_default_printer<long>();
+  register_default_printer<long long>();
+  register_default_printer<unsigned char>();
+  register_default_printer<unsigned int>();
+  register_default_printer<unsigned long>();
+  register_default_printer<unsigned long long>();
+  register_default_printer<float>();
+  register_default_printer<double>();
+  register_default_printer<long double>();
+  register_default_printer<std::string>();
+}
+
+TypeRegistry::id_type TypeRegistry::register_type(const std::type_info& type) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_ids.find(std::type_index(type));
+  if (it != std::end(m_ids)) return it->second;
+
+  const id_type id = static_cast<id_type>(m_entries.size());
+  m_entries.push_back(Entry{type.name(), demangle(type), nullptr});
+  m_ids.emplace(std::type_index(type), id);
+  return id;
+}
+
+const TypeRegistry::Entry& TypeRegistry::entry(id_type id) const {
+  if (id >= m_entries.size()) {
+    throw internal_error("Type id " + std::to_string(id) + " is not registered.");
+  }
+  return m_entries[id];
+}
+
+const std::string& TypeRegistry::name(id_type id) const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return entry(id).name;
+}
+
+const std::string& TypeRegistry::raw_name(id_type id) const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return entry(id).raw_name;
+}
+
+void TypeRegistry::register_printer(id_type id, printer_type printer) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (id == no_type || id >= m_entries.size()) {
+    throw invalid_argument("Cannot register a printer for type id " + std::to_string(id) +
+                           ".");
+  }
+  m_entries[id].printer = std::move(printer);
+}
+
+bool TypeRegistry::print(std::ostream& o, id_type id, const void* ptr) const {
+  printer_type printer;
+  {
+    // Copy the printer, such that it may itself use the registry
+    std::lock_guard<std::mutex> lock(m_mutex);
+    printer = entry(id).printer;
+  }
+  if (!printer) return false;
+  printer(o, ptr);
+  return true;
+}
+
+}  // namespace ctx
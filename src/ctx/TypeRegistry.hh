@@ -0,0 +1,131 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#pragma once
+#include <deque>
+#include <functional>
+#include <ostream>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+
+namespace ctx {
+
+/** \brief Global registry of the types stored inside a CtxMap.
+ *
+ * Each type is assigned a compact integer id on first use, such that
+ * checking the type of a CtxMapValue is a single integer comparison.
+ * The registry furthermore caches the demangled type names and holds
+ * the functions used to print values of a type (see print).
+ *
+ * The type T and const T share the same id.
+ */
+class TypeRegistry {
+ public:
+  /** Type of the integer type ids */
+  typedef unsigned int id_type;
+
+  /** Type of a function printing the object behind a pointer */
+  typedef std::function<void(std::ostream&, const void*)> printer_type;
+
+  /** Id representing "no type", e.g. the type of an empty CtxMapValue */
+  static constexpr id_type no_type = 0;
+
+  /** Return the global registry object */
+  static TypeRegistry& instance();
+
+  /** Return the id of the type T. The type is registered if needed.
+   *
+   * The id is computed only once for each type, so this only costs
+   * reading a static variable. */
+  template <typename T>
+  static id_type id_of() {
+    static const id_type id =
+          instance().register_type(typeid(typename std::remove_cv<T>::type));
+    return id;
+  }
+
+  /** Register a type (if needed) and return its id */
+  id_type register_type(const std::type_info& type);
+
+  /** Return the demangled name of the type with the given id */
+  const std::string& name(id_type id) const;
+
+  /** Return the raw (mangled) name of the type with the given id */
+  const std::string& raw_name(id_type id) const;
+
+  /** Register a function used to print values of type T */
+  template <typename T>
+  void register_printer(std::function<void(std::ostream&, const T&)> printer) {
+    register_printer(id_of<T>(), [printer](std::ostream& o, const void* ptr) {
+      printer(o, *static_cast<const T*>(ptr));
+    });
+  }
+
+  /** Register to print values of type T using their operator<< */
+  template <typename T>
+  void register_printer() {
+    register_printer<T>([](std::ostream& o, const T& t) { o << t; });
+  }
+
+  /** Register a function used to print values of the type with the given id */
+  void register_printer(id_type id, printer_type printer);
+
+  /** Print the object of the type with given id behind the pointer ptr.
+   *
+   * Returns false (and prints nothing) if no printer is known for the type. */
+  bool print(std::ostream& o, id_type id, const void* ptr) const;
+
+ private:
+  /** Information stored about each type */
+  struct Entry {
+    std::string raw_name;
+    std::string name;
+    printer_type printer;
+  };
+
+  /** Set up the registry and the printers for the elementary types */
+  TypeRegistry();
+
+  /** Register to print values of type T using their operator<<. Unlike
+   *  register_printer this does not use instance(), so it can be used
+   *  during construction. */
+  template <typename T>
+  void register_default_printer() {
+    register_printer(register_type(typeid(T)), [](std::ostream& o, const void* ptr) {
+      o << *static_cast<const T*>(ptr);
+    });
+  }
+
+  /** Return the entry for an id. Needs m_mutex to be locked. */
+  const Entry& entry(id_type id) const;
+
+  /** Mutex guarding all members below */
+  mutable std::mutex m_mutex;
+
+  /** The entries, indexed by type id. A deque, such that
+   *  references to the names stay valid upon registration. */
+  std::deque<Entry> m_entries;
+
+  /** Map from the types to their ids */
+  std::unordered_map<std::type_index, id_type> m_ids;
+};
+
+}  // namespace ctx
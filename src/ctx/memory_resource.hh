@@ -0,0 +1,147 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#pragma once
+#include <ctx/config.hh>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+
+// Which memory_resource is used depends on how ctx has been built
+// (see config.hh), not on the language mode of the code including this.
+#ifdef CTX_HAVE_MEMORY_RESOURCE
+#if __cplusplus < 201703L
+#error "ctx has been built in C++17 mode, so code using it needs C++17 as well."
+#endif
+#include <memory_resource>
+#endif
+
+namespace ctx {
+
+#ifdef CTX_HAVE_MEMORY_RESOURCE
+/** The interface of the resources providing memory to a CtxMap */
+typedef std::pmr::memory_resource memory_resource;
+#else
+/** The interface of the resources providing memory to a CtxMap.
+ *
+ * Before C++17 this is a replacement of std::pmr::memory_resource with the
+ * same interface, such that resources can be implemented in the same way
+ * in both cases.
+ */
+class memory_resource {
+ public:
+  virtual ~memory_resource() = default;
+
+  void* allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t)) {
+    return do_allocate(bytes, alignment);
+  }
+
+  void deallocate(void* p, std::size_t bytes,
+                  std::size_t alignment = alignof(std::max_align_t)) {
+    do_deallocate(p, bytes, alignment);
+  }
+
+  bool is_equal(const memory_resource& other) const noexcept {
+    return do_is_equal(other);
+  }
+
+ private:
+  virtual void* do_allocate(std::size_t bytes, std::size_t alignment)          = 0;
+  virtual void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) = 0;
+  virtual bool do_is_equal(const memory_resource& other) const noexcept       = 0;
+};
+#endif
+
+namespace detail {
+/** Allocate memory from the global operator new, honouring alignments beyond
+ *  that of std::max_align_t (which operator new only does from C++17 on).
+ *
+ * For such alignments more memory is requested and the pointer returned by
+ * operator new is stored right before the aligned block.
+ */
+inline void* heap_allocate(std::size_t bytes, std::size_t alignment) {
+  if (alignment <= alignof(std::max_align_t)) return ::operator new(bytes);
+  if (bytes > std::numeric_limits<std::size_t>::max() - alignment - sizeof(void*)) {
+    throw std::bad_alloc();
+  }
+  void* raw = ::operator new(bytes + alignment + sizeof(void*));
+  const std::uintptr_t first = reinterpret_cast<std::uintptr_t>(raw) + sizeof(void*);
+  void* aligned = reinterpret_cast<void*>((first + alignment - 1) & ~(alignment - 1));
+  static_cast<void**>(aligned)[-1] = raw;
+  return aligned;
+}
+
+/** Free memory obtained from heap_allocate with the same alignment */
+inline void heap_deallocate(void* p, std::size_t alignment) noexcept {
+  if (alignment <= alignof(std::max_align_t)) {
+    ::operator delete(p);
+  } else {
+    ::operator delete(static_cast<void**>(p)[-1]);
+  }
+}
+}  // namespace detail
+
+/** Allocator obtaining memory from a memory_resource or, if the resource
+ *  is a nullptr, from the global operator new. In both cases the memory
+ *  is aligned as required by T, even if T is over-aligned. */
+template <typename T>
+class ResourceAllocator {
+ public:
+  typedef T value_type;
+
+  explicit ResourceAllocator(memory_resource* resource = nullptr) noexcept
+        : m_resource{resource} {}
+
+  template <typename U>
+  ResourceAllocator(const ResourceAllocator<U>& other) noexcept
+        : m_resource{other.resource()} {}
+
+  T* allocate(std::size_t n) {
+    if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) throw std::bad_alloc();
+    if (m_resource == nullptr) {
+      return static_cast<T*>(detail::heap_allocate(n * sizeof(T), alignof(T)));
+    }
+    return static_cast<T*>(m_resource->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T* p, std::size_t n) noexcept {
+    if (m_resource == nullptr) {
+      detail::heap_deallocate(p, alignof(T));
+    } else {
+      m_resource->deallocate(p, n * sizeof(T), alignof(T));
+    }
+  }
+
+  /** The resource memory is obtained from */
+  memory_resource* resource() const noexcept { return m_resource; }
+
+ private:
+  memory_resource* m_resource;
+};
+
+template <typename T, typename U>
+bool operator==(const ResourceAllocator<T>& lhs, const ResourceAllocator<U>& rhs) {
+  return lhs.resource() == rhs.resource();
+}
+
+template <typename T, typename U>
+bool operator!=(const ResourceAllocator<T>& lhs, const ResourceAllocator<U>& rhs) {
+  return !(lhs == rhs);
+}
+
+}  // namespace ctx
@@ -0,0 +1,44 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#pragma once
+#include <ctx/config.hh>
+#include <string>
+
+// Note: This header deliberately does not need C++11, since it is
+//       used by libctx/params.h as well.
+
+// Whether keys are passed as views depends on how ctx has been built
+// (see config.hh), not on the language mode of the code including this.
+#ifdef CTX_HAVE_STRING_VIEW
+#if __cplusplus < 201703L
+#error "ctx has been built in C++17 mode, so code using it needs C++17 as well."
+#endif
+#include <string_view>
+#endif
+
+namespace ctx {
+
+#ifdef CTX_HAVE_STRING_VIEW
+/** The type used to pass keys to lookup functions */
+typedef std::string_view key_view_type;
+#else
+/** The type used to pass keys to lookup functions */
+typedef std::string key_view_type;
+#endif
+
+}  // namespace ctx
@@ -81,7 +81,16 @@ class context {
 
   /** Obtain an element from the context. */
   template <typename T>
-  rc_ptr<T> get(const std::string& key) {
+  rc_ptr<T> get(const ctx::key_view_type& key) {
+    return static_cast<rc_ptr<T>>(m_map_ptr->at_ptr<T>(key));
+  }
+
+  /** Obtain an element from the context using a precompiled key.
+   *
+   * This avoids parsing the key on each call, which is useful for keys
+   * which are looked up very often. */
+  template <typename T>
+  rc_ptr<T> get(const CtxMap::Key& key) {
     return static_cast<rc_ptr<T>>(m_map_ptr->at_ptr<T>(key));
   }
 
@@ -101,18 +110,23 @@ class context {
    */
   void copy(const std::string& key_from, context& to, const std::string& key_to);
 
-  /** Move an object from one key to another */
+  /** Move an object from one key to another.
+   *
+   * If key_from is a path rather than an object, all objects below the
+   * path are moved at once (see CtxMap::rename_subtree) and replace the
+   * objects below key_to.
+   */
   void move(const std::string& key_from, const std::string& key_to);
 
-  /** Move an object from one context to another */
-  void move(const std::string& key_from, context& to, const std::string& key_to) {
-    to.m_map_ptr->update(key_to, m_map_ptr->at_raw_value(key_from));
-    m_map_ptr->erase(key_from);
-  }
+  /** Move an object (or all objects below a path) from one context to another */
+  void move(const std::string& key_from, context& to, const std::string& key_to);
   ///@}
 
   /** If the key exists return true, else false */
-  bool key_exists(const std::string& key) const { return m_map_ptr->exists(key); }
+  bool key_exists(const ctx::key_view_type& key) const { return m_map_ptr->exists(key); }
+
+  /** If the precompiled key exists return true, else false */
+  bool key_exists(const CtxMap::Key& key) const { return m_map_ptr->exists(key); }
 
   /** Return the current location of the context relative to the root storage */
   const std::string& whereami() const { return m_location; }
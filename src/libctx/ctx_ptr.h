@@ -19,16 +19,24 @@
 
 namespace libctx {
 
-/** Class representing a pointer to an object in the context */
+/** Class representing a pointer to an object in the context
+ *
+ * The pointer follows updates of the key in the context, i.e. after
+ * ``ctx.update(key, ...)`` it points to the new object.
+ *
+ * \note Unlike a pointer obtained via ``ctx.get``, it does not keep the
+ * object alive: Once the key is erased from the context, dereferencing the
+ * pointer throws a ctx::out_of_range until the key is stored again.
+ */
 template <typename T>
 class ctx_ptr {
  public:
-  ctx_ptr(context& ctx, const std::string& key) : m_ptr(ctx.get<T>(key)) {}
-  T& operator*() const { return *m_ptr; }
-  T* operator->() const { return m_ptr.get(); }
+  ctx_ptr(context& ctx, const std::string& key) : m_handle(ctx.map().handle<T>(key)) {}
+  T& operator*() const { return m_handle.get(); }
+  T* operator->() const { return &m_handle.get(); }
 
  private:
-  rc_ptr<T> m_ptr;
+  ctx::CtxMapHandle<T> m_handle;
 };
 
 }  // namespace libctx
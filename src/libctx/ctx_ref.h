@@ -19,20 +19,28 @@
 
 namespace libctx {
 
-/** Class representing a reference to an object in the context */
+/** Class representing a reference to an object in the context
+ *
+ * The reference follows updates of the key in the context, i.e. after
+ * ``ctx.update(key, ...)`` it refers to the new object.
+ *
+ * \note Unlike a pointer obtained via ``ctx.get``, it does not keep the
+ * object alive: Once the key is erased from the context, converting the
+ * reference throws a ctx::out_of_range until the key is stored again.
+ */
 template <typename T>
 class ctx_ref {
  public:
-  ctx_ref(context& ctx, const std::string& key) : m_ptr(ctx.get<T>(key)) {}
+  ctx_ref(context& ctx, const std::string& key) : m_handle(ctx.map().handle<T>(key)) {}
 
   /** Implicit conversion to const T& */
-  operator const T&() const { return *m_ptr; }
+  operator const T&() const { return m_handle.get(); }
 
   /** Implicit conversion to T& */
-  operator T&() { return *m_ptr; }
+  operator T&() { return m_handle.get(); }
 
  private:
-  rc_ptr<T> m_ptr;
+  ctx::CtxMapHandle<T> m_handle;
 };
 
 }  // namespace libctx
@@ -17,6 +17,7 @@
 #pragma once
 
 #include <ctx/demangle.hh>
+#include <ctx/string_view.hh>
 #include <iostream>
 #include <map>
 #include <sstream>
@@ -75,7 +76,7 @@ class params {
   /**	\brief Returns true if a value with a given key exists,
           false otherwise.
    **/
-  bool key_exists(const std::string& key) const;
+  bool key_exists(const ctx::key_view_type& key) const;
   ///@}
 
   /** \brief Return a subtree (const version)
@@ -95,7 +96,7 @@ class params {
   const std::string& get(const std::string& key) const { return get_str(key); }
 
   /** Return the value indentified by a key as a plain string. */
-  const std::string& get_str(const std::string& key) const;
+  const std::string& get_str(const ctx::key_view_type& key) const;
 
   /**  Convert the string value referenced by key to the requestet type ``T``
    *   and return the result.
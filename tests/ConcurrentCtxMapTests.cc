@@ -0,0 +1,376 @@
+//
+// Copyright 2018 Michael F. Herbst and contributors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include <atomic>
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <ctx/ConcurrentCtxMap.hh>
+#include <ctx/CtxMap.hh>
+#include <thread>
+#include <vector>
+
+namespace ctx {
+namespace tests {
+
+TEST_CASE("ConcurrentCtxMap tests", "[concurrent]") {
+  SECTION("Can add, read and erase data") {
+    ConcurrentCtxMap m;
+    CHECK(m.n_shards() == ConcurrentCtxMap::default_n_shards);
+
+    m.update("scf/energy", -1.5);
+    m.update("/grid/./n_points", 1000);
+    m.update("props/name", std::string("water"));
+    m.update("/", 42);
+
+    CHECK(m.at<double>("/scf/energy") == -1.5);
+    CHECK(m.at<int>("grid/n_points") == 1000);
+    CHECK(m.at<std::string>("props/../props/name") == "water");
+    CHECK(m.at<int>("/") == 42);
+    CHECK(*m.at_ptr<std::string>("props/name") == "water");
+    CHECK(m.at<int>("grid/missing", 3) == 3);
+    CHECK_THROWS_AS(m.at<int>("grid/missing"), out_of_range);
+    CHECK_THROWS_AS(m.at<int>("scf/energy"), type_mismatch);
+    CHECK(m.exists("scf/energy"));
+    CHECK_FALSE(m.exists("scf/missing"));
+    CHECK(m.subtree_size("/") == 4);
+
+    // Pointers stay valid after the key is replaced
+    auto ptr = m.at_ptr<std::string>("props/name");
+    m.update("props/name", std::string("ammonia"));
+    CHECK(*ptr == "water");
+    CHECK(m.at<std::string>("props/name") == "ammonia");
+
+    CHECK(m.erase("scf/energy") == 1);
+    CHECK(m.erase("scf/energy") == 0);
+    CHECK_FALSE(m.exists("scf/energy"));
+    CHECK(m.erase_recursive("grid") == 1);
+    CHECK(m.subtree_size("/") == 2);
+
+    m.clear();
+    CHECK(m.subtree_size("/") == 0);
+    CHECK_FALSE(m.exists("/"));
+    CHECK_THROWS_AS(ConcurrentCtxMap(0), invalid_argument);
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check submaps are views") {
+    ConcurrentCtxMap m(4);
+    ConcurrentCtxMap sub = m.submap("tree/sub");
+    sub.update("a", 1);
+    sub.update("b/c", 2);
+    m.update("tree/other", 3);
+
+    CHECK(m.at<int>("tree/sub/a") == 1);
+    CHECK(m.at<int>("tree/sub/b/c") == 2);
+    CHECK(sub.at<int>("../b/c") == 2);
+    CHECK_FALSE(sub.exists("../../tree/other"));
+    CHECK(sub.subtree_size("/") == 2);
+    CHECK(m.subtree_size("tree") == 3);
+    CHECK(sub.submap("b").at<int>("c") == 2);
+
+    // Clearing the submap only clears the submap
+    sub.clear();
+    CHECK(sub.subtree_size("/") == 0);
+    CHECK(m.at<int>("tree/other") == 3);
+
+    // Copies refer to the same data
+    ConcurrentCtxMap copy(m);
+    copy.update("tree/new", 4);
+    CHECK(m.at<int>("tree/new") == 4);
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check the epoch manager tracks the readers") {
+    EpochManager epochs;
+    CHECK(epochs.passed(epochs.advance()));
+
+    // A guard of the calling thread itself is not waited for
+    {
+      EpochManager::Guard guard(epochs);
+      EpochManager::Guard nested(epochs);
+      CHECK(epochs.passed(epochs.advance()));
+    }
+
+    std::atomic<bool> entered{false};
+    std::atomic<bool> release{false};
+    std::atomic<bool> passed_in_guard{true};
+    std::thread reader([&] {
+      EpochManager::Guard guard(epochs);
+      entered = true;
+      while (!release) std::this_thread::yield();
+
+      // The writer's epoch has advanced after the guard was entered
+      passed_in_guard = epochs.passed(epochs.advance());
+    });
+    while (!entered) std::this_thread::yield();
+    const uint64_t epoch = epochs.advance();
+    CHECK_FALSE(epochs.passed(epoch));
+
+    // Readers of other managers are not tracked
+    EpochManager other;
+    CHECK(other.passed(other.advance()));
+
+    release = true;
+    epochs.wait_for(epoch);
+    reader.join();
+    CHECK(passed_in_guard);
+    CHECK(epochs.passed(epochs.advance()));
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check replaced values are released") {
+    ConcurrentCtxMap m(1);
+    auto object = std::make_shared<std::string>("large object");
+    std::weak_ptr<std::string> observer{object};
+    m.update("obj", std::move(object));
+    std::shared_ptr<const std::string> ptr = m.at_ptr<std::string>("obj");
+    CHECK(*ptr == "large object");
+
+    // The replaced value is kept by the other tree until the next write
+    m.update("obj", 1);
+    CHECK(m.at<int>("obj") == 1);
+    ptr.reset();
+    CHECK_FALSE(observer.expired());
+    m.update("other", 2);
+    CHECK(observer.expired());
+
+    object   = std::make_shared<std::string>("another object");
+    observer = object;
+    m.update("obj", std::move(object));
+    CHECK(m.erase("obj") == 1);
+    CHECK_FALSE(observer.expired());
+    m.reclaim();
+    CHECK(observer.expired());
+    CHECK(m.at<int>("other") == 2);
+    CHECK(m.subtree_size("/") == 1);
+
+    // Nothing is pending for the next writer
+    m.update("obj", 3);
+    CHECK(m.at<int>("obj") == 3);
+    CHECK(m.subtree_size("/") == 2);
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check atomic slots") {
+    ConcurrentCtxMap m;
+    ConcurrentCtxMap sub = m.submap("scf");
+    sub.update_atomic("energy", -1.5);
+    CHECK(m.at_atomic<double>("scf/energy") == -1.5);
+    m.update_atomic("scf/energy", -2.5);
+    CHECK(sub.at_atomic<double>("energy") == -2.5);
+    CHECK(m.subtree_size("/") == 1);
+    CHECK_THROWS_AS(m.at_atomic<int>("scf/energy"), type_mismatch);
+    CHECK_THROWS_AS(m.at_atomic<int>("scf/missing"), out_of_range);
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check batched updates") {
+    ConcurrentCtxMap m(4);
+    m.update("scf/a", 0);
+    m.update("scf/b", 0);
+    m.update("grid/n", 10);
+
+    // Readers see all or none of the modifications of a subtree
+    std::atomic<bool> done{false};
+    std::atomic<int> n_inconsistent{0};
+    std::thread reader([&]() {
+      while (!done) {
+        // A batch sets a = k and b = -k, so seeing the new a with the old b
+        // (or vice versa) means part of the batch was visible.
+        const int a_before = m.at<int>("scf/a");
+        const int b        = m.at<int>("scf/b");
+        const int a_after  = m.at<int>("scf/a");
+        if (a_before > -b || -b > a_after) ++n_inconsistent;
+      }
+    });
+    for (int k = 1; k <= 100; ++k) {
+      CtxMapBatch batch = m.submap("scf").batch();
+      batch.update("a", k);
+      batch.update("b", -k);
+      batch.update("k" + std::to_string(k), k);
+      batch.update("/grid/n", k);
+      batch.commit();
+    }
+    done = true;
+    reader.join();
+    CHECK(n_inconsistent == 0);
+
+    CHECK(m.at<int>("scf/a") == 100);
+    CHECK(m.at<int>("scf/b") == -100);
+    CHECK(m.at<int>("scf/grid/n") == 100);
+    CHECK(m.at<int>("grid/n") == 10);
+    CHECK(m.subtree_size("scf") == 103);
+
+    CtxMapBatch batch = m.batch();
+    for (int k = 1; k <= 100; ++k) batch.erase("scf/k" + std::to_string(k));
+    batch.erase("grid/n");
+    batch.update("props/dipole", 1.5);
+    batch.commit();
+    CHECK(m.subtree_size("/") == 4);
+    CHECK(m.at<double>("props/dipole") == 1.5);
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check batches spanning several shards are visible at once") {
+    ConcurrentCtxMap m(4);
+    const int n_trees = 8;  // Top-level subtrees, so some end up in other shards
+    auto tree_key     = [](int i) { return "/tree" + std::to_string(i) + "/k"; };
+    for (int i = 0; i < n_trees; ++i) m.update(tree_key(i), 0);
+
+    // Each batch sets all keys to k, so reading a value smaller than one
+    // read before means part of a batch was visible.
+    std::atomic<bool> done{false};
+    std::atomic<int> n_inconsistent{0};
+    std::thread reader([&]() {
+      while (!done) {
+        int last = 0;
+        for (int i = 0; i < 2 * n_trees; ++i) {
+          const int j     = i < n_trees ? i : 2 * n_trees - 1 - i;
+          const int value = m.at<int>(tree_key(j));
+          if (value < last) ++n_inconsistent;
+          last = value;
+        }
+        if (m.subtree_size("/") % n_trees != 0) ++n_inconsistent;
+      }
+    });
+    for (int k = 1; k <= 200; ++k) {
+      CtxMapBatch batch = m.batch();
+      for (int i = 0; i < n_trees; ++i) {
+        batch.update(tree_key(i), k);
+        if (k % 10 == 0) batch.update(tree_key(i) + std::to_string(k), k);
+      }
+      batch.commit();
+    }
+    done = true;
+    reader.join();
+    CHECK(n_inconsistent == 0);
+    CHECK(m.subtree_size("/") == static_cast<size_t>(n_trees * 21));
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check publishing subtrees built elsewhere") {
+    ConcurrentCtxMap m(4);
+    const int n_keys = 50;
+    auto make_staging = [&](int version) {
+      // Each version uses other keys, so a partially installed version
+      // would change the number of keys below the path
+      CtxMap staging;
+      for (int i = 0; i < n_keys; ++i) {
+        staging.update("k" + std::to_string(i) + "_" + std::to_string(version), version);
+      }
+      return staging;
+    };
+    m.update("scf/energy", -1.5);
+    m.publish("props", make_staging(0));
+
+    std::atomic<bool> done{false};
+    std::atomic<int> n_inconsistent{0};
+    std::thread reader([&]() {
+      while (!done) {
+        if (m.subtree_size("props") != static_cast<size_t>(n_keys)) ++n_inconsistent;
+      }
+    });
+    for (int version = 1; version <= 100; ++version) {
+      CtxMap staging = make_staging(version);
+      if (version % 2 == 0) staging.publish();
+      m.submap("props").publish("/", std::move(staging));
+      CHECK(staging.subtree_size("/") == 0);
+    }
+    done = true;
+    reader.join();
+    CHECK(n_inconsistent == 0);
+    CHECK(m.at<int>("props/k7_100") == 100);
+    CHECK_FALSE(m.exists("props/k7_99"));
+    CHECK(m.at<double>("scf/energy") == -1.5);
+
+    // Publishing at the root replaces everything
+    CtxMap all{{"scf/energy", -2.0}, {"grid/n", 3}};
+    m.publish("/", std::move(all));
+    CHECK(m.subtree_size("/") == 2);
+    CHECK(m.at<double>("scf/energy") == -2.0);
+    CHECK(m.at<int>("grid/n") == 3);
+
+    // Staging maps which are views are copied
+    CtxMap other{{"a/x", 1}, {"b/y", 2}};
+    m.publish("scf", other.submap("a"));
+    CHECK(m.at<int>("scf/x") == 1);
+    CHECK_FALSE(m.exists("scf/energy"));
+    CHECK(other.at<int>("a/x") == 1);
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check concurrent access from several threads") {
+    ConcurrentCtxMap m;
+    const int n_threads = 4;
+    const int n_keys    = 200;
+
+    // Each thread writes to its own subtree and reads the others
+    std::atomic<int> n_errors{0};
+    auto worker = [&](int t) {
+      const std::string own = "/thread" + std::to_string(t) + "/";
+      for (int i = 0; i < n_keys; ++i) {
+        m.update(own + std::to_string(i), i);
+        m.update("/shared/" + std::to_string(t), i);
+        if (m.at<int>(own + std::to_string(i)) != i) ++n_errors;
+
+        const std::string other = "/thread" + std::to_string((t + 1) % n_threads) + "/";
+        const int value         = m.at<int>(other + std::to_string(i), i);
+        if (value != i) ++n_errors;
+        if (i % 2 == 0) m.erase(own + std::to_string(i));
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < n_threads; ++t) threads.emplace_back(worker, t);
+    for (auto& thread : threads) thread.join();
+
+    CHECK(n_errors == 0);
+    CHECK(m.subtree_size("shared") == static_cast<size_t>(n_threads));
+    for (int t = 0; t < n_threads; ++t) {
+      const std::string own = "thread" + std::to_string(t);
+      CHECK(m.subtree_size(own) == static_cast<size_t>(n_keys / 2));
+      CHECK(m.at<int>("shared/" + std::to_string(t)) == n_keys - 1);
+    }
+  }
+}
+
+}  // namespace tests
+}  // namespace ctx
@@ -14,10 +14,19 @@
 // limitations under the License.
 //
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <catch2/catch.hpp>
+#include <chrono>
+#include <complex>
+#include <memory>
 #include <ctx/CheaplyCopyable_i.hh>
 #include <ctx/CtxMap.hh>
+#include <sstream>
+#include <thread>
+#include <utility>
+#include <vector>
 
 namespace ctx {
 namespace tests {
@@ -33,6 +42,68 @@ struct DummyCopyable : public CheaplyCopyable_i, std::array<T, 4> {
     this->at(3) = d4;
   }
 };
+
+/** Memory resource counting the bytes it has handed out */
+class CountingResource : public memory_resource {
+ public:
+  size_t n_allocations = 0;
+  size_t n_bytes       = 0;
+
+ private:
+  void* do_allocate(std::size_t bytes, std::size_t) override {
+    n_allocations += 1;
+    n_bytes += bytes;
+    return ::operator new(bytes);
+  }
+  void do_deallocate(void* p, std::size_t bytes, std::size_t) override {
+    n_bytes -= bytes;
+    ::operator delete(p);
+  }
+  bool do_is_equal(const memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+};
+
+/** Records the destruction of LoggedObjects */
+struct DestructionLog {
+  /** The thread the log has been created on */
+  const std::thread::id owner = std::this_thread::get_id();
+
+  /** Destructors running on other threads wait while the gate is closed */
+  std::atomic<bool> gate_open{true};
+
+  std::atomic<int> n_waiting{0};
+  std::atomic<int> n_destroyed{0};
+  std::atomic<int> n_destroyed_elsewhere{0};  // On a thread other than owner
+};
+
+/** Object, whose destruction is recorded in a DestructionLog */
+struct LoggedObject {
+  explicit LoggedObject(DestructionLog& log_) : log(&log_) {}
+  LoggedObject(const LoggedObject&) = delete;
+  LoggedObject& operator=(const LoggedObject&) = delete;
+
+  ~LoggedObject() {
+    if (std::this_thread::get_id() != log->owner) {
+      // Wait at the gate, but never forever
+      ++log->n_waiting;
+      const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+      while (!log->gate_open && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::yield();
+      }
+      --log->n_waiting;
+      ++log->n_destroyed_elsewhere;
+    }
+    ++log->n_destroyed;
+  }
+
+  DestructionLog* log;
+};
+
+/** An object holding a map */
+struct MapHolder {
+  CtxMap map;
+};
 }  // namespace genmap_tests
 
 TEST_CASE("CtxMap tests", "[genmap]") {
@@ -465,6 +536,34 @@ TEST_CASE("CtxMap tests", "[genmap]") {
       REQUIRE(false);  // We should never get here, since range empty
       (void)it;
     }
+
+    // Copies of iterators (e.g. by postfix increments) have their own key
+    auto it   = m.cbegin("tree");
+    auto prev = it++;
+    CHECK(prev->key() == "/");
+    CHECK(it->key() == "/i");
+    CHECK(std::next(it, 2)->key() == "/value");
+    prev = it;
+    ++it;
+    CHECK(prev->key() == "/i");
+    CHECK((--it)->key() == "/i");
+
+    // Paths deeper than the part of the path stored inline in the iterator
+    CtxMap deep;
+    std::string deep_key;
+    for (int level = 0; level < 12; ++level) {
+      deep_key += "/l" + std::to_string(level);
+      deep.update(deep_key, level);
+    }
+    auto deep_it = deep.begin();
+    for (int level = 0; level < 12; ++level, ++deep_it) {
+      CHECK(deep_it->value<int>() == level);
+    }
+    CHECK(deep_it == deep.end());
+    CHECK((--deep_it)->key() == deep_key);
+    auto deep_copy = deep_it;
+    CHECK((--deep_copy)->value<int>() == 10);
+    CHECK(deep_it->key() == deep_key);
   }
 
   //
@@ -659,8 +758,1235 @@ TEST_CASE("CtxMap tests", "[genmap]") {
   // ---------------------------------------------------------------
   //
 
-  // TODO Test mass update from initialiser list
+  SECTION("Check iteration order and erasure of deep keys") {
+    CtxMap m{{"a/b/c", 1}, {"a/b_c", 2}, {"a", 3}, {"a/b/c/d/e", 4}, {"ab", 5}};
+
+    // Inner nodes like "/a/b" carry no value and are skipped
+    std::vector<std::string> ref{"/a", "/a/b/c", "/a/b/c/d/e", "/a/b_c", "/ab"};
+    auto itref = std::begin(ref);
+    for (auto it = m.begin(); it != m.end(); ++it, ++itref) {
+      REQUIRE(itref != std::end(ref));
+      CHECK(*itref == it->key());
+    }
+    CHECK(itref == std::end(ref));
+
+    // Backwards iteration:
+    auto rit = m.end();
+    for (auto itref = ref.rbegin(); itref != ref.rend(); ++itref) {
+      --rit;
+      CHECK(*itref == rit->key());
+    }
+    CHECK(rit == m.begin());
+
+    auto subit = m.end("a/b");
+    --subit;
+    CHECK(subit->key() == "/c/d/e");
+    --subit;
+    CHECK(subit->key() == "/c");
+    CHECK(subit == m.begin("a/b"));
+
+    // Erasing an inner value keeps the keys below
+    m.erase("a/b/c");
+    CHECK(m.exists("a/b/c/d/e"));
+    CHECK_FALSE(m.exists("a/b/c"));
+    CHECK(m.submap("a/b").begin()->key() == "/c/d/e");
+
+    m.erase("a/b/c/d/e");
+    CHECK(m.begin("a/b") == m.end("a/b"));
+    CHECK(m.at<int>("a/b_c") == 2);
+
+    m.erase_recursive("a");
+    CHECK(m.begin()->key() == "/ab");
+    CHECK(++m.begin() == m.end());
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check iteration order agrees with the key comparator") {
+    std::vector<std::string> keys{"/a",     "/a/b",  "/a-b",      "/a.b/c",
+                                  "/a\x7f", "/\xff", "/a/\x01/b", "/a0",
+                                  "/A",     "/a/\xc3\xa4"};
+    CtxMap m;
+    for (const auto& key : keys) m.update(key, 0);
+
+    std::sort(std::begin(keys), std::end(keys), CtxMap::key_comparator_type{});
+    auto itref = std::begin(keys);
+    for (auto& kv : m) {
+      REQUIRE(itref != std::end(keys));
+      CHECK(kv.key() == *itref++);
+    }
+    CHECK(itref == std::end(keys));
 
+    CtxMap::key_comparator_type comp;
+    CHECK(comp("/a/b", "/a-b"));
+    CHECK(comp("/a", "/a/b"));
+    CHECK_FALSE(comp("/a/b", "/a"));
+    CHECK(comp("/a\x7f", "/a\x80"));
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check subtree sizes") {
+    CtxMap m{{"tree/sub", s},   {"tree/i", i},       {"dum", dum},
+             {"tree/value", 9}, {"tree_ser", "abc"}, {"tree", "root"},
+             {"/", "god"},      {"deep/a/b/c", 1}};
+
+    CHECK(m.subtree_size("/") == 8);
+    CHECK(m.subtree_size("tree") == 4);
+    CHECK(m.subtree_size("tree/i") == 1);
+    CHECK(m.subtree_size("deep/a") == 1);
+    CHECK(m.subtree_size("blubba") == 0);
+    CHECK(m.submap("tree").subtree_size("/") == 4);
+
+    // Overwriting keeps the size
+    m.update("tree/i", 12);
+    CHECK(m.subtree_size("tree") == 4);
+
+    m.update("tree/more/x", 1);
+    CHECK(m.subtree_size("tree") == 5);
+    CHECK(m.subtree_size("/") == 9);
+
+    m.erase("tree");
+    CHECK(m.subtree_size("tree") == 4);
+    CHECK(m.erase_recursive("tree") == 4);
+    CHECK(m.subtree_size("tree") == 0);
+    CHECK(m.subtree_size("/") == 4);
+
+    m.submap("deep").clear();
+    CHECK(m.subtree_size("/") == 3);
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check precompiled keys") {
+    const CtxMap::Key key_i("/tree/./i/");
+    const CtxMap::Key key_new("../tree/new");
+    CHECK(key_i == CtxMap::Key("tree/i"));
+    CHECK(key_i != key_new);
+    CHECK(key_i.hash() == CtxMap::Key("/tree//i").hash());
+    CHECK(key_i.str() == "/tree/i");
+    CHECK(CtxMap::Key("/..").str() == "");
+
+    CtxMap m{{"tree/i", i}, {"tree/s", s}, {"/", "god"}};
+    CHECK(m.exists(key_i));
+    CHECK_FALSE(m.exists(key_new));
+    CHECK(m.at<int>(key_i) == i);
+    CHECK(m.at<std::string>(CtxMap::Key("/")) == "god");
+    CHECK_THROWS_AS(m.at<int>(key_new), out_of_range);
+    CHECK_THROWS_AS(m.at<double>(key_i), type_mismatch);
+
+    m.at<int>(key_i) = 42;
+    CHECK(m.at<int>("tree/i") == 42);
+    m.update(key_new, 3.5);
+    CHECK(m.at<double>("tree/new") == 3.5);
+    CHECK(*m.at_ptr<double>(key_new) == 3.5);
+    CHECK(m.subtree_size("tree") == 3);
+
+    // Keys are relative to the location of submaps
+    CtxMap sub = m.submap("tree");
+    const CtxMap::Key key_sub("i");
+    CHECK(sub.at<int>(key_sub) == 42);
+    CHECK_FALSE(sub.exists(key_i));
+    sub.update(CtxMap::Key("x/y"), 1);
+    CHECK(m.at<int>("tree/x/y") == 1);
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check typed handles") {
+    CtxMap m{{"tree/i", i}, {"tree/s", s}};
+    auto hi = m.handle<int>("tree/i");
+    auto hs = m.submap("tree").handle<std::string>(CtxMap::Key("s"));
+    CHECK(*hi == i);
+    CHECK(hs->size() == s.size());
+    CHECK_THROWS_AS(m.handle<int>("tree/none"), out_of_range);
+    CHECK_THROWS_AS(m.handle<double>("tree/i"), type_mismatch);
+
+    // Modifications via the handle and via the map are visible to the other
+    *hi = 5;
+    CHECK(m.at<int>("tree/i") == 5);
+    m.at<int>("tree/i") = 6;
+    CHECK(hi.get() == 6);
+
+    // Handles follow updates and insertions without looking the key up again
+    m.update("tree/i", 7);
+    m.update("tree/a", 1);
+    m.update("other", 2.5);
+    CHECK(hi.cached());
+    CHECK(*hi == 7);
+    CHECK(*hi.get_ptr() == 7);
+    CHECK(hs.get() == s);
+
+    // Handles from const maps only give const access
+    const CtxMap& cm = m;
+    CtxMapHandle<const int> hc = cm.handle<int>("tree/i");
+    CHECK(*hc == 7);
+
+    // Copies of the nodes (e.g. since a copy of the map shares them) are noticed
+    CtxMap copy(m);
+    m.update("tree/s", s);
+    CHECK_FALSE(hi.cached());
+    CHECK(*hi == 7);
+    CHECK(hi.cached());
+    *hi = 8;
+    CHECK(copy.at<int>("tree/i") == 8);  // Like for at, the object is shared
+
+    // Invalidated handles throw on access
+    m.update("tree/i", 3.5);
+    CHECK_FALSE(hi.valid());
+    CHECK_THROWS_AS(hi.get(), type_mismatch);
+    m.erase("tree/s");
+    CHECK_FALSE(hs.valid());
+    CHECK_THROWS_AS(*hs, out_of_range);
+    m.update("tree/s", "back");
+    CHECK(hs.valid());
+    CHECK(*hs == "back");
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check type registry and printing") {
+    TypeRegistry& registry = TypeRegistry::instance();
+    CHECK(TypeRegistry::id_of<int>() == TypeRegistry::id_of<const int>());
+    CHECK(TypeRegistry::id_of<int>() != TypeRegistry::id_of<double>());
+    CHECK(registry.name(TypeRegistry::id_of<double>()) == "double");
+
+    struct Point {
+      int x, y;
+    };
+    CtxMap m{{"i", i}, {"s", s}, {"p", Point{1, 2}}};
+    CHECK(m.at_raw_value("i").type_id() == TypeRegistry::id_of<int>());
+    CHECK(m.at_raw_value("p").type_id() == TypeRegistry::id_of<Point>());
+
+    std::stringstream ss_i;
+    ss_i << m.at_raw_value("i");
+    CHECK(ss_i.str().find(std::to_string(i)) == 0);
+    CHECK(ss_i.str().find("  (int)") != std::string::npos);
+
+    std::stringstream ss_p;
+    ss_p << m.at_raw_value("p");
+    CHECK(ss_p.str().find("???") == 0);
+
+    registry.register_printer<Point>(
+          [](std::ostream& o, const Point& p) { o << p.x << "," << p.y; });
+    std::stringstream ss_p_registered;
+    ss_p_registered << m.at_raw_value("p");
+    CHECK(ss_p_registered.str().find("1,2") == 0);
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check references to small values stay valid") {
+    CtxMap m{{"a", 1}, {"c", std::complex<double>{1., 2.}}};
+
+    // Pointers obtained later refer to the same object as the reference
+    int& ref = m.at<int>("a");
+    std::shared_ptr<int> ptr = m.at_ptr<int>("a");
+    *ptr = 5;
+    CHECK(ref == 5);
+    CHECK(m.at<int>("a") == 5);
+
+    // So do copies of the map
+    CtxMap copy(m);
+    copy.at<int>("a") = 7;
+    ref = 9;
+    CHECK(m.at<int>("a") == 9);
+    CHECK(copy.at<int>("a") == 9);
+
+    // And copies of the value
+    std::complex<double>& cref = m.at<std::complex<double>>("c");
+    CtxMapValue value          = m.at_raw_value("c");
+    value.get<std::complex<double>>() = {3., 4.};
+    CHECK(cref.real() == 3.);
+    CHECK_THROWS_AS(m.at<double>("a"), type_mismatch);
+
+    // Moving a value leaves it empty
+    CtxMapValue moved(std::move(value));
+    CHECK_FALSE(value.has_value());
+    CHECK(moved.get<std::complex<double>>().imag() == 4.);
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check concurrent reads of a const map") {
+    CtxMap m;
+    for (int k = 0; k < 100; ++k) m.update("v/" + std::to_string(k), k);
+    const CtxMap& cm = m;
+
+    // Obtaining pointers, copies and frozen maps does not modify the map
+    std::atomic<int> n_wrong{0};
+    auto read = [&cm, &n_wrong]() {
+      for (int rep = 0; rep < 20; ++rep) {
+        for (int k = 0; k < 100; ++k) {
+          const std::string key = "v/" + std::to_string(k);
+          if (*cm.at_ptr<int>(key) != k) ++n_wrong;
+        }
+        CtxMap copy(cm);
+        if (copy.at<int>("v/42") != 42) ++n_wrong;
+        if (cm.freeze().at<int>("v/7") != 7) ++n_wrong;
+      }
+    };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) threads.emplace_back(read);
+    for (auto& thread : threads) thread.join();
+    CHECK(n_wrong.load() == 0);
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check lookup of keys which are not normalised") {
+    CtxMap m{{"tree/i", i}, {"tree/sub/s", s}};
+    CHECK(m.exists("tree//i"));
+    CHECK(m.exists("/tree/sub/s/"));
+    CHECK(m.exists("tree/./sub/../i"));
+    CHECK(m.exists("../tree/.hidden/../i"));
+    CHECK_FALSE(m.exists("tree/.i"));
+    CHECK(m.at<int>("//tree/i/") == i);
+    CHECK_THROWS_AS(m.at<int>("tree/..."), out_of_range);
+
+    CtxMap sub = m.submap("tree");
+    CHECK(sub.exists("sub//s"));
+    CHECK(sub.at<std::string>("/sub/./s") == s);
+    CHECK_FALSE(sub.exists("tree/i"));
+
+#ifdef CTX_HAVE_STRING_VIEW
+    const std::string_view key_view = "tree/i/and/more";
+    CHECK(m.at<int>(key_view.substr(0, 6)) == i);
+    CHECK_FALSE(m.exists(key_view.substr(0, 4)));
+    CHECK(m.subtree_size(key_view.substr(0, 4)) == 2);
+    CHECK(m.erase(key_view.substr(0, 6)) == 1);
+    CHECK_FALSE(m.exists("tree/i"));
+#endif
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check frozen maps") {
+    CtxMap m{{"tree/sub", s},   {"tree/i", i},       {"dum", dum},
+             {"tree/value", 9}, {"tree_ser", "abc"}, {"tree", "root"},
+             {"/", "god"},      {"deep/a/b/c", 1}};
+    const FrozenCtxMap f = m.freeze();
+
+    // Same values, which are shared with the original map
+    CHECK(f.at<int>("tree/i") == i);
+    CHECK(f.at<std::string>("/") == "god");
+    CHECK(f.at<std::string>("tree") == "root");
+    CHECK(f.at<int>("deep//a/b/c/") == 1);
+    CHECK(f.at<int>("tree/../deep/./a/b/c") == 1);
+    CHECK(f.at<int>(CtxMap::Key("tree/value")) == 9);
+    CHECK(f.at<int>("tree/none", 3) == 3);
+    CHECK(&f.at<std::string>("tree/sub") == &m.at<std::string>("tree/sub"));
+    CHECK(f.type_name_of("tree/value") == m.type_name_of("tree/value"));
+    CHECK_THROWS_AS(f.at<int>("blubba"), out_of_range);
+    CHECK_THROWS_AS(f.at<double>("tree/i"), type_mismatch);
+
+    CHECK(f.exists("dum"));
+    CHECK_FALSE(f.exists("deep/a"));
+    CHECK_FALSE(f.exists("tree/i/j"));
+    CHECK_FALSE(f.exists("i"));
+    CHECK(f.subtree_size("/") == 8);
+    CHECK(f.subtree_size("tree") == 4);
+    CHECK(f.subtree_size("deep/a") == 1);
+    CHECK(f.subtree_size("blubba") == 0);
+
+    // Same iteration order and keys as the original map
+    auto itm = std::begin(m);
+    for (auto& kv : f) {
+      REQUIRE(itm != std::end(m));
+      CHECK(kv.key() == itm->key());
+      CHECK(kv.value_raw().type_id() == itm->value_raw().type_id());
+      ++itm;
+    }
+    CHECK(itm == std::end(m));
+
+    auto itm2 = m.begin("tree");
+    for (auto it = f.begin("tree"); it != f.end("tree"); ++it, ++itm2) {
+      CHECK(it->key() == itm2->key());
+    }
+    CHECK(itm2 == m.end("tree"));
+    CHECK(f.begin("blubba") == f.end("blubba"));
+
+    auto itlast = f.end("tree");
+    --itlast;
+    CHECK(itlast->key() == "/value");
+
+    // Submaps
+    const FrozenCtxMap sub = f.submap("tree");
+    CHECK(sub.at<int>("i") == i);
+    CHECK(sub.at<int>("/value") == 9);
+    CHECK(sub.at<std::string>("/") == "root");
+    CHECK(sub.at<int>("../i") == i);
+    CHECK_FALSE(sub.exists("dum"));
+    CHECK(sub.subtree_size("/") == 4);
+    CHECK(std::begin(sub)->key() == "/");
+    CHECK(f.submap("deep").submap("a/b").at<int>("c") == 1);
+    CHECK(f.submap("blubba").subtree_size("/") == 0);
+
+    // Changes to the map do not affect the snapshot
+    m.update("tree/i", 42);
+    m.erase("dum");
+    CHECK(f.at<int>("tree/i") == i);
+    CHECK(f.exists("dum"));
+
+    const FrozenCtxMap empty;
+    CHECK(empty.subtree_size("/") == 0);
+    CHECK(std::begin(empty) == std::end(empty));
+    CHECK_FALSE(empty.exists("/"));
+
+    // Many keys
+    CtxMap large;
+    auto large_key = [](int k) {
+      return "level" + std::to_string(k % 7) + "/key" + std::to_string(k);
+    };
+    for (int k = 0; k < 2000; ++k) large.update(large_key(k), k);
+    const FrozenCtxMap flarge = large.freeze();
+    for (int k = 0; k < 2000; ++k) CHECK(flarge.at<int>(large_key(k)) == k);
+    CHECK_FALSE(flarge.exists("level1/key0"));
+    CHECK(flarge.subtree_size("level3") == large.subtree_size("level3"));
+
+    // Keys whose paths have the same 64-bit hash (as do all paths below them)
+    CtxMap colliding{{"643e43ff2dec4a61", 1},
+                     {"a51c20591dd3285f", 2},
+                     {"643e43ff2dec4a61/x", 3},
+                     {"a51c20591dd3285f/x", 4}};
+    const FrozenCtxMap fcolliding = colliding.freeze();
+    CHECK(fcolliding.at<int>("643e43ff2dec4a61") == 1);
+    CHECK(fcolliding.at<int>("a51c20591dd3285f") == 2);
+    CHECK(fcolliding.at<int>("643e43ff2dec4a61/x") == 3);
+    CHECK(fcolliding.at<int>("a51c20591dd3285f/x") == 4);
+    CHECK(fcolliding.submap("a51c20591dd3285f").at<int>("x") == 4);
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check copies share their storage until modified") {
+    CtxMap m{{"tree/sub", s}, {"tree/i", i}, {"dum", dum}, {"tree/value", 9},
+             {"deep/a/b/c", 1}};
+    CtxMap copy(m);
+    const CtxMap& cm    = m;
+    const CtxMap& ccopy = copy;
+
+    // update replaces the value in one map only, at modifies the shared data
+    copy.update("tree/value", 10);
+    copy.at<int>("tree/i") = 42;
+    CHECK(m.at<int>("tree/value") == 9);
+    CHECK(copy.at<int>("tree/value") == 10);
+    CHECK(m.at<int>("tree/i") == 42);
+    CHECK(copy.at<int>("tree/i") == 42);
+
+    // Subtrees not touched by the modifications are still shared
+    CHECK(&cm.at_raw_value("deep/a/b/c") == &ccopy.at_raw_value("deep/a/b/c"));
+    CHECK(&cm.at_raw_value("tree/value") != &ccopy.at_raw_value("tree/value"));
+
+    // Erasing and inserting affects only one of the maps
+    copy.erase_recursive("deep");
+    m.update("deep/a/b/d", 2);
+    CHECK(m.at<int>("deep/a/b/c") == 1);
+    CHECK(m.subtree_size("deep") == 2);
+    CHECK_FALSE(copy.exists("deep/a/b/c"));
+    CHECK_FALSE(copy.exists("deep/a/b/d"));
+    CHECK(copy.subtree_size("/") == 4);
+    CHECK(m.subtree_size("/") == 6);
+
+    // Handles follow the modifications of their own map only
+    auto handle = copy.handle<int>("tree/value");
+    CtxMap copy2(copy);
+    copy.update("tree/value", 11);
+    copy2.update("tree/value", 12);
+    CHECK(*handle == 11);
+    CHECK(copy2.at<int>("tree/value") == 12);
+
+    // Moving the values out of a copy leaves the original intact
+    CtxMap target;
+    CtxMap source(m);
+    target.update("moved", std::move(source));
+    CHECK(target.at<int>("moved/deep/a/b/c") == 1);
+    CHECK(m.at<int>("deep/a/b/c") == 1);
+    CHECK(m.at<std::string>("tree/sub") == s);
+
+    // Copies of submaps share the storage as well
+    const CtxMap subcopy(m.submap("tree"));
+    CHECK(&cm.at_raw_value("tree/sub") == &subcopy.at_raw_value("sub"));
+    CtxMap subcopy2(subcopy);
+    subcopy2.update("value", 13);
+    CHECK(m.at<int>("tree/value") == 9);
+    CHECK(subcopy.at<int>("value") == 9);
+    CHECK(subcopy2.at<int>("i") == 42);
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check snapshots of published versions") {
+    CtxMap m{{"tree/i", i}, {"tree/s", s}, {"dum", dum}};
+    CHECK(m.snapshot().subtree_size("/") == 0);
+
+    m.publish();
+    const CtxMap snap = m.snapshot();
+    const CtxMap subsnap = m.submap("tree").snapshot();
+    m.update("tree/i", 6);
+    m.update("tree/new", 1.5);
+    m.erase("dum");
+
+    // The snapshots keep the published state
+    CHECK(snap.at<int>("tree/i") == i);
+    CHECK(snap.exists("dum"));
+    CHECK_FALSE(snap.exists("tree/new"));
+    CHECK(snap.subtree_size("/") == 3);
+    CHECK(subsnap.at<int>("i") == i);
+    CHECK(subsnap.at<std::string>("s") == s);
+    CHECK(subsnap.subtree_size("/") == 2);
+    CHECK(m.snapshot().at<int>("tree/i") == i);
+
+    // Until the next version is published
+    m.publish();
+    const CtxMap snap2 = m.snapshot();
+    CHECK(snap2.at<int>("tree/i") == 6);
+    CHECK(snap2.at<double>("tree/new") == 1.5);
+    CHECK_FALSE(snap2.exists("dum"));
+    CHECK(snap.at<int>("tree/i") == i);
+
+    // Copies of snapshots can be modified independently
+    CtxMap copy(snap);
+    copy.update("tree/i", 7);
+    CHECK(copy.at<int>("tree/i") == 7);
+    CHECK(snap.at<int>("tree/i") == i);
+    CHECK(m.at<int>("tree/i") == 6);
+
+    // Readers in other threads always see consistent versions
+    std::atomic<bool> done{false};
+    std::atomic<int> n_inconsistent{0};
+    std::atomic<int> n_snapshots{0};
+    auto reader = [&]() {
+      while (!done) {
+        // Version k has the keys "a", "b" and "k1" to "k<k>"
+        const CtxMap view = m.snapshot();
+        const int k       = view.at<int>("sum/a");
+        if (view.at<int>("sum/b") != -k) ++n_inconsistent;
+
+        int count = 0;
+        for (auto it = view.begin("sum"); it != view.end("sum"); ++it) ++count;
+        if (count != k + 2 || view.subtree_size("sum") != static_cast<size_t>(count)) {
+          ++n_inconsistent;
+        }
+        ++n_snapshots;
+      }
+    };
+
+    m.update("sum/a", 0);
+    m.update("sum/b", 0);
+    m.publish();
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; ++t) readers.emplace_back(reader);
+    for (int k = 1; k < 300; ++k) {
+      m.update("sum/a", k);
+      m.update("sum/b", -k);
+      m.update("sum/k" + std::to_string(k), k);
+      m.publish();
+    }
+    done = true;
+    for (auto& thread : readers) thread.join();
+    CHECK(n_inconsistent == 0);
+    CHECK(n_snapshots > 0);
+    CHECK(m.snapshot().at<int>("sum/a") == 299);
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check atomic slots") {
+    CtxMap m{{"tree/i", i}};
+    m.update_atomic("scf/energy", -1.5);
+    m.update_atomic("scf/name", std::string("first"));
+    CHECK(m.at_atomic<double>("scf/energy") == -1.5);
+    CHECK(m.at_atomic<std::string>("scf/name") == "first");
+    CHECK_THROWS_AS(m.at_atomic<int>("scf/energy"), type_mismatch);
+    CHECK_THROWS_AS(m.at_atomic<int>("tree/i"), type_mismatch);
+
+    // Storing into an existing slot keeps the slot
+    const AtomicSlot<double>* slot = &m.at<AtomicSlot<double>>("scf/energy");
+    m.update_atomic("scf/energy", -2.5);
+    m.update_atomic("scf/name", std::string("second"));
+    CHECK(&m.at<AtomicSlot<double>>("scf/energy") == slot);
+    CHECK(m.at_atomic<double>("scf/energy") == -2.5);
+    CHECK(m.at_atomic<std::string>("scf/name") == "second");
+
+    // Other types replace the slot
+    m.update_atomic("tree/i", 3);
+    CHECK(m.at_atomic<int>("tree/i") == 3);
+    m.update_atomic("scf/energy", 1);
+    CHECK(m.at_atomic<int>("scf/energy") == 1);
+
+    // Readers in other threads see either the old or the new value
+    struct Pair {
+      long a, b;
+    };
+    m.update_atomic("pair", Pair{0, 0});
+    m.update_atomic("text", std::string("0"));
+    std::atomic<bool> done{false};
+    std::atomic<int> n_inconsistent{0};
+    auto reader = [&]() {
+      long last = 0;
+      while (!done) {
+        const Pair p = m.at_atomic<Pair>("pair");
+        if (p.b != -p.a || p.a < last) ++n_inconsistent;
+        last                   = p.a;
+        const std::string text = m.at_atomic<std::string>("text");
+        if (std::stol(text) < 0) ++n_inconsistent;
+      }
+    };
+
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; ++t) readers.emplace_back(reader);
+    for (long k = 1; k <= 2000; ++k) {
+      m.update_atomic("pair", Pair{k, -k});
+      m.update_atomic("text", std::to_string(k));
+    }
+    done = true;
+    for (auto& thread : readers) thread.join();
+    CHECK(n_inconsistent == 0);
+    CHECK(m.at_atomic<Pair>("pair").a == 2000);
+    CHECK(m.at_atomic<std::string>("text") == "2000");
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check atomic cells") {
+    CtxMap m;
+    m.update("counter", AtomicCell<long>{0});
+    m.update("timings/total", AtomicCell<double>{0.5});
+    m.update("timings/max", AtomicCell<int>{0});
+    m.update("failed", AtomicCell<bool>{false});
+    CHECK(sizeof(AtomicCell<long>) >= 64);
+
+    // Accumulate from several threads via the const interface of the map
+    const CtxMap& cm = m;
+    auto worker      = [&cm](int t) {
+      for (int k = 0; k < 1000; ++k) {
+        cm.at<AtomicCell<long>>("counter").fetch_add(2);
+        cm.at<AtomicCell<double>>("timings/total").fetch_add(0.25);
+        cm.at<AtomicCell<int>>("timings/max").fetch_max(t * 1000 + k);
+        if (t == 2 && k == 500) cm.at<AtomicCell<bool>>("failed").fetch_max(true);
+      }
+    };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) threads.emplace_back(worker, t);
+    for (auto& thread : threads) thread.join();
+
+    CHECK(m.at<AtomicCell<long>>("counter").load() == 8000);
+    CHECK(m.at<AtomicCell<double>>("timings/total") == 1000.5);
+    CHECK(m.at<AtomicCell<int>>("timings/max") == 3999);
+    CHECK(m.at<AtomicCell<bool>>("failed").load());
+    CHECK(m.at<AtomicCell<bool>>("failed").fetch_min(false));
+    CHECK_FALSE(m.at<AtomicCell<bool>>("failed"));
+    CHECK(m.at<AtomicCell<long>>("counter").fetch_sub(8000) == 8000);
+    CHECK(m.at<AtomicCell<int>>("timings/max").fetch_min(-1) == 3999);
+    m.at<AtomicCell<double>>("timings/total").store(2.5);
+
+    // Copies of the map share the cell, printing shows the value
+    CtxMap copy(m);
+    copy.at<AtomicCell<long>>("counter").fetch_add(5);
+    CHECK(m.at<AtomicCell<long>>("counter") == 5);
+
+    std::stringstream ss;
+    ss << m.at_raw_value("counter") << ";" << m.at_raw_value("timings/max") << ";"
+       << m.at_raw_value("timings/total");
+    CHECK(ss.str().find("5 ") == 0);
+    CHECK(ss.str().find(";-1 ") != std::string::npos);
+    CHECK(ss.str().find(";2.5 ") != std::string::npos);
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check batched updates") {
+    CtxMap m{{"tree/i", i}, {"tree/s", s}, {"other/a", 1}, {"other/b", 2}};
+    const CtxMap copy(m);
+
+    CtxMap sub        = m.submap("tree");
+    CtxMapBatch batch = sub.batch();
+    batch.update("new/deep/key", 3.5);
+    batch.update("i", 42);
+    batch.erase("s");
+    batch.erase("missing/key");
+    batch.update("twice", 1);
+    batch.update("./twice", 2);
+    batch.update("gone", 1);
+    batch.erase("gone");
+    batch.erase("back");
+    batch.update("back", 7);
+    batch.update("../escape", 8);
+    const key_view_type view("view");
+    batch.update(view, 9);
+    CHECK(batch.size() == 12);
+
+    // Nothing happens before the commit
+    CHECK(m.at<int>("tree/i") == i);
+    CHECK_FALSE(m.exists("tree/new/deep/key"));
+    batch.commit();
+    CHECK(batch.empty());
+
+    CHECK(m.at<double>("tree/new/deep/key") == 3.5);
+    CHECK(m.at<int>("tree/i") == 42);
+    CHECK_FALSE(m.exists("tree/s"));
+    CHECK_FALSE(m.exists("tree/missing"));
+    CHECK(m.at<int>("tree/twice") == 2);
+    CHECK_FALSE(m.exists("tree/gone"));
+    CHECK(m.at<int>("tree/back") == 7);
+    CHECK(m.at<int>("tree/escape") == 8);
+    CHECK(m.at<int>("tree/view") == 9);
+    CHECK(m.subtree_size("tree") == 6);
+    CHECK(m.subtree_size("/") == 8);
+
+    // Pruned and new nodes are consistent with the iteration
+    std::vector<std::string> keys;
+    for (auto& kv : m) keys.push_back(kv.key());
+    CHECK(keys == std::vector<std::string>{"/other/a", "/other/b", "/tree/back",
+                                           "/tree/escape", "/tree/i",
+                                           "/tree/new/deep/key", "/tree/twice",
+                                           "/tree/view"});
+
+    // Removing everything below a node prunes it
+    CtxMapBatch batch2 = m.batch();
+    batch2.erase("tree/new/deep/key");
+    batch2.erase("other/a");
+    batch2.erase("other/b");
+    batch2.update("/", 0);
+    batch2.commit();
+    CHECK(m.subtree_size("/") == 6);
+    CHECK(m.subtree_size("other") == 0);
+    CHECK(m.begin("other") == m.end("other"));
+    CHECK(m.begin("tree/new") == m.end("tree/new"));
+    CHECK(m.at<int>("/") == 0);
+
+    // Uncommitted modifications are discarded, copies are untouched
+    {
+      CtxMapBatch discarded = m.batch();
+      discarded.update("tree/i", -1);
+    }
+    CHECK(m.at<int>("tree/i") == 42);
+    CHECK(copy.subtree_size("/") == 4);
+    CHECK(copy.at<int>("tree/i") == i);
+    CHECK(copy.at<std::string>("tree/s") == s);
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check loading many entries at once") {
+    // Keys sorted like in a CtxMap, unsorted keys and keys needing normalisation
+    std::vector<std::pair<std::string, int>> sorted, shuffled;
+    for (int k = 0; k < 200; ++k) {
+      sorted.emplace_back("block" + std::to_string(k / 50) + "/k" + std::to_string(k), k);
+    }
+    std::sort(std::begin(sorted), std::end(sorted),
+              [](const std::pair<std::string, int>& lhs,
+                 const std::pair<std::string, int>& rhs) {
+                return CtxMap::key_comparator_type{}("/" + lhs.first, "/" + rhs.first);
+              });
+    shuffled = sorted;
+    std::reverse(std::begin(shuffled), std::end(shuffled));
+    shuffled.emplace_back("block1/./k60", -60);
+    shuffled.emplace_back("//block2/k100/", -100);
+
+    const CtxMap m(std::begin(sorted), std::end(sorted));
+    const CtxMap n(std::begin(shuffled), std::end(shuffled));
+    CHECK(m.subtree_size("/") == 200);
+    CHECK(n.subtree_size("/") == 200);
+    CHECK(m.subtree_size("block2") == 50);
+    CHECK(m.at<int>("block3/k199") == 199);
+    CHECK(n.at<int>("block1/k60") == -60);
+    CHECK(n.at<int>("block2/k100") == -100);
+
+    auto it = m.begin();
+    for (const auto& kv : sorted) {
+      REQUIRE(it != m.end());
+      CHECK(it->key() == "/" + kv.first);
+      CHECK(it->value<int>() == kv.second);
+      ++it;
+    }
+    CHECK(it == m.end());
+
+    // Assigning to a submap only replaces its entries
+    CtxMap o{{"keep", 1}, {"sub/old", 2}};
+    CtxMap sub = o.submap("sub");
+    sub.assign(std::begin(sorted), std::begin(sorted) + 10);
+    CHECK(o.subtree_size("/") == 11);
+    CHECK(o.at<int>("keep") == 1);
+    CHECK_FALSE(o.exists("sub/old"));
+    CHECK(o.at<int>("sub/block0/k1") == 1);
+
+    // Mass update from an initialiser list keeps the other entries
+    o.update({{"keep", 3}, {"sub/new", s}, {"new", 4}});
+    CHECK(o.subtree_size("/") == 13);
+    CHECK(o.at<int>("keep") == 3);
+    CHECK(o.at<std::string>("sub/new") == s);
+    CHECK(o.at<int>("sub/block0/k0") == 0);
+  }
+
+  SECTION("Check merging maps") {
+    CtxMap m{{"a/x", 1}, {"a/y/z", 2}, {"b", 3}};
+    CtxMap other{{"/", 5}, {"x", 10}, {"y/w", 20}, {"q/r", 30}};
+
+    m.update("a", other);
+    CHECK(m.subtree_size("/") == 6);
+    CHECK(m.subtree_size("a/y") == 2);
+    CHECK(m.at<int>("a") == 5);
+    CHECK(m.at<int>("a/x") == 10);
+    CHECK(m.at<int>("a/y/z") == 2);
+    CHECK(m.at<int>("a/y/w") == 20);
+    CHECK(m.at<int>("a/q/r") == 30);
+
+    std::vector<std::string> keys;
+    for (auto& kv : m) keys.push_back(kv.key());
+    CHECK(keys == std::vector<std::string>{"/a", "/a/q/r", "/a/x", "/a/y/w", "/a/y/z",
+                                           "/b"});
+
+    // Both maps stay independent although they share the subtree "q"
+    m.update("a/q/r", 0);
+    other.update("q/s", 1);
+    CHECK(other.at<int>("q/r") == 30);
+    CHECK_FALSE(m.exists("a/q/s"));
+    CHECK(other.subtree_size("/") == 5);
+
+    // Merge a submap of the map into itself
+    const CtxMap sub = m.submap("a");
+    m.update("a/copy", sub);
+    CHECK(m.subtree_size("a") == 10);
+    CHECK(m.subtree_size("/") == 11);
+    CHECK(m.at<int>("a/copy") == 5);
+    CHECK(m.at<int>("a/copy/y/z") == 2);
+    CHECK(m.at<int>("a/copy/q/r") == 0);
+    CHECK_FALSE(m.exists("a/copy/copy"));
+
+    // Merging an empty map does not create any nodes
+    const CtxMap empty;
+    m.update("empty/path", empty);
+    CHECK(m.subtree_size("/") == 11);
+    CHECK(m.begin("empty") == m.end("empty"));
+  }
+
+  SECTION("Check moving maps") {
+    CtxMap results{{"e/x", 1}, {"e/y", 2.5}, {"big", s}};
+    const int* x_ptr           = &results.at<int>("e/x");
+    const std::string* big_ptr = &results.at<std::string>("big");
+
+    CtxMap archive{{"archive/e/x", 0}, {"archive/e/z", 3}, {"other", 4}};
+    archive.update("archive", std::move(results));
+    CHECK(archive.subtree_size("/") == 5);
+    CHECK(archive.subtree_size("archive") == 4);
+    CHECK(archive.at<int>("archive/e/x") == 1);
+    CHECK(archive.at<int>("archive/e/z") == 3);
+    CHECK(archive.at<double>("archive/e/y") == 2.5);
+
+    // Neither the nodes nor the values were copied
+    CHECK(&archive.at<int>("archive/e/x") == x_ptr);
+    CHECK(&archive.at<std::string>("archive/big") == big_ptr);
+    CHECK(results.subtree_size("/") == 0);
+
+    // Submaps viewing a map are not emptied
+    archive.update("copy", archive.submap("archive/e"));
+    CHECK(archive.at<int>("copy/z") == 3);
+    CHECK(archive.at<int>("archive/e/z") == 3);
+    CHECK(archive.subtree_size("/") == 8);
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check renaming and swapping subtrees") {
+    CtxMap m{{"scf/current/energy", -1.5},
+             {"scf/current/orbitals/alpha", 1},
+             {"scf/current/orbitals/beta", 2},
+             {"scf/previous/energy", -1.0},
+             {"scf/previous/stale", 3},
+             {"scf/iteration", 7}};
+    const double* energy = &m.at<double>("scf/current/energy");
+
+    // Swap the buffers: The values are not touched
+    m.swap_subtrees("scf/current", "scf/previous");
+    CHECK(m.at<double>("scf/current/energy") == -1.0);
+    CHECK(m.at<int>("scf/current/stale") == 3);
+    CHECK(&m.at<double>("scf/previous/energy") == energy);
+    CHECK(m.at<int>("scf/previous/orbitals/beta") == 2);
+    CHECK_FALSE(m.exists("scf/current/orbitals/alpha"));
+    CHECK(m.subtree_size("scf/current") == 2);
+    CHECK(m.subtree_size("scf/previous") == 3);
+    CHECK(m.subtree_size("/") == 6);
+
+    // Swapping with a path without entries moves the subtree
+    m.swap_subtrees("scf/current", "scf/next");
+    CHECK(m.subtree_size("scf/current") == 0);
+    CHECK(m.at<int>("scf/next/stale") == 3);
+    m.swap_subtrees("scf/next", "scf/next");
+    CHECK(m.subtree_size("scf/next") == 2);
+
+    // Renaming replaces the target
+    m.rename_subtree("scf/previous", "scf/next");
+    CHECK(&m.at<double>("scf/next/energy") == energy);
+    CHECK_FALSE(m.exists("scf/next/stale"));
+    CHECK(m.subtree_size("scf/previous") == 0);
+    CHECK(m.subtree_size("scf") == 4);
+
+    // Deeper, into a new path and from a submap
+    CtxMap scf = m.submap("scf");
+    scf.rename_subtree("next/orbitals", "old/orbitals/2");
+    CHECK(m.at<int>("scf/old/orbitals/2/alpha") == 1);
+    CHECK(m.subtree_size("scf/next") == 1);
+    m.rename_subtree("scf/old/orbitals/2", "scf/old");
+    CHECK(m.at<int>("scf/old/beta") == 2);
+    CHECK(m.subtree_size("/") == 4);
+
+    // Copies of the map are not affected
+    const CtxMap copy(m);
+    m.rename_subtree("scf", "archive/scf");
+    CHECK(m.at<int>("archive/scf/iteration") == 7);
+    CHECK(copy.at<int>("scf/iteration") == 7);
+    CHECK_FALSE(copy.exists("archive/scf/iteration"));
+
+    CHECK_THROWS_AS(m.rename_subtree("scf", "other"), out_of_range);
+    CHECK_THROWS_AS(m.rename_subtree("archive", "archive/scf/x"), invalid_argument);
+    CHECK_THROWS_AS(m.swap_subtrees("archive/scf", "archive"), invalid_argument);
+    CHECK(m.subtree_size("archive") == 4);
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check publishing subtrees built elsewhere") {
+    CtxMap m{{"props/old", 0}, {"scf/energy", -1.5}};
+    m.publish();
+    const CtxMap before = m.snapshot();
+
+    CtxMap staging{{"dipole/x", 0.5}, {"dipole/y", 1.5}};
+    const double* dipole_x = &staging.at<double>("dipole/x");
+    m.publish("props", std::move(staging));
+    CHECK(staging.subtree_size("/") == 0);
+
+    // The nodes and values have been taken over
+    const CtxMap after = m.snapshot();
+    CHECK(&after.at<double>("props/dipole/x") == dipole_x);
+    CHECK(after.subtree_size("props") == 2);
+    CHECK_FALSE(after.exists("props/old"));
+    CHECK(after.at<double>("scf/energy") == -1.5);
+    CHECK(before.at<int>("props/old") == 0);
+    CHECK_FALSE(before.exists("props/dipole/x"));
+
+    // Staging maps which are views are left as they are
+    CtxMap other{{"a/b", 1}};
+    m.publish("props/dipole", other.submap("a"));
+    CHECK(m.snapshot().at<int>("props/dipole/b") == 1);
+    CHECK(m.subtree_size("props") == 1);
+    CHECK(other.at<int>("a/b") == 1);
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check allocating from a memory resource") {
+    genmap_tests::CountingResource resource;
+    {
+      CtxMap m(&resource);
+      CHECK(m.resource() == &resource);
+      m.update("scf/energy", -1.5);
+      m.update("scf/iteration/count", 3);
+      const size_t n_node_allocations = resource.n_allocations;
+      CHECK(n_node_allocations > 0);
+
+      // Values created by the map come from the resource as well
+      m.emplace<std::vector<double>>("scf/orbitals", 3, 2.0);
+      m.emplace<double>("scf/scalar", 4.0);
+      CHECK(resource.n_allocations > n_node_allocations);
+      CHECK(m.at<std::vector<double>>("scf/orbitals") == std::vector<double>(3, 2.0));
+      CHECK(m.at<double>("scf/scalar") == 4.0);
+
+      const size_t n_values = resource.n_allocations;
+      m.update("scf/scalar", std::string("converged"));
+      m.update("scf/scalar", -1.0);
+      m.update(CtxMap::Key("scf/iteration/count"), 4);
+      m.update_copy("scf/orbitals", std::vector<double>(2, 1.0));
+      CHECK(resource.n_allocations == n_values + 4);
+      CHECK(m.at<double>("scf/scalar") == -1.0);
+      CHECK(m.at<int>("scf/iteration/count") == 4);
+
+      // So do copies and snapshots
+      const size_t n_before = resource.n_allocations;
+      CtxMap copy(m);
+      copy.update("scf/energy", -2.0);
+      CHECK(copy.resource() == &resource);
+      CHECK(resource.n_allocations > n_before);
+      m.publish();
+      CHECK(m.snapshot().resource() == &resource);
+      CHECK(m.snapshot().at<double>("scf/energy") == -1.5);
+
+      // Maps using the heap can exchange entries with the map
+      CtxMap other{{"a/b", 1}, {"a/c", 2}};
+      m.update("other", std::move(other));
+      CtxMap moved;
+      moved.update("/", std::move(copy));
+      CHECK(m.at<int>("other/a/c") == 2);
+      CHECK(moved.at<double>("scf/energy") == -2.0);
+      CHECK(moved.resource() == nullptr);
+    }
+    CHECK(resource.n_bytes == 0);
+
+    // Over-aligned objects are aligned on the global heap as well
+    struct alignas(128) Aligned {
+      double x;
+    };
+    ResourceAllocator<Aligned> heap;
+    Aligned* block = heap.allocate(3);
+    CHECK(reinterpret_cast<std::uintptr_t>(block) % 128 == 0);
+    heap.deallocate(block, 3);
+
+    CtxMap m;
+    m.update("aligned", Aligned{1.5});
+    m.emplace<Aligned>("emplaced", Aligned{2.5});
+    CHECK(reinterpret_cast<std::uintptr_t>(&m.at<Aligned>("aligned")) % 128 == 0);
+    CHECK(reinterpret_cast<std::uintptr_t>(&m.at<Aligned>("emplaced")) % 128 == 0);
+    CHECK(m.at<Aligned>("emplaced").x == 2.5);
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check subtree regions") {
+    genmap_tests::CountingResource resource;
+    CtxMap m(&resource);
+    m.update("scf/energy", -1.5);
+    m.attach_region("scf/step1");
+    CHECK(m.subtree_size("scf/step1") == 0);
+    CHECK_FALSE(m.exists("scf/step1"));
+
+    auto matrix = std::make_shared<std::vector<double>>(100, 1.0);
+    std::weak_ptr<std::vector<double>> observer(matrix);
+    for (int i = 0; i < 100; ++i) {
+      m.update("scf/step1/a_rather_long_key_name_" + std::to_string(i) + "/value", i);
+    }
+    m.update("scf/step1/matrix", std::move(matrix));
+    m.update("scf/step1/label", std::string(100, 'x'));
+    m.update("scf/step1/sub", CtxMap{{"a", 1}, {"b", 2}});
+    CHECK(m.at<int>("scf/step1/a_rather_long_key_name_42/value") == 42);
+    CHECK(m.subtree_size("scf/step1") == 104);
+
+    // Copies keep the entries alive, even after they are erased from the map
+    {
+      CtxMap copy(m);
+      copy.update("scf/step1/a_rather_long_key_name_7/value", -7);
+      CHECK(m.erase_recursive("scf/step1") == 104);
+      CHECK(copy.at<int>("scf/step1/a_rather_long_key_name_8/value") == 8);
+      CHECK(copy.at<int>("scf/step1/a_rather_long_key_name_7/value") == -7);
+      CHECK(copy.at<int>("scf/step1/sub/b") == 2);
+      CHECK(copy.erase_recursive("scf/step1") == 104);
+      CHECK(observer.expired());
+    }
+
+    // The chunks of the region are obtained from the resource of the map
+    // and given back once the last entry of the path is gone
+    const size_t n_allocations = resource.n_allocations;
+    const size_t n_bytes       = resource.n_bytes;
+    m.attach_region("scf/step2", 4096);
+    auto grid = std::make_shared<std::vector<double>>(100, 2.0);
+    observer  = grid;
+    for (int i = 0; i < 100; ++i) m.update("scf/step2/" + std::to_string(i), i);
+    m.update("scf/step2/grid", std::move(grid));
+    CHECK(m.at<int>("scf/step2/99") == 99);
+    CHECK(resource.n_allocations - n_allocations < 10);
+    CHECK(resource.n_bytes > n_bytes);
+
+    {
+      CtxMap snapshot(m);
+      CHECK(m.erase_recursive("scf/step2") == 101);
+      CHECK(resource.n_bytes > n_bytes);
+      CHECK(snapshot.at<int>("scf/step2/99") == 99);
+    }
+    CHECK(resource.n_bytes == n_bytes);
+    CHECK(observer.expired());
+
+    // The values created by the map are carved from the region as well,
+    // such that only chunks are obtained from the resource
+    const size_t n_chunks_before = resource.n_allocations;
+    m.attach_region("scf/step2", 4096);
+    for (int i = 0; i < 100; ++i) m.update("scf/step2/" + std::to_string(i), i);
+    for (int i = 0; i < 50; ++i) {
+      m.emplace<std::vector<double>>("scf/step2/v" + std::to_string(i), 3, 1.0);
+    }
+    CHECK(resource.n_allocations - n_chunks_before < 20);
+    CHECK(m.erase_recursive("scf/step2") == 150);
+    CHECK(resource.n_bytes == n_bytes);
+    CHECK(m.subtree_size("/") == 1);
+
+    // Memory given back to the region is reused, so replacing and erasing
+    // entries over and over does not make the region grow. This includes
+    // memory given back on other threads.
+    m.attach_region("scf/step4", 4096);
+    m.update("scf/step4/keep", 0);
+    size_t n_bytes_churn = 0;
+    for (int round = 0; round < 200; ++round) {
+      for (int i = 0; i < 20; ++i) {
+        m.update("scf/step4/tmp/" + std::to_string(i), round + i);
+      }
+      m.emplace<std::vector<double>>("scf/step4/vec", 10, 1.0);
+      m.update("scf/step4/keep", round % 2 == 0 ? CtxMapValue(1.5) : CtxMapValue(2));
+
+      {
+        CtxMap holder(m);
+        CHECK(m.erase_recursive("scf/step4/tmp") == 20);
+        if (round % 3 == 0) std::thread([&holder] { holder = CtxMap(); }).join();
+      }
+      if (round == 10) n_bytes_churn = resource.n_bytes;
+    }
+    CHECK(resource.n_bytes == n_bytes_churn);
+    CHECK(m.erase_recursive("scf/step4") == 2);
+    CHECK(resource.n_bytes == n_bytes);
+
+    // Regions are ended by emptying the path
+    m.attach_region("scf/step3");
+    m.update("scf/step3/x", 1);
+    m.erase("scf/step3/x");
+    CHECK(m.subtree_size("scf") == 1);
+
+    CHECK_THROWS_AS(m.attach_region("scf"), invalid_argument);
+    CHECK_THROWS_AS(m.attach_region("/"), invalid_argument);
+    CHECK(resource.n_bytes == n_bytes);
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
+
+  SECTION("Check destroying values in the background") {
+    DestructionLog log;
+    auto reclaimer = std::make_shared<CtxMapReclaimer>();
+    CtxMap m{{"x", 1}};
+    m.set_reclaimer(reclaimer);
+
+    // Erasing does not wait for the destructor
+    log.gate_open = false;
+    m.update("big", std::make_shared<LoggedObject>(log));
+    CHECK(m.erase("big") == 1);
+    CHECK(log.n_destroyed.load() == 0);
+    log.gate_open = true;
+    reclaimer->flush();
+    CHECK(log.n_destroyed.load() == 1);
+    CHECK(log.n_destroyed_elsewhere.load() == 1);
+
+    // Overwriting, removing subtrees, clearing and dropping copies
+    m.update("a", std::make_shared<LoggedObject>(log));
+    m.update("a", 2);
+    for (int i = 0; i < 3; ++i) {
+      m.update("b/" + std::to_string(i), std::make_shared<LoggedObject>(log));
+    }
+    CHECK(m.erase_recursive("b") == 3);
+    m.update("c", std::make_shared<LoggedObject>(log));
+    m.update({{"c", 3}});
+    {
+      CtxMap copy(m);
+      copy.update("d", std::make_shared<LoggedObject>(log));
+    }
+    CtxMap sub = m.submap("e");
+    sub.update("f", std::make_shared<LoggedObject>(log));
+    sub.clear();
+    reclaimer->flush();
+    CHECK(log.n_destroyed.load() == 8);
+    CHECK(log.n_destroyed_elsewhere.load() == 8);
+    CHECK(m.at<int>("a") == 2);
+    CHECK(m.at<int>("c") == 3);
+    CHECK(m.subtree_size("/") == 3);
+
+    // Objects referenced elsewhere stay alive
+    auto kept = std::make_shared<LoggedObject>(log);
+    m.update("kept", kept);
+    m.erase("kept");
+    reclaimer->flush();
+    CHECK(log.n_destroyed.load() == 8);
+    kept.reset();
+    CHECK(log.n_destroyed.load() == 9);
+    CHECK(log.n_destroyed_elsewhere.load() == 8);
+
+    // Values replaced via update_copy are handed over as well
+    m.update("copied", std::make_shared<LoggedObject>(log));
+    m.update_copy("copied", 4);
+    reclaimer->flush();
+    CHECK(log.n_destroyed.load() == 10);
+    CHECK(log.n_destroyed_elsewhere.load() == 9);
+
+    // Once the queue is full, objects are destroyed by the caller
+    auto small = std::make_shared<CtxMapReclaimer>(2);
+    m.set_reclaimer(small);
+    for (int i = 0; i < 4; ++i) {
+      m.update("q/" + std::to_string(i), std::make_shared<LoggedObject>(log));
+    }
+    log.gate_open = false;
+    m.erase("q/0");
+    while (log.n_waiting.load() == 0) std::this_thread::yield();
+    m.erase("q/1");
+    m.erase("q/2");
+    CHECK(log.n_destroyed.load() == 10);
+    m.erase("q/3");
+    CHECK(log.n_destroyed.load() == 11);
+    CHECK(log.n_destroyed_elsewhere.load() == 9);
+    log.gate_open = true;
+    small->flush();
+    CHECK(log.n_destroyed.load() == 14);
+    CHECK(log.n_destroyed_elsewhere.load() == 12);
+
+    // The last reference to a reclaimer may be dropped by an object it destroys
+    auto holder = std::make_shared<MapHolder>();
+    holder->map.set_reclaimer(small);
+    holder->map.update("obj", std::make_shared<LoggedObject>(log));
+    m.update("holder", std::move(holder));
+    m.update("gated", std::make_shared<LoggedObject>(log));
+
+    log.gate_open = false;
+    m.erase("gated");
+    while (log.n_waiting.load() == 0) std::this_thread::yield();
+    m.erase("holder");
+    m.set_reclaimer(nullptr);
+    small.reset();  // Only the queued holder refers to the reclaimer now
+    log.gate_open = true;
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (log.n_destroyed.load() < 16 && std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::yield();
+    }
+    CHECK(log.n_destroyed.load() == 16);
+    CHECK(log.n_destroyed_elsewhere.load() == 14);
+  }
+
+  //
+  // ---------------------------------------------------------------
+  //
 }  // TEST_CASE
 }  // namespace tests
 }  // namespace ctx
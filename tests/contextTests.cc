@@ -165,6 +165,46 @@ TEST_CASE("Test context", "[context]") {
     REQUIRE(*ctx2.get<int>("d") == 0);
   }
 
+  SECTION("Test moving objects and paths") {
+    CtxMap stor{{"scf/current/energy", -1.5}, {"scf/current/density", 3}, {"value", 1}};
+    context ctx(stor);
+    const double* energy = ctx.get<double>("scf/current/energy").get();
+
+    ctx.move("value", "moved");
+    REQUIRE_FALSE(ctx.key_exists("value"));
+    REQUIRE(*ctx.get<int>("moved") == 1);
+
+    // Moving a path moves all objects below it
+    ctx.move("scf/current", "scf/previous");
+    REQUIRE_FALSE(ctx.key_exists("scf/current/energy"));
+    REQUIRE(ctx.get<double>("scf/previous/energy").get() == energy);
+    REQUIRE(*ctx.get<int>("scf/previous/density") == 3);
+
+    // Across contexts
+    root_storage stor2{{"previous/stale", 4}};
+    context ctx2(stor2);
+    context scf(ctx, "scf");
+    scf.move("previous", ctx2, "previous");
+    REQUIRE_FALSE(ctx.key_exists("scf/previous/energy"));
+    REQUIRE(ctx2.get<double>("previous/energy").get() == energy);
+    REQUIRE_FALSE(ctx2.key_exists("previous/stale"));
+
+    REQUIRE_THROWS_AS(ctx.move("scf", "other"), ctx::out_of_range);
+  }
+
+  SECTION("Test access with precompiled keys") {
+    CtxMap stor{{"tree/data", 39}, {"tree/string", "string"}};
+    context ctx(stor);
+    context tree(ctx, "tree");
+
+    const CtxMap::Key key("data");
+    REQUIRE(tree.key_exists(key));
+    REQUIRE_FALSE(ctx.key_exists(key));
+    REQUIRE(*tree.get<int>(key) == 39);
+    REQUIRE(*ctx.get<std::string>(CtxMap::Key("tree/string")) == "string");
+    REQUIRE_THROWS_AS(ctx.get<int>(key), ctx::out_of_range);
+  }
+
   SECTION("Test various exception throws") {
     CtxMap stor{{"tree/data", 39}, {"tree/string", "string"}};
     context ctx(stor);
@@ -67,6 +67,30 @@ TEST_CASE("Test ctx_ptr", "[ctx_ptr]") {
     REQUIRE(*ptr_five == 5.);
   }  // doubles
 
+  SECTION("Test following updates") {
+    ctx.insert("six", rc_ptr<int>(new int(6)));
+    ctx_ptr<int> ptr_six(ctx, "six");
+    REQUIRE(*ptr_six == 6);
+
+    ctx.update("six", rc_ptr<int>(new int(66)));
+    REQUIRE(*ptr_six == 66);
+    *ptr_six = 7;
+    REQUIRE(*ctx.get<int>("six") == 7);
+  }  // updates
+
+  SECTION("Test erasing the key") {
+    ctx.insert("six", rc_ptr<int>(new int(6)));
+    ctx_ptr<int> ptr_six(ctx, "six");
+    rc_ptr<int> kept = ctx.get<int>("six");
+
+    ctx.erase("six");
+    REQUIRE_THROWS_AS(*ptr_six, ctx::out_of_range);
+    REQUIRE(*kept == 6);
+
+    ctx.insert("six", rc_ptr<int>(new int(60)));
+    REQUIRE(*ptr_six == 60);
+  }  // erase
+
 }  // ctx_ptr
 
 }  // namespace tests
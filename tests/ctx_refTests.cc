@@ -73,6 +73,30 @@ TEST_CASE("Test ctx_ref", "[ctx_ref]") {
     REQUIRE(toref(five) == 5.);
   }  // doubles
 
+  SECTION("Test following updates") {
+    ctx.insert("six", rc_ptr<int>(new int(6)));
+    ctx_ref<int> six(ctx, "six");
+    REQUIRE(toref(six) == 6);
+
+    ctx.update("six", rc_ptr<int>(new int(66)));
+    REQUIRE(toref(six) == 66);
+    toref(six) = 7;
+    REQUIRE(*ctx.get<int>("six") == 7);
+  }  // updates
+
+  SECTION("Test erasing the key") {
+    ctx.insert("six", rc_ptr<int>(new int(6)));
+    ctx_ref<int> six(ctx, "six");
+    rc_ptr<int> kept = ctx.get<int>("six");
+
+    ctx.erase("six");
+    REQUIRE_THROWS_AS(toref(six), ctx::out_of_range);
+    REQUIRE(*kept == 6);
+
+    ctx.insert("six", rc_ptr<int>(new int(60)));
+    REQUIRE(toref(six) == 60);
+  }  // erase
+
 }  // ctx_ref
 
 }  // namespace tests